@@ -11,6 +11,11 @@
     #include <cstdio>
 #endif
 
+#ifdef __linux__
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
 namespace adt
 {
 
@@ -21,95 +26,235 @@ struct ArenaBlock
     u64 nBytesOccupied {};
     u8* pLastAlloc {};
     u64 lastAllocSize {};
+    u8* pDirtyEnd {}; /* memory past max(pDirtyEnd, bump) was never handed out since it was mapped, it's zero */
     u8 pMem[];
 };
 
-/* fast region based allocator, only freeAll() free's memory, free() does nothing */
+/* where blocks come from, the mmap ones fall back to HEAP outside of linux */
+enum class ARENA_BACKING : u8
+{
+    HEAP, /* aligned_alloc */
+    MMAP, /* anonymous mappings, zalloc trusts fresh pages, reset gives pages back (MADV_DONTNEED) */
+    HUGE_PAGES, /* MMAP in 2M aligned multiples of 2M, with MAP_HUGETLB when possible, MADV_HUGEPAGE otherwise */
+};
+
+/* fast region based allocator, only freeAll() free's memory, free() does nothing.
+ * Blocks are aligned to blockAlign so realloc finds a pointer's block by masking,
+ * allocations that don't fit a regular block get a block of their own. */
 struct Arena
 {
     IAllocator super {};
-    u64 defaultCapacity {};
-    ArenaBlock* pBlocks {};
+    u64 defaultCapacity {}; /* usable bytes of a regular block */
+    u64 blockAlign {}; /* power of 2, ptr & ~(blockAlign - 1) is the owning ArenaBlock */
+    ArenaBlock* pBlocks {}; /* blocks in use, newest first */
+    ArenaBlock* pCur {}; /* regular block we bump from */
+    ArenaBlock* pFree {}; /* regular blocks kept by ArenaReset() */
+    ArenaBlock* pFreeBig {}; /* oversized blocks kept by ArenaReset(), largest first */
+    ARENA_BACKING eBacking {};
 
     Arena() = default;
-    Arena(u64 capacity);
+    Arena(u64 capacity, ARENA_BACKING eBacking = ARENA_BACKING::HEAP);
+};
+
+/* position to roll an Arena back to, see ArenaSave() */
+struct ArenaMarker
+{
+    ArenaBlock* pBlocks {};
+    ArenaBlock* pCur {};
+    u8* pLastAlloc {};
+    u64 lastAllocSize {};
+    u64 nBytesOccupied {};
 };
 
 [[nodiscard]] inline void* ArenaAlloc(Arena* s, u64 mCount, u64 mSize);
 [[nodiscard]] inline void* ArenaZalloc(Arena* s, u64 mCount, u64 mSize);
 [[nodiscard]] inline void* ArenaRealloc(Arena* s, void* ptr, u64 mCount, u64 mSize);
+/* only the last allocation of a block can grow */
+[[nodiscard]] inline bool ArenaTryExpand(Arena* s, void* ptr, u64 mCount, u64 mSize);
 inline void ArenaFree(Arena* s, void* ptr);
 inline void ArenaFreeAll(Arena* s);
 inline void ArenaReset(Arena* s);
+/* Everything allocated after the save is gone after the restore.
+ * Don't grow (realloc) allocations made before the save while it's active. */
+[[nodiscard]] inline ArenaMarker ArenaSave(Arena* s);
+/* bRelease: free the blocks taken after the save instead of keeping them for reuse */
+inline void ArenaRestore(Arena* s, ArenaMarker marker, bool bRelease = false);
+[[nodiscard]] inline AllocatorUsage ArenaUsage(const Arena* s);
 
 [[nodiscard]] inline void* alloc(Arena* s, u64 mCount, u64 mSize) { return ArenaAlloc(s, mCount, mSize); }
 [[nodiscard]] inline void* zalloc(Arena* s, u64 mCount, u64 mSize) { return ArenaZalloc(s, mCount, mSize); }
 [[nodiscard]] inline void* realloc(Arena* s, void* ptr, u64 mCount, u64 mSize) { return ArenaRealloc(s, ptr, mCount, mSize); }
 inline void free(Arena* s, void* ptr) { return ArenaFree(s, ptr); }
 inline void freeAll(Arena* s) { return ArenaFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(Arena* s, void* ptr, u64 mCount, u64 mSize) { return ArenaTryExpand(s, ptr, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(const Arena* s) { return ArenaUsage(s); }
 
+/* only valid for pointers returned by this arena, oversized blocks hold a single allocation at pMem */
 [[nodiscard]] inline ArenaBlock*
 _ArenaFindBlockFromPtr(Arena* s, u8* ptr)
 {
-    auto* it = s->pBlocks;
-    while (it)
-    {
-        if (ptr >= it->pMem && ptr < &it->pMem[it->size])
-            return it;
+    return (ArenaBlock*)(u64(ptr) & ~(s->blockAlign - 1));
+}
+
+[[nodiscard]] inline bool
+_ArenaIsRegular(Arena* s, ArenaBlock* pBlock)
+{
+    return pBlock->size == s->defaultCapacity;
+}
+
+/* HUGE_PAGES blocks are at least this big and aligned to it, a huge page needs a whole aligned range */
+constexpr u64 ARENA_HUGE_PAGE_SIZE = SIZE_1M * 2;
+
+#ifdef __linux__
+
+/* mmap only guarantees granularity alignment, map extra and trim the ends */
+[[nodiscard]] inline void*
+_ArenaMapAligned(u64 total, u64 alignment, u64 granularity, int flags)
+{
+    u64 extra = alignment > granularity ? alignment : 0;
+    u8* pRaw = (u8*)mmap(nullptr, total + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (pRaw == MAP_FAILED) return nullptr;
+    if (!extra) return pRaw;
 
-        it = it->pNext;
+    u8* p = (u8*)align(u64(pRaw), alignment);
+    if (p > pRaw) munmap(pRaw, p - pRaw);
+    if (p + total < pRaw + total + extra) munmap(p + total, (pRaw + total + extra) - (p + total));
+
+    return p;
+}
+
+[[nodiscard]] inline void*
+_ArenaMapBlock(Arena* s, u64 total)
+{
+    const u64 pageSize = sysconf(_SC_PAGESIZE);
+
+    if (s->eBacking == ARENA_BACKING::HUGE_PAGES)
+    {
+        /* total and blockAlign are multiples of ARENA_HUGE_PAGE_SIZE here,
+         * MAP_HUGETLB needs reserved hugetlbfs pages, usually there are none */
+        void* p = _ArenaMapAligned(total, s->blockAlign, ARENA_HUGE_PAGE_SIZE, MAP_HUGETLB);
+        if (p) return p;
+
+        p = _ArenaMapAligned(total, s->blockAlign, pageSize, 0);
+        if (p) madvise(p, total, MADV_HUGEPAGE);
+        return p;
     }
 
-    return nullptr;
+    return _ArenaMapAligned(total, s->blockAlign, pageSize, 0);
 }
 
+#endif
+
+/* nullptr when out of memory, ArenaAlloc() passes it on */
 [[nodiscard]] inline ArenaBlock*
-_ArenaFindFittingBlock(Arena* s, u64 size)
+_ArenaAllocBlock(Arena* s, u64 size)
 {
-    auto* it = s->pBlocks;
-    while (it)
+    /* not zeroed, fresh memory is lazily zeroed by the os anyway and reset blocks never were */
+    u64 total = align(size + sizeof(ArenaBlock), s->blockAlign);
+
+    ArenaBlock* pBlock;
+    bool bFresh = false;
+#ifdef __linux__
+    if (s->eBacking != ARENA_BACKING::HEAP)
     {
-        if (it->size - it->nBytesOccupied > size)
-            return it;
+        pBlock = (ArenaBlock*)_ArenaMapBlock(s, total);
+        bFresh = true;
+    }
+    else
+#endif
+    pBlock = (ArenaBlock*)::aligned_alloc(s->blockAlign, total);
+
+    if (!pBlock) return nullptr;
+
+    *pBlock = {.size = total - sizeof(ArenaBlock)};
+    pBlock->pLastAlloc = pBlock->pMem;
+    pBlock->pDirtyEnd = bFresh ? pBlock->pMem : pBlock->pMem + pBlock->size;
+
+    return pBlock;
+}
 
-        it = it->pNext;
+inline void
+_ArenaFreeBlock(Arena* s, ArenaBlock* pBlock)
+{
+#ifdef __linux__
+    if (s->eBacking != ARENA_BACKING::HEAP)
+    {
+        munmap(pBlock, pBlock->size + sizeof(ArenaBlock));
+        return;
     }
+#else
+    (void)s;
+#endif
 
-    return nullptr;
+    ::free(pBlock);
 }
 
-[[nodiscard]] inline ArenaBlock*
-_ArenaAllocBlock(u64 size)
+/* bump is about to move back, remember how far it got */
+inline void
+_ArenaMarkDirty(ArenaBlock* pBlock)
 {
-    ArenaBlock* pBlock = (ArenaBlock*)::calloc(1, size + sizeof(ArenaBlock));
-    pBlock->size = size;
-    pBlock->pLastAlloc = pBlock->pMem;
+    u8* pBump = pBlock->pLastAlloc + pBlock->lastAllocSize;
+    if (pBump > pBlock->pDirtyEnd) pBlock->pDirtyEnd = pBump;
+}
+
+inline ArenaBlock*
+_ArenaPushBlock(Arena* s, ArenaBlock* pBlock)
+{
+    pBlock->pNext = s->pBlocks;
+    s->pBlocks = pBlock;
 
     return pBlock;
 }
 
 [[nodiscard]] inline ArenaBlock*
-_ArenaPrependBlock(Arena* s, u64 size)
+_ArenaTakeBlock(Arena* s)
+{
+    ArenaBlock* pBlock = s->pFree;
+    if (pBlock) s->pFree = pBlock->pNext;
+    else pBlock = _ArenaAllocBlock(s, s->defaultCapacity);
+
+    if (!pBlock) return nullptr;
+
+    return _ArenaPushBlock(s, pBlock);
+}
+
+/* gets its own block, extra room lets realloc grow it in place */
+[[nodiscard]] inline void*
+_ArenaAllocBig(Arena* s, u64 realSize)
 {
-    auto* pNew = _ArenaAllocBlock(size);
-    pNew->pNext = s->pBlocks;
-    s->pBlocks = pNew;
+#if defined ADT_DBG_MEMORY
+    fprintf(stderr, "[Arena]: allocating more than defaultCapacity (%llu, %llu)\n", s->defaultCapacity, realSize);
+#endif
+
+    ArenaBlock* pBlock = s->pFreeBig;
+    if (pBlock && pBlock->size >= realSize) s->pFreeBig = pBlock->pNext;
+    else pBlock = _ArenaAllocBlock(s, realSize*2);
+
+    if (!pBlock) return nullptr;
+
+    _ArenaPushBlock(s, pBlock);
+    pBlock->pLastAlloc = pBlock->pMem;
+    pBlock->nBytesOccupied = realSize;
+    pBlock->lastAllocSize = realSize;
 
-    return pNew;
+    return pBlock->pMem;
 }
 
 inline void*
 ArenaAlloc(Arena* s, u64 mCount, u64 mSize)
 {
-    u64 realSize = align8(mCount * mSize);
-    auto* pBlock = _ArenaFindFittingBlock(s, realSize);
+    /* 0 bytes still take 8: the bump position of a full block is its end, which would mask to the next region */
+    u64 realSize = align8(utils::max(mCount * mSize, u64(1)));
+    auto* pBlock = s->pCur;
 
-#if defined ADT_DBG_MEMORY
-    if (s->defaultCapacity <= realSize)
-        fprintf(stderr, "[Arena]: allocating more than defaultCapacity (%llu, %llu)\n", s->defaultCapacity, realSize);
-#endif
+    if (!pBlock || pBlock->size - pBlock->nBytesOccupied < realSize)
+    {
+        if (realSize > s->defaultCapacity) return _ArenaAllocBig(s, realSize);
 
-    if (!pBlock) pBlock = _ArenaPrependBlock(s, utils::max(s->defaultCapacity, realSize*2));
+        pBlock = _ArenaTakeBlock(s);
+        if (!pBlock) return nullptr;
+        s->pCur = pBlock;
+    }
 
     auto* pRet = pBlock->pLastAlloc + pBlock->lastAllocSize;
 
@@ -123,8 +268,16 @@ ArenaAlloc(Arena* s, u64 mCount, u64 mSize)
 inline void*
 ArenaZalloc(Arena* s, u64 mCount, u64 mSize)
 {
-    auto* p = ArenaAlloc(s, mCount, mSize);
-    memset(p, 0, mCount * mSize);
+    u8* p = (u8*)ArenaAlloc(s, mCount, mSize);
+    if (!p) return nullptr;
+
+    u64 size = mCount * mSize;
+
+    /* p is the old bump position, everything past it and past pDirtyEnd is still zero */
+    auto* pBlock = _ArenaFindBlockFromPtr(s, p);
+    if (p < pBlock->pDirtyEnd)
+        memset(p, 0, utils::min(size, u64(pBlock->pDirtyEnd - p)));
+
     return p;
 }
 
@@ -133,33 +286,42 @@ ArenaRealloc(Arena* s, void* ptr, u64 mCount, u64 mSize)
 {
     if (!ptr) return ArenaAlloc(s, mCount, mSize);
 
+    if (ArenaTryExpand(s, ptr, mCount, mSize)) return ptr;
+
+    u64 requested = mSize * mCount;
+    auto* pBlock = _ArenaFindBlockFromPtr(s, (u8*)ptr);
+
+    auto* pRet = ArenaAlloc(s, mCount, mSize);
+    if (!pRet) return nullptr;
+
+    u64 nBytesUntilEndOfBlock = &pBlock->pMem[pBlock->size] - (u8*)ptr;
+    u64 nBytesToCopy = utils::min(requested, nBytesUntilEndOfBlock); /* out of range memcpy */
+    nBytesToCopy = utils::min(nBytesToCopy, u64((u8*)pRet - (u8*)ptr)); /* overlap memcpy */
+    memcpy(pRet, ptr, nBytesToCopy);
+
+    return pRet;
+}
+
+inline bool
+ArenaTryExpand(Arena* s, void* ptr, u64 mCount, u64 mSize)
+{
     u64 requested = mSize * mCount;
     u64 realSize = align8(requested);
     auto* pBlock = _ArenaFindBlockFromPtr(s, (u8*)ptr);
 
     assert(pBlock && "[Arena]: pointer doesn't belong to this arena");
 
-    if (ptr == pBlock->pLastAlloc &&
-        pBlock->pLastAlloc + realSize < pBlock->pMem + pBlock->size) /* bump case */
-    {
-        if (pBlock->lastAllocSize >= requested) return ptr;
+    if (ptr != pBlock->pLastAlloc || pBlock->pLastAlloc + realSize > pBlock->pMem + pBlock->size)
+        return false;
 
-        pBlock->nBytesOccupied -= pBlock->lastAllocSize;
-        pBlock->nBytesOccupied += realSize;
-        pBlock->lastAllocSize = realSize;
+    /* bump case */
+    if (pBlock->lastAllocSize >= requested) return true;
 
-        return ptr;
-    }
-    else
-    {
-        auto* pRet = ArenaAlloc(s, mCount, mSize);
-        u64 nBytesUntilEndOfBlock = &pBlock->pMem[pBlock->size] - (u8*)ptr;
-        u64 nBytesToCopy = utils::min(requested, nBytesUntilEndOfBlock); /* out of range memcpy */
-        nBytesToCopy = utils::min(nBytesToCopy, u64((u8*)pRet - (u8*)ptr)); /* overlap memcpy */
-        memcpy(pRet, ptr, nBytesToCopy);
+    pBlock->nBytesOccupied -= pBlock->lastAllocSize;
+    pBlock->nBytesOccupied += realSize;
+    pBlock->lastAllocSize = realSize;
 
-        return pRet;
-    }
+    return true;
 }
 
 inline void
@@ -169,16 +331,64 @@ ArenaFree([[maybe_unused]] Arena* s, [[maybe_unused]] void* ptr)
 }
 
 inline void
-ArenaFreeAll(Arena* s)
+_ArenaFreeList(Arena* s, ArenaBlock* it)
 {
-    auto* it = s->pBlocks;
     while (it)
     {
         auto* next = it->pNext;
-        ::free(it);
+        _ArenaFreeBlock(s, it);
         it = next;
     }
-    s->pBlocks = nullptr;
+}
+
+inline void
+ArenaFreeAll(Arena* s)
+{
+    _ArenaFreeList(s, s->pBlocks);
+    _ArenaFreeList(s, s->pFree);
+    _ArenaFreeList(s, s->pFreeBig);
+
+    s->pBlocks = s->pCur = s->pFree = s->pFreeBig = nullptr;
+}
+
+/* back to the free lists, empty */
+inline void
+_ArenaRecycleBlock(Arena* s, ArenaBlock* pBlock)
+{
+    _ArenaMarkDirty(pBlock);
+    pBlock->nBytesOccupied = 0;
+    pBlock->lastAllocSize = 0;
+    pBlock->pLastAlloc = pBlock->pMem;
+
+    if (_ArenaIsRegular(s, pBlock))
+    {
+        pBlock->pNext = s->pFree;
+        s->pFree = pBlock;
+    }
+    else
+    {
+        /* keep them sorted so _ArenaAllocBig() only looks at the head */
+        ArenaBlock** ppIns = &s->pFreeBig;
+        while (*ppIns && (*ppIns)->size > pBlock->size) ppIns = &(*ppIns)->pNext;
+        pBlock->pNext = *ppIns;
+        *ppIns = pBlock;
+    }
+}
+
+/* hand the touched pages back, they fault in as zeroes again */
+inline void
+_ArenaDecommitBlock(ArenaBlock* pBlock)
+{
+#ifdef __linux__
+    const u64 pageSize = sysconf(_SC_PAGESIZE);
+    u8* pFirst = (u8*)align(u64(pBlock->pMem), pageSize); /* the header's page stays */
+    if (pBlock->pDirtyEnd <= pFirst) return;
+
+    madvise(pFirst, align(pBlock->pDirtyEnd - pFirst, pageSize), MADV_DONTNEED);
+    pBlock->pDirtyEnd = pFirst;
+#else
+    (void)pBlock;
+#endif
 }
 
 inline void
@@ -187,12 +397,78 @@ ArenaReset(Arena* s)
     auto* it = s->pBlocks;
     while (it)
     {
-        it->nBytesOccupied = 0;
-        it->lastAllocSize = 0;
-        it->pLastAlloc = it->pMem;
+        auto* next = it->pNext;
+        _ArenaRecycleBlock(s, it);
+        if (s->eBacking != ARENA_BACKING::HEAP) _ArenaDecommitBlock(it);
+        it = next;
+    }
+
+    s->pBlocks = s->pCur = nullptr;
+}
+
+inline ArenaMarker
+ArenaSave(Arena* s)
+{
+    ArenaMarker r {.pBlocks = s->pBlocks, .pCur = s->pCur};
+    if (s->pCur)
+    {
+        r.pLastAlloc = s->pCur->pLastAlloc;
+        r.lastAllocSize = s->pCur->lastAllocSize;
+        r.nBytesOccupied = s->pCur->nBytesOccupied;
+    }
+
+    return r;
+}
+
+inline void
+ArenaRestore(Arena* s, ArenaMarker marker, bool bRelease)
+{
+    /* blocks are pushed to the front, everything before marker.pBlocks is newer */
+    while (s->pBlocks != marker.pBlocks)
+    {
+        assert(s->pBlocks && "[Arena]: marker doesn't belong to this arena (or it was reset)");
+
+        auto* it = s->pBlocks;
+        s->pBlocks = it->pNext;
+
+        if (bRelease) _ArenaFreeBlock(s, it);
+        else _ArenaRecycleBlock(s, it);
+    }
+
+    s->pCur = marker.pCur;
+    if (s->pCur)
+    {
+        _ArenaMarkDirty(s->pCur);
+        s->pCur->pLastAlloc = marker.pLastAlloc;
+        s->pCur->lastAllocSize = marker.lastAllocSize;
+        s->pCur->nBytesOccupied = marker.nBytesOccupied;
+    }
+}
+
+inline AllocatorUsage
+ArenaUsage(const Arena* s)
+{
+    AllocatorUsage r {};
+
+    for (auto* it = s->pBlocks; it; it = it->pNext)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += it->size + sizeof(ArenaBlock);
+        r.nBytesUsed += it->nBytesOccupied;
+    }
 
-        it = it->pNext;
+    /* kept by reset for reuse */
+    ArenaBlock* aFreeLists[] {s->pFree, s->pFreeBig};
+    for (auto* pList : aFreeLists)
+    {
+        for (auto* it = pList; it; it = it->pNext)
+        {
+            ++r.nBlocks;
+            r.nBytesReserved += it->size + sizeof(ArenaBlock);
+        }
     }
+
+    return r;
 }
 
 inline const AllocatorVTable inl_ArenaVTable {
@@ -201,11 +477,33 @@ inline const AllocatorVTable inl_ArenaVTable {
     .realloc = decltype(AllocatorVTable::realloc)(ArenaRealloc),
     .free = decltype(AllocatorVTable::free)(ArenaFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(ArenaFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(ArenaTryExpand),
 };
 
-inline Arena::Arena(u64 capacity)
+inline Arena::Arena(u64 capacity, ARENA_BACKING _eBacking)
     : super(&inl_ArenaVTable),
-      defaultCapacity(align8(capacity)),
-      pBlocks(_ArenaAllocBlock(this->defaultCapacity)) {}
+      blockAlign(utils::max(nextPowerOf2(capacity), _eBacking == ARENA_BACKING::HUGE_PAGES ? ARENA_HUGE_PAGE_SIZE : SIZE_1K * 4)),
+      eBacking(_eBacking)
+{
+    defaultCapacity = blockAlign - sizeof(ArenaBlock);
+    pCur = _ArenaTakeBlock(this);
+}
+
+/* scratch region, restores the arena when it goes out of scope */
+class ArenaScope
+{
+    Arena* pArena;
+    ArenaMarker marker;
+    bool bRelease;
+
+public:
+    ArenaScope(Arena* _pArena, bool _bRelease = false)
+        : pArena(_pArena), marker(ArenaSave(_pArena)), bRelease(_bRelease) {}
+
+    ~ArenaScope() { ArenaRestore(pArena, marker, bRelease); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+};
 
 } /* namespace adt */
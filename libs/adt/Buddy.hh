@@ -5,164 +5,215 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 
 namespace adt
 {
 
+constexpr u64 BUDDY_MIN_SIZE = 32; /* order 0, fits a BuddyFreeNode */
+constexpr u32 BUDDY_MIN_SHIFT = 5;
+constexpr u32 BUDDY_MAX_ORDERS = 48;
+
+/* Blocks are blockSize aligned, so the block of any pointer is found by masking.
+ * The header sits in the first node(s) of the block, which stay allocated forever.
+ * Allocations bigger than half a block get a block of their own (bBig). */
 struct BuddyBlock
 {
     BuddyBlock* pNext {};
+    BuddyBlock* pPrev {};
     u64 size {};
     u64 nBytesOccupied {};
-    u8 pMem[];
+    u8* pSplit {}; /* bit per node of the implicit tree, set: split into two children */
+    u8* pFree {}; /* bit per node, set: sits in a free list */
+    bool bBig {};
 };
 
-struct BuddyNode
+/* lives inside free nodes */
+struct BuddyFreeNode
 {
-    /* NOTE: saving isFree boolean in the leftmost bit and the rest is the size */
-    u64 sizeAndIsFree {};
-    u8 pMem[];
+    BuddyFreeNode* pPrev {};
+    BuddyFreeNode* pNext {};
 };
 
-/* FIXME: terribly slow buddy allocator */
+/* Power of 2 allocator with per order free lists and full coalescing, alloc/free are O(maxOrder).
+ * Nodes carry no header, free() finds the order by walking the split bitmap from the root. */
 struct Buddy
 {
     IAllocator super {};
     BuddyBlock* pBlocks {};
     u64 blockSize {};
+    u32 maxOrder {}; /* order of a whole block */
+    BuddyFreeNode* aFree[BUDDY_MAX_ORDERS] {};
 
     Buddy() = default;
     Buddy(u64 blockSize);
 };
 
-constexpr u64
-BuddyNodeSize(const BuddyNode* s)
+[[nodiscard]] inline void* BuddyAlloc(Buddy* s, u64 nMembers, u64 mSize);
+[[nodiscard]] inline void* BuddyZalloc(Buddy* s, u64 nMembers, u64 mSize);
+[[nodiscard]] inline void* BuddyRealloc(Buddy* s, void* p, u64 nMembers, u64 mSize);
+/* grows by absorbing free right buddies */
+[[nodiscard]] inline bool BuddyTryExpand(Buddy* s, void* p, u64 nMembers, u64 mSize);
+inline void BuddyFree(Buddy* s, void* p);
+inline void BuddyFreeAll(Buddy* s);
+[[nodiscard]] inline AllocatorUsage BuddyUsage(const Buddy* s);
+
+[[nodiscard]] inline void* alloc(Buddy* s, u64 mCount, u64 mSize) { return BuddyAlloc(s, mCount, mSize); }
+[[nodiscard]] inline void* zalloc(Buddy* s, u64 mCount, u64 mSize) { return BuddyZalloc(s, mCount, mSize); }
+[[nodiscard]] inline void* realloc(Buddy* s, void* p, u64 mCount, u64 mSize) { return BuddyRealloc(s, p, mCount, mSize); }
+inline void free(Buddy* s, void* p) { BuddyFree(s, p); }
+inline void freeAll(Buddy* s) { BuddyFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(Buddy* s, void* p, u64 mCount, u64 mSize) { return BuddyTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(const Buddy* s) { return BuddyUsage(s); }
+
+/* offset of big allocations from their block */
+constexpr u64 BUDDY_BIG_OFFSET = align(sizeof(BuddyBlock), 16);
+
+constexpr bool _BuddyBit(const u8* a, u64 i) { return a[i >> 3] & (1 << (i & 7)); }
+constexpr void _BuddyBitSet(u8* a, u64 i) { a[i >> 3] |= (1 << (i & 7)); }
+constexpr void _BuddyBitClear(u8* a, u64 i) { a[i >> 3] &= ~(1 << (i & 7)); }
+
+[[nodiscard]] inline BuddyBlock*
+_BuddyBlockFromPtr(Buddy* s, void* p)
 {
-    return s->sizeAndIsFree & ~(1UL << 63);
+    return (BuddyBlock*)(u64(p) & ~(s->blockSize - 1));
 }
 
-constexpr bool
-BuddyNodeIsFree(const BuddyNode* s)
+[[nodiscard]] constexpr u64
+_BuddyNodeSize(u32 order)
 {
-    return s->sizeAndIsFree & (1UL << 63);
+    return BUDDY_MIN_SIZE << order;
 }
 
-constexpr void
-BuddyNodeSetFree(BuddyNode* s, bool bFree)
+/* smallest order that fits size */
+[[nodiscard]] constexpr u32
+_BuddyOrderFor(u64 size)
 {
-    bFree ? s->sizeAndIsFree |= (1UL << 63) : s->sizeAndIsFree &= ~(1UL << 63);
+    if (size <= BUDDY_MIN_SIZE) return 0;
+    return 64 - __builtin_clzll(size - 1) - BUDDY_MIN_SHIFT;
 }
 
-constexpr void
-BuddyNodeSetSizeSetFree(BuddyNode* s, u64 size, bool bFree)
+/* index in the implicit tree, root is 0, children of i are 2i+1 and 2i+2 */
+[[nodiscard]] inline u64
+_BuddyNodeIdx(Buddy* s, BuddyBlock* pBlock, void* p, u32 order)
 {
-    s->sizeAndIsFree = size;
-    BuddyNodeSetFree(s, bFree);
+    u64 off = (u8*)p - (u8*)pBlock;
+    return ((1ULL << (s->maxOrder - order)) - 1) + (off >> (BUDDY_MIN_SHIFT + order));
 }
 
-constexpr BuddyNode*
-BuddyNodeFromBlock(const BuddyBlock* pBlock)
+inline void
+_BuddyPushFree(Buddy* s, BuddyBlock* pBlock, void* p, u32 order)
 {
-    return (BuddyNode*)pBlock->pMem;
+    auto* pNode = (BuddyFreeNode*)p;
+    *pNode = {.pPrev = nullptr, .pNext = s->aFree[order]};
+    if (s->aFree[order]) s->aFree[order]->pPrev = pNode;
+    s->aFree[order] = pNode;
+
+    _BuddyBitSet(pBlock->pFree, _BuddyNodeIdx(s, pBlock, p, order));
 }
 
-constexpr BuddyNode*
-BuddyNodeNext(const BuddyNode* s)
+inline void
+_BuddyRemoveFree(Buddy* s, BuddyBlock* pBlock, void* p, u32 order)
 {
-    return (BuddyNode*)((u8*)s + BuddyNodeSize(s));
+    auto* pNode = (BuddyFreeNode*)p;
+    if (pNode->pPrev) pNode->pPrev->pNext = pNode->pNext;
+    else s->aFree[order] = pNode->pNext;
+    if (pNode->pNext) pNode->pNext->pPrev = pNode->pPrev;
+
+    _BuddyBitClear(pBlock->pFree, _BuddyNodeIdx(s, pBlock, p, order));
 }
 
-constexpr BuddyNode*
-BuddyNodeFromPtr(void* p)
+/* split p (of order) down to want, the right halves go to the free lists */
+inline void
+_BuddySplit(Buddy* s, BuddyBlock* pBlock, u8* p, u32 order, u32 want)
 {
-    return (BuddyNode*)((u8*)p - sizeof(BuddyNode));
+    while (order > want)
+    {
+        _BuddyBitSet(pBlock->pSplit, _BuddyNodeIdx(s, pBlock, p, order));
+        --order;
+        _BuddyPushFree(s, pBlock, p + _BuddyNodeSize(order), order);
+    }
 }
 
-inline BuddyBlock*
-BuddyBlockNew(u64 size)
+/* the allocated node at p is the first one on the way down that isn't split */
+[[nodiscard]] inline u32
+_BuddyOrderOf(Buddy* s, BuddyBlock* pBlock, void* p)
 {
-    assert(size >= 128 && "[Buddy]: too small");
+    u32 order = s->maxOrder;
+    while (order > 0 && _BuddyBit(pBlock->pSplit, _BuddyNodeIdx(s, pBlock, p, order)))
+        --order;
 
-    u64 aligned = nextPowerOf2(size);
-    auto* pNewBlock = (BuddyBlock*)::calloc(1, aligned + sizeof(BuddyBlock));
-    pNewBlock->size = aligned + sizeof(BuddyBlock);
-
-    BuddyNode* pNode = BuddyNodeFromBlock(pNewBlock);
-    BuddyNodeSetSizeSetFree(pNode, aligned, true);
+    return order;
+}
 
-    return pNewBlock;
-};
+inline void
+_BuddyLinkBlock(Buddy* s, BuddyBlock* pBlock)
+{
+    pBlock->pPrev = nullptr;
+    pBlock->pNext = s->pBlocks;
+    if (s->pBlocks) s->pBlocks->pPrev = pBlock;
+    s->pBlocks = pBlock;
+}
 
-inline BuddyBlock*
-BuddyBlockPrepend(Buddy* s, u64 size)
+inline void
+_BuddyUnlinkBlock(Buddy* s, BuddyBlock* pBlock)
 {
-    assert(s->pBlocks && "[Buddy]: ininitialized prepend");
-    auto* pNew = BuddyBlockNew(size);
-    pNew->pNext = s->pBlocks;
-    s->pBlocks = pNew;
+    if (pBlock->pPrev) pBlock->pPrev->pNext = pBlock->pNext;
+    else s->pBlocks = pBlock->pNext;
+    if (pBlock->pNext) pBlock->pNext->pPrev = pBlock->pPrev;
+}
 
-    return pNew;
+inline void
+_BuddyBlockNew(Buddy* s)
+{
+    auto* pBlock = (BuddyBlock*)::aligned_alloc(s->blockSize, s->blockSize);
+    u64 nBitmapBytes = ((2ULL << s->maxOrder) + 7) / 8;
+    u8* pBits = (u8*)::calloc(2, nBitmapBytes);
+    *pBlock = {.size = s->blockSize, .pSplit = pBits, .pFree = pBits + nBitmapBytes};
+
+    /* header takes the leftmost node */
+    _BuddySplit(s, pBlock, (u8*)pBlock, s->maxOrder, _BuddyOrderFor(sizeof(BuddyBlock)));
+    _BuddyLinkBlock(s, pBlock);
 }
 
-inline BuddyNode*
-BuddyNodeSplit(BuddyNode* s, const u64 size)
+[[nodiscard]] inline void*
+_BuddyAllocBig(Buddy* s, u64 size)
 {
-    while (BuddyNodeSize(s)/2 >= size + sizeof(BuddyNode))
-    {
-        u64 half = BuddyNodeSize(s) / 2;
-        BuddyNodeSetSizeSetFree(s, half, true);
-        s = BuddyNodeNext(s);
-        BuddyNodeSetSizeSetFree(s, half, true);
-    }
+    u64 total = align(BUDDY_BIG_OFFSET + size, s->blockSize);
+    auto* pBlock = (BuddyBlock*)::aligned_alloc(s->blockSize, total);
+    *pBlock = {.size = total, .nBytesOccupied = size, .bBig = true};
+    _BuddyLinkBlock(s, pBlock);
 
-    assert(BuddyNodeIsFree(s) && "mustn't split nonfree node");
-    return s;
+    return (u8*)pBlock + BUDDY_BIG_OFFSET;
 }
 
 inline void*
 BuddyAlloc(Buddy* s, u64 nMembers, u64 mSize)
 {
-    assert(s->pBlocks && "[Buddy]: ininitialized alloc");
+    assert(s->blockSize && "[Buddy]: ininitialized alloc");
 
     u64 requested = nMembers * mSize;
+    u32 order = _BuddyOrderFor(requested);
+    /* the root is never free (header), half a block is the most a node can hold */
+    if (order >= s->maxOrder) return _BuddyAllocBig(s, requested);
 
-    auto* pBlock = s->pBlocks;
-    while (pBlock && pBlock->size - sizeof(BuddyBlock) < requested)
-        pBlock = pBlock->pNext;
+    u32 from = order;
+    while (from < s->maxOrder && !s->aFree[from]) ++from;
 
-    bool bNoBlock = !pBlock;
-    bool bBlockIsOutOfSpace = pBlock && (pBlock->size - sizeof(BuddyBlock)) < (pBlock->nBytesOccupied + nextPowerOf2(requested + sizeof(BuddyNode)));
-    if (bNoBlock || bBlockIsOutOfSpace)
+    if (from == s->maxOrder)
     {
-again:
-        u64 adjSize = utils::max(s->blockSize, requested*2);
-        pBlock = BuddyBlockPrepend(s, adjSize);
+        _BuddyBlockNew(s);
+        from = order;
+        while (!s->aFree[from]) ++from;
     }
 
-    /* find free node that fits requested + sizeof(BuddyNode) */
-    u8* pTail = (u8*)pBlock + pBlock->size;
-    auto* pNode = BuddyNodeFromBlock(pBlock);
-
-    while ((u8*)pNode < pTail)
-    {
-        if (!BuddyNodeIsFree(pNode)) pNode = BuddyNodeNext(pNode);
-        else
-        {
-            if (BuddyNodeSize(pNode) >= requested + sizeof(BuddyNode)) break;
-            else pNode = BuddyNodeNext(pNode);
-        }
-    }
-
-    /* if all the nodes are too small */
-    if ((u8*)pNode == pTail)
-        goto again;
-
-    pNode = BuddyNodeSplit(pNode, requested);
+    u8* p = (u8*)s->aFree[from];
+    auto* pBlock = _BuddyBlockFromPtr(s, p);
+    _BuddyRemoveFree(s, pBlock, p, from);
+    _BuddySplit(s, pBlock, p, from, order);
+    pBlock->nBytesOccupied += _BuddyNodeSize(order);
 
-    BuddyNodeSetFree(pNode, false);
-    pBlock->nBytesOccupied += BuddyNodeSize(pNode);;
-
-    return pNode->pMem;
+    return p;
 }
 
 inline void*
@@ -173,63 +224,89 @@ BuddyZalloc(Buddy* s, u64 nMembers, u64 mSize)
     return p;
 }
 
-inline BuddyBlock*
-BuddyBlockOfNode(Buddy* s, BuddyNode* pNode)
-{
-    assert(s->pBlocks && "[Buddy]: ininitialized");
-    auto* pBlock = s->pBlocks;
-    while (pBlock)
-    {
-        auto* pTail = ((u8*)pBlock + pBlock->size);
-        if ((u8*)pNode > (u8*)pBlock && (u8*)pNode < pTail) break;
-        pBlock = pBlock->pNext;
-    }
-
-    assert(pBlock && "[Buddy]: couldn't find block");
-    return pBlock;
-}
-
-inline void
-BuddyCoalescence([[maybe_unused]] const BuddyBlock* pBlock, [[maybe_unused]] const BuddyNode* pNode)
-{
-    // auto* pTail = ((u8*)pBlock + pBlock->size);
-
-    // auto* pPrev = pNode;
-    // auto* pNext = BuddyNodeNext(pNode);
-
-    // while (pPrev && BuddyNodeIsFree(pPrev) && pNext && BuddyNodeIsFree(pNext))
-    // {
-    //     pPrev = pNext;
-    //     pNext = BuddyNodeNext(pNext);
-    // }
-}
-
 inline void
 BuddyFree(Buddy* s, void* p)
 {
     if (!p) return;
 
-    auto* pNode = BuddyNodeFromPtr(p);
-    auto* pBlock = BuddyBlockOfNode(s, pNode);
-    pBlock->nBytesOccupied -= BuddyNodeSize(pNode);
-    BuddyNodeSetFree(pNode, true);
+    auto* pBlock = _BuddyBlockFromPtr(s, p);
+    if (pBlock->bBig)
+    {
+        _BuddyUnlinkBlock(s, pBlock);
+        ::free(pBlock);
+        return;
+    }
+
+    u32 order = _BuddyOrderOf(s, pBlock, p);
+    assert(!_BuddyBit(pBlock->pFree, _BuddyNodeIdx(s, pBlock, p, order)) && "[Buddy]: double free");
+    pBlock->nBytesOccupied -= _BuddyNodeSize(order);
 
-    /*BuddyCoalescence(pBlock, pNode);*/
+    /* merge with free buddies as far up as possible */
+    u8* pNode = (u8*)p;
+    while (order < s->maxOrder)
+    {
+        u64 off = pNode - (u8*)pBlock;
+        u8* pBuddy = (u8*)pBlock + (off ^ _BuddyNodeSize(order));
+        if (!_BuddyBit(pBlock->pFree, _BuddyNodeIdx(s, pBlock, pBuddy, order))) break;
+
+        _BuddyRemoveFree(s, pBlock, pBuddy, order);
+        pNode = utils::min(pNode, pBuddy);
+        ++order;
+        _BuddyBitClear(pBlock->pSplit, _BuddyNodeIdx(s, pBlock, pNode, order));
+    }
+
+    _BuddyPushFree(s, pBlock, pNode, order);
 }
 
 inline void*
 BuddyRealloc(Buddy* s, void* p, u64 nMembers, u64 mSize)
 {
     if (!p) return BuddyAlloc(s, nMembers, mSize);
+    if (BuddyTryExpand(s, p, nMembers, mSize)) return p;
+
+    auto* pBlock = _BuddyBlockFromPtr(s, p);
+    u64 capacity = pBlock->bBig ?
+        pBlock->size - BUDDY_BIG_OFFSET :
+        _BuddyNodeSize(_BuddyOrderOf(s, pBlock, p));
 
-    auto* pNode = BuddyNodeFromPtr(p);
     void* ret = BuddyAlloc(s, nMembers, mSize);
-    memcpy(ret, p, BuddyNodeSize(pNode) - sizeof(BuddyNode));
+    memcpy(ret, p, capacity);
     BuddyFree(s, p);
 
     return ret;
 }
 
+inline bool
+BuddyTryExpand(Buddy* s, void* p, u64 nMembers, u64 mSize)
+{
+    u64 requested = nMembers * mSize;
+    auto* pBlock = _BuddyBlockFromPtr(s, p);
+    if (pBlock->bBig) return requested <= pBlock->size - BUDDY_BIG_OFFSET;
+
+    u32 order = _BuddyOrderOf(s, pBlock, p);
+    if (requested <= _BuddyNodeSize(order)) return true;
+
+    u32 want = _BuddyOrderFor(requested);
+    if (want >= s->maxOrder) return false;
+
+    /* p has to be the left half on every level up to want, and each right half has to be free */
+    u64 off = (u8*)p - (u8*)pBlock;
+    for (u32 o = order; o < want; ++o)
+    {
+        if (off & _BuddyNodeSize(o)) return false;
+        if (!_BuddyBit(pBlock->pFree, _BuddyNodeIdx(s, pBlock, (u8*)p + _BuddyNodeSize(o), o))) return false;
+    }
+
+    for (u32 o = order; o < want; ++o)
+    {
+        _BuddyRemoveFree(s, pBlock, (u8*)p + _BuddyNodeSize(o), o);
+        _BuddyBitClear(pBlock->pSplit, _BuddyNodeIdx(s, pBlock, p, o + 1));
+    }
+
+    pBlock->nBytesOccupied += _BuddyNodeSize(want) - _BuddyNodeSize(order);
+    return true;
+}
+
 inline void
 BuddyFreeAll(Buddy* s)
 {
@@ -237,9 +314,28 @@ BuddyFreeAll(Buddy* s)
     while (it)
     {
         auto* next = it->pNext;
+        ::free(it->pSplit);
         ::free(it);
         it = next;
     }
+
+    s->pBlocks = nullptr;
+    for (auto& pHead : s->aFree) pHead = nullptr;
+}
+
+inline AllocatorUsage
+BuddyUsage(const Buddy* s)
+{
+    AllocatorUsage r {};
+
+    for (auto* it = s->pBlocks; it; it = it->pNext)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += it->size;
+        r.nBytesUsed += it->nBytesOccupied;
+    }
+
+    return r;
 }
 
 inline const AllocatorVTable inl_BuddyAllocatorVTable {
@@ -248,17 +344,16 @@ inline const AllocatorVTable inl_BuddyAllocatorVTable {
     .realloc = decltype(AllocatorVTable::realloc)(BuddyRealloc),
     .free = decltype(AllocatorVTable::free)(BuddyFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(BuddyFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(BuddyTryExpand),
 };
 
 inline Buddy::Buddy(u64 _blockSize)
     : super(&inl_BuddyAllocatorVTable),
-      pBlocks(BuddyBlockNew(_blockSize)),
-      blockSize(nextPowerOf2(_blockSize)) {}
-
-inline void* alloc(Buddy* s, u64 mCount, u64 mSize) { return BuddyAlloc(s, mCount, mSize); }
-inline void* zalloc(Buddy* s, u64 mCount, u64 mSize) { return BuddyZalloc(s, mCount, mSize); }
-inline void* realloc(Buddy* s, void* p, u64 mCount, u64 mSize) { return BuddyRealloc(s, p, mCount, mSize); }
-inline void free(Buddy* s, void* p) { BuddyFree(s, p); }
-inline void freeAll(Buddy* s) { BuddyFreeAll(s); }
+      blockSize(nextPowerOf2(utils::max(_blockSize, SIZE_1K)))
+{
+    maxOrder = __builtin_ctzll(blockSize) - BUDDY_MIN_SHIFT;
+    assert(maxOrder < BUDDY_MAX_ORDERS && "[Buddy]: block size too big");
+    _BuddyBlockNew(this);
+}
 
 } /* namespace adt */
@@ -15,12 +15,17 @@ struct ChunkAllocator;
 inline void* ChunkAlloc(ChunkAllocator* s, u64 ignored0, u64 ignored1);
 inline void* ChunkZalloc(ChunkAllocator* s, u64 ignored0, u64 ignored1);
 inline void ChunkFree(ChunkAllocator* s, void* p);
+/* fits if it fits the chunk */
+[[nodiscard]] inline bool ChunkTryExpand(ChunkAllocator* s, void* p, u64 mCount, u64 mSize);
 inline void ChunkFreeAll(ChunkAllocator* s);
+[[nodiscard]] inline AllocatorUsage ChunkUsage(const ChunkAllocator* s);
 
 inline void* alloc(ChunkAllocator* s, u64 mCount, u64 mSize) { return ChunkAlloc(s, mCount, mSize); }
 inline void* zalloc(ChunkAllocator* s, u64 mCount, u64 mSize) { return ChunkZalloc(s, mCount, mSize); }
 inline void free(ChunkAllocator* s, void* p) { ChunkFree(s, p); }
 inline void freeAll(ChunkAllocator* s) { ChunkFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(ChunkAllocator* s, void* p, u64 mCount, u64 mSize) { return ChunkTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(const ChunkAllocator* s) { return ChunkUsage(s); }
 
 struct ChunkAllocatorNode
 {
@@ -117,6 +122,12 @@ _ChunkRealloc(
     return nullptr;
 }
 
+inline bool
+ChunkTryExpand(ChunkAllocator* s, [[maybe_unused]] void* p, u64 mCount, u64 mSize)
+{
+    return mCount * mSize <= s->chunkSize - sizeof(ChunkAllocatorNode);
+}
+
 inline void
 ChunkFree(ChunkAllocator* s, void* p)
 {
@@ -153,12 +164,28 @@ ChunkFreeAll(ChunkAllocator* s)
     s->pBlocks = nullptr;
 }
 
+inline AllocatorUsage
+ChunkUsage(const ChunkAllocator* s)
+{
+    AllocatorUsage r {};
+
+    for (auto* it = s->pBlocks; it; it = it->next)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += s->blockCap + sizeof(ChunkAllocatorBlock);
+        r.nBytesUsed += it->used;
+    }
+
+    return r;
+}
+
 inline const AllocatorVTable inl_chunkAllocatorVTable {
     .alloc = decltype(AllocatorVTable::alloc)(ChunkAlloc),
     .zalloc = decltype(AllocatorVTable::zalloc)(ChunkZalloc),
     .realloc = decltype(AllocatorVTable::realloc)(_ChunkRealloc),
     .free = decltype(AllocatorVTable::free)(ChunkFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(ChunkFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(ChunkTryExpand),
 };
 
 inline
@@ -0,0 +1,447 @@
+/* Thread safe hashmap made of MapBase shards.
+ * The top bits of the key hash pick a shard, each shard has its own mutex for writers and a sequence counter,
+ * so lookups never take a lock: they copy the shard's MapBase, search it and retry if a writer got in between.
+ * Replaced bucket arrays are retired and freed by a later writer, once the lock-free readers of the epoch
+ * they were replaced in have left the shard. Readers are short, so that usually takes a write or two, even under load.
+ * Lock-free readers compare keys that may be torn, that's why K and V have to be trivially copyable
+ * (plain integer/hash keys are the intended use).
+ * The allocator is called from whichever thread inserts, it has to be thread safe (OsAllocator, MutexArena, ThreadArena...). */
+
+#pragma once
+
+#include "Map.hh"
+#include "Opt.hh"
+
+#include <stdatomic.h>
+#include <threads.h>
+#include <type_traits>
+
+#if defined __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace adt
+{
+
+constexpr u32 CONCURRENT_MAP_DEFAULT_SHARDS = 64;
+constexpr u32 CONCURRENT_MAP_READ_TRIES = 64; /* optimistic reads before waiting for the lock */
+
+template<typename V>
+struct ConcurrentMapResult
+{
+    V val {}; /* inserted or the one that was already there */
+    MAP_RESULT_STATUS eStatus {};
+};
+
+template<typename K, typename V>
+struct ConcurrentMapRetired
+{
+    MapBucket<K, V>* pBuckets;
+    u32 epoch; /* shard epoch it was replaced in */
+};
+
+/* own cache line, so writers on neighbouring shards don't invalidate each other's sequence counters */
+template<typename K, typename V>
+struct alignas(CACHE_LINE_SIZE) ConcurrentMapShard
+{
+    atomic_uint seq; /* odd while a writer changes the map */
+    atomic_uint epoch; /* bumped by writers while there are retired arrays */
+    atomic_uint aReaders[2]; /* lock-free searches in progress, by epoch parity */
+    mtx_t mtx;
+    MapBase<K, V> map;
+    u32 nRemoved; /* since the last rebuild, tombstones are only cleared by rebuilding */
+    VecBase<ConcurrentMapRetired<K, V>> vRetired; /* old bucket arrays readers might still look at */
+};
+
+template<typename K, typename V>
+struct ConcurrentMap
+{
+    IAllocator* pAlloc {};
+    void* pShardsMem {};
+    ConcurrentMapShard<K, V>* aShards {}; /* aligned inside pShardsMem */
+    u32 shardMask {};
+
+    ConcurrentMap() = default;
+    ConcurrentMap(IAllocator* p, u32 nShards = CONCURRENT_MAP_DEFAULT_SHARDS, u32 prealloc = SIZE_MIN);
+};
+
+template<typename K, typename V>
+[[nodiscard]] inline Opt<V> ConcurrentMapSearch(ConcurrentMap<K, V>* s, const K& key); /* lock-free */
+
+/* does not check for duplicates */
+template<typename K, typename V>
+inline void ConcurrentMapInsert(ConcurrentMap<K, V>* s, const K& key, const V& val);
+
+/* search and insert under one lock, concurrent callers with the same key all get the first value */
+template<typename K, typename V>
+inline ConcurrentMapResult<V> ConcurrentMapTryInsert(ConcurrentMap<K, V>* s, const K& key, const V& val);
+
+/* TryInsert for n keys, sorted by shard first so each shard is locked once.
+ * aOut (optional) gets what TryInsert would return for each key. Returns the number of inserted keys. */
+template<typename K, typename V>
+inline u32 ConcurrentMapTryInsertMany(ConcurrentMap<K, V>* s, const K* aKeys, const V* aVals, u32 n, V* aOut);
+
+template<typename K, typename V>
+inline bool ConcurrentMapRemove(ConcurrentMap<K, V>* s, const K& key);
+
+/* sum of the shards, not a snapshot while others write */
+template<typename K, typename V>
+[[nodiscard]] inline u32 ConcurrentMapSize(ConcurrentMap<K, V>* s);
+
+template<typename K, typename V>
+[[nodiscard]] inline u32 ConcurrentMapShardsCount(const ConcurrentMap<K, V>* s);
+
+/* not thread safe */
+template<typename K, typename V>
+inline void ConcurrentMapDestroy(ConcurrentMap<K, V>* s);
+
+template<typename K, typename V>
+[[nodiscard]] inline u32
+_ConcurrentMapShardI(const ConcurrentMap<K, V>* s, u64 keyHash)
+{
+    /* MapBase indexes with the low bits */
+    return u32(keyHash >> 40) & s->shardMask;
+}
+
+inline void
+_ConcurrentMapPause()
+{
+#if defined __SSE2__
+    _mm_pause();
+#endif
+}
+
+template<typename K, typename V>
+inline void
+_ConcurrentShardWriteBegin(ConcurrentMapShard<K, V>* pShard)
+{
+    atomic_store_explicit(&pShard->seq, atomic_load_explicit(&pShard->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+template<typename K, typename V>
+inline void
+_ConcurrentShardWriteEnd(ConcurrentMapShard<K, V>* pShard)
+{
+    atomic_store_explicit(&pShard->seq, atomic_load_explicit(&pShard->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/* lock held, inside WriteBegin/End */
+template<typename K, typename V>
+inline void
+_ConcurrentShardInsert(ConcurrentMap<K, V>* s, ConcurrentMapShard<K, V>* pShard, const K& key, const V& val, u64 keyHash)
+{
+    auto* pMap = &pShard->map;
+
+    /* readers probe until an empty bucket, keep tombstones under the load factor too */
+    if (f32(pMap->nOccupied + pShard->nRemoved) >= f32(MapCap(pMap)) * pMap->maxLoadFactor)
+    {
+        /* MapBase() takes the entry count: room for twice the live keys,
+         * the same buckets if tombstones filled the map. Old array stays readable */
+        const u32 nEntries = utils::max(pMap->nOccupied * 2, u32(f32(MapCap(pMap)) * pMap->maxLoadFactor));
+        auto mNew = MapBase<K, V>(s->pAlloc, nEntries);
+        for (u32 i = 0; i < MapCap(pMap); ++i)
+        {
+            auto& bucket = pMap->aBuckets[i];
+            if (bucket.bOccupied) _MapInsertHashed(&mNew, s->pAlloc, bucket.key, bucket.val, hash::func(bucket.key));
+        }
+
+        VecPush(&pShard->vRetired, s->pAlloc, {
+            .pBuckets = pMap->aBuckets.pData, .epoch = atomic_load_explicit(&pShard->epoch, memory_order_relaxed)
+        });
+        *pMap = mNew;
+        pShard->nRemoved = 0;
+    }
+
+    _MapInsertHashed(pMap, s->pAlloc, key, val, keyHash);
+}
+
+/* Lock held, after WriteEnd.
+ * Readers that entered in the current epoch started after every array retired in the previous one was replaced,
+ * so those arrays are free to go once the previous epoch's readers are gone. */
+template<typename K, typename V>
+inline void
+_ConcurrentShardReclaim(ConcurrentMap<K, V>* s, ConcurrentMapShard<K, V>* pShard)
+{
+    if (VecSize(&pShard->vRetired) == 0) return;
+
+    const u32 epoch = atomic_load_explicit(&pShard->epoch, memory_order_relaxed);
+
+    /* pairs with the fence in _ConcurrentMapReadBegin(), a reader not counted here sees the new arrays */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pShard->aReaders[(epoch + 1) & 1], memory_order_acquire) != 0) return;
+
+    u32 nKept = 0;
+    for (auto& retired : pShard->vRetired)
+    {
+        if (retired.epoch == epoch) pShard->vRetired[nKept++] = retired;
+        else free(s->pAlloc, retired.pBuckets);
+    }
+    VecSetSize(&pShard->vRetired, s->pAlloc, nKept);
+
+    /* new readers go to the other counter, the ones that may see what's left drain out of this one */
+    if (nKept > 0) atomic_store_explicit(&pShard->epoch, epoch + 1, memory_order_release);
+}
+
+/* returns the counter to leave through */
+template<typename K, typename V>
+inline atomic_uint*
+_ConcurrentMapReadBegin(ConcurrentMapShard<K, V>* pShard)
+{
+    while (true)
+    {
+        const u32 epoch = atomic_load_explicit(&pShard->epoch, memory_order_acquire);
+        atomic_uint* pReaders = &pShard->aReaders[epoch & 1];
+
+        atomic_fetch_add_explicit(pReaders, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        /* a writer may have checked this counter before we got in */
+        if (atomic_load_explicit(&pShard->epoch, memory_order_relaxed) == epoch) return pReaders;
+
+        atomic_fetch_sub_explicit(pReaders, 1, memory_order_release);
+    }
+}
+
+template<typename K, typename V>
+inline Opt<V>
+ConcurrentMapSearch(ConcurrentMap<K, V>* s, const K& key)
+{
+    u64 keyHash = hash::func(key);
+    auto* pShard = &s->aShards[_ConcurrentMapShardI(s, keyHash)];
+
+    /* keeps retired bucket arrays alive until we leave */
+    atomic_uint* pReaders = _ConcurrentMapReadBegin(pShard);
+
+    for (u32 nTries = 0; nTries < CONCURRENT_MAP_READ_TRIES; ++nTries)
+    {
+        u32 seq = atomic_load_explicit(&pShard->seq, memory_order_acquire);
+        if (seq & 1)
+        {
+            _ConcurrentMapPause();
+            continue;
+        }
+
+        /* bucket pointer and capacity have to come from the same version before probing */
+        MapBase<K, V> snapshot = pShard->map;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&pShard->seq, memory_order_relaxed) != seq) continue;
+
+        Opt<V> ret {};
+        auto f = _MapSearchHashed(&snapshot, key, keyHash);
+        if (f) ret = {f.pData->val};
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&pShard->seq, memory_order_relaxed) == seq)
+        {
+            atomic_fetch_sub_explicit(pReaders, 1, memory_order_release);
+            return ret;
+        }
+    }
+
+    atomic_fetch_sub_explicit(pReaders, 1, memory_order_release);
+
+    /* writers kept the shard busy */
+    mtx_lock(&pShard->mtx);
+    Opt<V> ret {};
+    auto f = _MapSearchHashed(&pShard->map, key, keyHash);
+    if (f) ret = {f.pData->val};
+    mtx_unlock(&pShard->mtx);
+
+    return ret;
+}
+
+template<typename K, typename V>
+inline void
+ConcurrentMapInsert(ConcurrentMap<K, V>* s, const K& key, const V& val)
+{
+    u64 keyHash = hash::func(key);
+    auto* pShard = &s->aShards[_ConcurrentMapShardI(s, keyHash)];
+
+    mtx_lock(&pShard->mtx);
+    _ConcurrentShardWriteBegin(pShard);
+    _ConcurrentShardInsert(s, pShard, key, val, keyHash);
+    _ConcurrentShardWriteEnd(pShard);
+    _ConcurrentShardReclaim(s, pShard);
+    mtx_unlock(&pShard->mtx);
+}
+
+template<typename K, typename V>
+inline ConcurrentMapResult<V>
+ConcurrentMapTryInsert(ConcurrentMap<K, V>* s, const K& key, const V& val)
+{
+    u64 keyHash = hash::func(key);
+    auto* pShard = &s->aShards[_ConcurrentMapShardI(s, keyHash)];
+    ConcurrentMapResult<V> ret {.val = val, .eStatus = MAP_RESULT_STATUS::INSERTED};
+
+    mtx_lock(&pShard->mtx);
+
+    /* found: readers don't have to retry */
+    auto f = _MapSearchHashed(&pShard->map, key, keyHash);
+    if (f)
+    {
+        ret = {.val = f.pData->val, .eStatus = MAP_RESULT_STATUS::FOUND};
+    }
+    else
+    {
+        _ConcurrentShardWriteBegin(pShard);
+        _ConcurrentShardInsert(s, pShard, key, val, keyHash);
+        _ConcurrentShardWriteEnd(pShard);
+        _ConcurrentShardReclaim(s, pShard);
+    }
+
+    mtx_unlock(&pShard->mtx);
+
+    return ret;
+}
+
+template<typename K, typename V>
+inline u32
+ConcurrentMapTryInsertMany(ConcurrentMap<K, V>* s, const K* aKeys, const V* aVals, u32 n, V* aOut)
+{
+    const u32 nShards = ConcurrentMapShardsCount(s);
+
+    auto* aHashes = (u64*)alloc(s->pAlloc, n, sizeof(u64));
+    auto* aOrder = (u32*)alloc(s->pAlloc, n, sizeof(u32));
+    auto* aStarts = (u32*)zalloc(s->pAlloc, nShards + 1, sizeof(u32));
+
+    /* counting sort of the indices by shard */
+    for (u32 i = 0; i < n; ++i)
+    {
+        aHashes[i] = hash::func(aKeys[i]);
+        ++aStarts[_ConcurrentMapShardI(s, aHashes[i]) + 1];
+    }
+    for (u32 i = 0; i < nShards; ++i) aStarts[i + 1] += aStarts[i];
+    for (u32 i = 0; i < n; ++i) aOrder[aStarts[_ConcurrentMapShardI(s, aHashes[i])]++] = i;
+
+    /* aStarts[i] is now the end of shard i */
+    u32 nInserted = 0;
+    for (u32 shardI = 0, start = 0; shardI < nShards; start = aStarts[shardI++])
+    {
+        if (start == aStarts[shardI]) continue;
+
+        auto* pShard = &s->aShards[shardI];
+        mtx_lock(&pShard->mtx);
+        _ConcurrentShardWriteBegin(pShard);
+
+        for (u32 j = start; j < aStarts[shardI]; ++j)
+        {
+            const u32 i = aOrder[j];
+            auto f = _MapSearchHashed(&pShard->map, aKeys[i], aHashes[i]);
+            if (f)
+            {
+                if (aOut) aOut[i] = f.pData->val;
+            }
+            else
+            {
+                _ConcurrentShardInsert(s, pShard, aKeys[i], aVals[i], aHashes[i]);
+                if (aOut) aOut[i] = aVals[i];
+                ++nInserted;
+            }
+        }
+
+        _ConcurrentShardWriteEnd(pShard);
+        _ConcurrentShardReclaim(s, pShard);
+        mtx_unlock(&pShard->mtx);
+    }
+
+    free(s->pAlloc, aStarts);
+    free(s->pAlloc, aOrder);
+    free(s->pAlloc, aHashes);
+
+    return nInserted;
+}
+
+template<typename K, typename V>
+inline bool
+ConcurrentMapRemove(ConcurrentMap<K, V>* s, const K& key)
+{
+    u64 keyHash = hash::func(key);
+    auto* pShard = &s->aShards[_ConcurrentMapShardI(s, keyHash)];
+
+    mtx_lock(&pShard->mtx);
+
+    auto f = _MapSearchHashed(&pShard->map, key, keyHash);
+    if (f)
+    {
+        _ConcurrentShardWriteBegin(pShard);
+        MapRemove(&pShard->map, MapIdx(&pShard->map, f));
+        ++pShard->nRemoved;
+        _ConcurrentShardWriteEnd(pShard);
+        _ConcurrentShardReclaim(s, pShard);
+    }
+
+    mtx_unlock(&pShard->mtx);
+
+    return bool(f);
+}
+
+template<typename K, typename V>
+inline u32
+ConcurrentMapSize(ConcurrentMap<K, V>* s)
+{
+    u32 size = 0;
+    for (u32 i = 0; i < ConcurrentMapShardsCount(s); ++i)
+    {
+        mtx_lock(&s->aShards[i].mtx);
+        size += MapSize(&s->aShards[i].map);
+        mtx_unlock(&s->aShards[i].mtx);
+    }
+
+    return size;
+}
+
+template<typename K, typename V>
+inline u32
+ConcurrentMapShardsCount(const ConcurrentMap<K, V>* s)
+{
+    return s->shardMask + 1;
+}
+
+template<typename K, typename V>
+inline void
+ConcurrentMapDestroy(ConcurrentMap<K, V>* s)
+{
+    for (u32 i = 0; i < ConcurrentMapShardsCount(s); ++i)
+    {
+        auto* pShard = &s->aShards[i];
+
+        for (auto& retired : pShard->vRetired) free(s->pAlloc, retired.pBuckets);
+        VecDestroy(&pShard->vRetired, s->pAlloc);
+        MapDestroy(&pShard->map, s->pAlloc);
+        mtx_destroy(&pShard->mtx);
+    }
+
+    free(s->pAlloc, s->pShardsMem);
+    *s = {};
+}
+
+template<typename K, typename V>
+inline
+ConcurrentMap<K, V>::ConcurrentMap(IAllocator* p, u32 nShards, u32 prealloc)
+    : pAlloc(p), shardMask(u32(nextPowerOf2(nShards)) - 1)
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+        "lock-free lookups copy keys and values that may be torn"
+    );
+
+    /* the allocator only guarantees 16 byte alignment */
+    const u32 n = shardMask + 1;
+    pShardsMem = alloc(p, 1, sizeof(ConcurrentMapShard<K, V>) * n + CACHE_LINE_SIZE);
+    aShards = (ConcurrentMapShard<K, V>*)align(u64(pShardsMem), CACHE_LINE_SIZE);
+
+    for (u32 i = 0; i < n; ++i)
+    {
+        auto* pShard = &aShards[i];
+        atomic_store_explicit(&pShard->seq, 0, memory_order_relaxed);
+        atomic_store_explicit(&pShard->epoch, 0, memory_order_relaxed);
+        atomic_store_explicit(&pShard->aReaders[0], 0, memory_order_relaxed);
+        atomic_store_explicit(&pShard->aReaders[1], 0, memory_order_relaxed);
+        mtx_init(&pShard->mtx, mtx_plain);
+        pShard->map = MapBase<K, V>(p, utils::max(prealloc / n, u32(SIZE_MIN)));
+        pShard->nRemoved = 0;
+        pShard->vRetired = {};
+    }
+}
+
+} /* namespace adt */
@@ -24,15 +24,20 @@ struct FixedAllocator
 constexpr void* FixedAlloc(FixedAllocator* s, u64 mCount, u64 mSize);
 constexpr void* FixedZalloc(FixedAllocator* s, u64 mCount, u64 mSize);
 constexpr void* FixedRealloc(FixedAllocator* s, void* p, u64 mCount, u64 mSize);
+/* only the last allocation can grow */
+[[nodiscard]] constexpr bool FixedTryExpand(FixedAllocator* s, void* p, u64 mCount, u64 mSize);
 constexpr void FixedFree(FixedAllocator* s, void* p);
 constexpr void FixedFreeAll(FixedAllocator* s);
 constexpr void FixedReset(FixedAllocator* s);
+[[nodiscard]] constexpr AllocatorUsage FixedUsage(const FixedAllocator* s);
 
 inline void* alloc(FixedAllocator* s, u64 mCount, u64 mSize) { return FixedAlloc(s, mCount, mSize); }
 inline void* zalloc(FixedAllocator* s, u64 mCount, u64 mSize) { return FixedZalloc(s, mCount, mSize); }
 inline void* realloc(FixedAllocator* s, void* p, u64 mCount, u64 mSize) { return FixedRealloc(s, p, mCount, mSize); }
 inline void free(FixedAllocator* s, void* p) { return FixedFree(s, p); }
 inline void freeAll(FixedAllocator* s) { return FixedFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(FixedAllocator* s, void* p, u64 mCount, u64 mSize) { return FixedTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(const FixedAllocator* s) { return FixedUsage(s); }
 
 constexpr void*
 FixedAlloc(FixedAllocator* s, u64 mCount, u64 mSize)
@@ -76,6 +81,7 @@ FixedRealloc(FixedAllocator* s, void* p, u64 mCount, u64 mSize)
         s->pLastAlloc = ret;
         u64 nBytesUntilEndOfBlock = s->cap - s->size;
         u64 nBytesToCopy = utils::min(aligned, nBytesUntilEndOfBlock);
+        nBytesToCopy = utils::min(nBytesToCopy, u64((u8*)ret - (u8*)p)); /* overlap memcpy */
         memcpy(ret, p, nBytesToCopy);
         s->size += aligned;
     }
@@ -83,6 +89,18 @@ FixedRealloc(FixedAllocator* s, void* p, u64 mCount, u64 mSize)
     return ret;
 }
 
+constexpr bool
+FixedTryExpand(FixedAllocator* s, void* p, u64 mCount, u64 mSize)
+{
+    if (p != s->pLastAlloc) return false;
+
+    u64 newSize = u64((u8*)p - s->pMemBuffer) + align8(mCount * mSize);
+    if (newSize > s->cap) return false;
+
+    s->size = utils::max(s->size, newSize);
+    return true;
+}
+
 constexpr void
 FixedFree([[maybe_unused]] FixedAllocator* s, [[maybe_unused]] void* p)
 {
@@ -101,12 +119,19 @@ FixedReset(FixedAllocator* s)
     s->size = 0;
 }
 
+constexpr AllocatorUsage
+FixedUsage(const FixedAllocator* s)
+{
+    return {.nBlocks = 1, .nBytesReserved = s->cap, .nBytesUsed = s->size};
+}
+
 inline const AllocatorVTable inl_FixedAllocatorVTable {
     .alloc = decltype(AllocatorVTable::alloc)(FixedAlloc),
     .zalloc = decltype(AllocatorVTable::zalloc)(FixedZalloc),
     .realloc = decltype(AllocatorVTable::realloc)(FixedRealloc),
     .free = decltype(AllocatorVTable::free)(FixedFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(FixedFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(FixedTryExpand),
 };
 
 constexpr FixedAllocator::FixedAllocator(void* pMemory, u64 capacity)
@@ -10,21 +10,28 @@ namespace adt
 {
 
 /* Best-fit logarithmic time allocator, all IAllocator methods are supported.
- * Can be slow and memory wasteful for small allocations (56 bytes of metadata for each allocation).
+ * Requests up to FREE_LIST_SMALL_MAX come from size class bins (8 byte header, O(1)),
+ * bigger ones go to the tree (56 bytes of metadata for each allocation).
  * Preallocating big blocks would help. */
 struct FreeList;
 
 inline void* FreeListAlloc(FreeList* s, u64 nMembers, u64 mSize);
 inline void* FreeListZalloc(FreeList* s, u64 nMembers, u64 mSize);
 inline void* FreeListRealloc(FreeList* s, void* ptr, u64 nMembers, u64 mSize);
+/* tree allocations grow into a free node right after them */
+[[nodiscard]] inline bool FreeListTryExpand(FreeList* s, void* ptr, u64 nMembers, u64 mSize);
 inline void FreeListFree(FreeList* s, void* ptr);
 inline void FreeListFreeAll(FreeList* s);
+/* walks the free tree, size class chunks count as used */
+[[nodiscard]] inline AllocatorUsage FreeListUsage(FreeList* s);
 
 inline void* alloc(FreeList* s, u64 mCount, u64 mSize) { return FreeListAlloc(s, mCount, mSize); }
 inline void* zalloc(FreeList* s, u64 mCount, u64 mSize) { return FreeListZalloc(s, mCount, mSize); }
 inline void* realloc(FreeList* s, void* p, u64 mCount, u64 mSize) { return FreeListRealloc(s, p, mCount, mSize); }
 inline void free(FreeList* s, void* p) { FreeListFree(s, p); }
 inline void freeAll(FreeList* s) { FreeListFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(FreeList* s, void* p, u64 mCount, u64 mSize) { return FreeListTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(FreeList* s) { return FreeListUsage(s); }
 
 struct FreeListBlock
 {
@@ -37,6 +44,7 @@ struct FreeListBlock
 struct FreeListData
 {
     static constexpr u64 IS_FREE_MASK = 1ULL << 63;
+    static constexpr u64 IS_SMALL_MASK = 1ULL << 62; /* size class chunk header, the rest is the class */
 
     FreeListData* pPrev {};
     FreeListData* pNext {}; /* TODO: calculate from the size (save 8 bytes) */
@@ -52,6 +60,17 @@ struct FreeListData
     // constexpr FreeListData* nextNode() const { return (FreeListData*)((u8*)this + getSize()); }
 };
 
+/* 8, 16, 24, then 4 classes per power of 2 (x1, x1.25, x1.5, x1.75) up to 2048 */
+constexpr u32 FREE_LIST_N_CLASSES = 28;
+constexpr u64 FREE_LIST_SMALL_MAX = 2048;
+constexpr u64 FREE_LIST_SLAB_SIZE = SIZE_8K; /* at least, chunks are carved from tree allocations */
+
+/* lives in free chunks, after the header */
+struct FreeListChunk
+{
+    FreeListChunk* pNext {};
+};
+
 struct FreeList
 {
     using Node = RBNode<FreeListData>;
@@ -60,6 +79,8 @@ struct FreeList
     u64 blockSize {};
     RBTreeBase<FreeListData> tree {};
     FreeListBlock* pBlocks {};
+    FreeListChunk* aClasses[FREE_LIST_N_CLASSES] {};
+    u32 classMask {}; /* bit per non empty class */
 
     FreeList() = default;
     FreeList(u64 _blockSize);
@@ -92,6 +113,50 @@ utils::compare(const FreeListData& l, const FreeListData& r)
     return l.getSize() - r.getSize();
 }
 
+[[nodiscard]] constexpr u64
+_FreeListClassSize(u32 c)
+{
+    if (c < 3) return (c + 1) * 8;
+
+    u32 octave = (c - 3) / 4, step = (c - 3) % 4;
+    return (32ULL << octave) * (4 + step) / 4;
+}
+
+/* smallest class that fits size (1..FREE_LIST_SMALL_MAX) */
+[[nodiscard]] constexpr u32
+_FreeListClassOf(u64 size)
+{
+    if (size <= 32) return (size + 7) / 8 - 1;
+
+    u32 octave = (63 - __builtin_clzll(size - 1)) - 5;
+    u64 stepSize = 8ULL << octave;
+    u64 step = (size - (32ULL << octave) + stepSize - 1) / stepSize;
+
+    return 3 + 4*octave + step;
+}
+
+static_assert(_FreeListClassOf(FREE_LIST_SMALL_MAX) == FREE_LIST_N_CLASSES - 1);
+static_assert(_FreeListClassSize(FREE_LIST_N_CLASSES - 1) == FREE_LIST_SMALL_MAX);
+
+/* bit k: class c + k is at most twice as big as c and may serve it (8 -> 16, 16 -> 32, 24 -> 48, then 4 steps) */
+[[nodiscard]] constexpr u32
+_FreeListFitMask(u32 c)
+{
+    return (1U << (2 + utils::min(c, 3U))) - 1;
+}
+
+static_assert([] {
+    for (u32 c = 0; c < FREE_LIST_N_CLASSES; ++c)
+    {
+        for (u32 k = 0; c + k < FREE_LIST_N_CLASSES && k < 6; ++k)
+        {
+            if (bool((_FreeListFitMask(c) >> k) & 1) != (_FreeListClassSize(c + k) <= 2 * _FreeListClassSize(c)))
+                return false;
+        }
+    }
+    return true;
+}());
+
 inline FreeList::Node*
 _FreeListNodeFromBlock(FreeListBlock* pBlock)
 {
@@ -106,6 +171,8 @@ _FreeListBlockFromNode(FreeList* s, FreeList::Node* pNode)
     {
         if ((u8*)pNode > (u8*)pBlock && (u8*)pNode < (u8*)pBlock + pBlock->size)
             return pBlock;
+
+        pBlock = pBlock->pNext;
     }
 
     return nullptr;
@@ -152,6 +219,10 @@ FreeListFreeAll(FreeList* s)
         it = next;
     }
     s->pBlocks = nullptr;
+    s->tree = {};
+
+    for (auto& pHead : s->aClasses) pHead = nullptr;
+    s->classMask = 0;
 }
 
 inline FreeListData*
@@ -235,40 +306,24 @@ _FreeListVerify(FreeList* s)
 #endif
 
 inline void*
-FreeListAlloc(FreeList* s, u64 nMembers, u64 mSize)
+_FreeListAllocTree(FreeList* s, u64 requested)
 {
-    u64 requested = align8(nMembers * mSize);
-    if (requested == 0) return nullptr;
     u64 realSize = requested + sizeof(FreeList::Node);
 
-    /* find block that fits */
-    auto* pBlock = s->pBlocks;
-    while (pBlock)
-    {
-        bool bFits = (((pdiff)pBlock->size - (pdiff)sizeof(FreeListBlock)) - (pdiff)pBlock->nBytesOccupied) >= (pdiff)realSize;
-
-        if (!bFits)
-            pBlock = pBlock->pNext;
-        else break;
-    }
-
-    if (!pBlock)
+    /* the tree spans every block, only add one when nothing fits */
+    auto* pFree = _FreeListFindFittingNode(s, requested);
+    if (!pFree)
     {
 #if defined ADT_DBG_MEMORY
         CERR("[FreeList]: no fitting block for '{}' bytes\n", realSize);
 #endif
 
-again:
-        pBlock = _FreeListBlockPrepend(s, utils::max(s->blockSize, requested*2 + sizeof(FreeListBlock) + sizeof(FreeList::Node)));
+        _FreeListBlockPrepend(s, utils::max(s->blockSize, requested*2 + sizeof(FreeListBlock) + sizeof(FreeList::Node)));
+        pFree = _FreeListFindFittingNode(s, requested);
     }
 
-    auto* pFree = _FreeListFindFittingNode(s, requested);
-    if (!pFree) goto again;
-
+    assert(pFree && pFree->data.isFree());
 
-    assert(pFree->data.isFree());
-
-    pBlock->nBytesOccupied += realSize;
     s64 splitSize = s64(pFree->data.getSize()) - s64(realSize);
 
     assert(splitSize >= 0);
@@ -281,19 +336,89 @@ again:
         return pFree->data.pMem;
     }
 
-    FreeList::Node* pSplit = (FreeList::Node*)((u8*)pFree + splitSize);
-    pSplit->data.setSizeSetFree(realSize, false);
+    /* carve from the front, the rest stays free right after the allocation so it can grow into it */
+    FreeList::Node* pSplit = (FreeList::Node*)((u8*)pFree + realSize);
+    pSplit->data.setSizeSetFree(splitSize, true);
 
     pSplit->data.pNext = pFree->data.pNext;
     pSplit->data.pPrev = &pFree->data;
 
     if (pFree->data.pNext) pFree->data.pNext->pPrev = &pSplit->data;
     pFree->data.pNext = &pSplit->data;
-    pFree->data.setSizeSetFree(splitSize, true);
+    pFree->data.setSizeSetFree(realSize, false);
+
+    RBInsert(&s->tree, pSplit, true);
+
+    return pFree->data.pMem;
+}
+
+/* carve a slab from the tree into chunks of class c */
+inline void
+_FreeListRefillClass(FreeList* s, u32 c)
+{
+    const u64 stride = sizeof(u64) + _FreeListClassSize(c);
+    const u64 nChunks = utils::max(FREE_LIST_SLAB_SIZE / stride, 8ULL);
+
+    u8* pSlab = (u8*)_FreeListAllocTree(s, nChunks * stride);
+    for (u64 i = nChunks; i-- > 0; )
+    {
+        u8* pChunk = pSlab + i*stride;
+        *(u64*)pChunk = FreeListData::IS_SMALL_MASK | c;
+
+        auto* pNode = (FreeListChunk*)(pChunk + sizeof(u64));
+        pNode->pNext = s->aClasses[c];
+        s->aClasses[c] = pNode;
+    }
+
+    s->classMask |= 1U << c;
+}
+
+[[nodiscard]] inline void*
+_FreeListAllocSmall(FreeList* s, u64 requested)
+{
+    u32 c = _FreeListClassOf(requested);
+
+    /* a bigger class is fine if it's at most twice as big */
+    u32 mask = (s->classMask >> c) & _FreeListFitMask(c);
+    if (!mask)
+    {
+        _FreeListRefillClass(s, c);
+        mask = 1;
+    }
+    c += __builtin_ctz(mask);
 
-    RBInsert(&s->tree, pFree, true);
+    FreeListChunk* pNode = s->aClasses[c];
+    s->aClasses[c] = pNode->pNext;
+    if (!pNode->pNext) s->classMask &= ~(1U << c);
 
-    return pSplit->data.pMem;
+    return pNode;
+}
+
+inline void
+_FreeListFreeSmall(FreeList* s, void* ptr, u64 header)
+{
+    u32 c = header & ~FreeListData::IS_SMALL_MASK;
+
+    auto* pNode = (FreeListChunk*)ptr;
+    pNode->pNext = s->aClasses[c];
+    s->aClasses[c] = pNode;
+    s->classMask |= 1U << c;
+}
+
+[[nodiscard]] inline u64
+_FreeListHeader(void* ptr)
+{
+    return *((u64*)ptr - 1);
+}
+
+inline void*
+FreeListAlloc(FreeList* s, u64 nMembers, u64 mSize)
+{
+    u64 requested = align8(nMembers * mSize);
+    if (requested == 0) return nullptr;
+
+    if (requested <= FREE_LIST_SMALL_MAX) return _FreeListAllocSmall(s, requested);
+    return _FreeListAllocTree(s, requested);
 }
 
 inline void*
@@ -307,6 +432,15 @@ FreeListZalloc(FreeList* s, u64 nMembers, u64 mSize)
 inline void
 FreeListFree(FreeList* s, void* ptr)
 {
+    if (!ptr) return;
+
+    u64 header = _FreeListHeader(ptr);
+    if (header & FreeListData::IS_SMALL_MASK)
+    {
+        _FreeListFreeSmall(s, ptr, header);
+        return;
+    }
+
     auto* pThis = _FreeListTreeNodeFromPtr(ptr);
 
     assert(!pThis->data.isFree());
@@ -345,15 +479,22 @@ inline void*
 FreeListRealloc(FreeList* s, void* ptr, u64 nMembers, u64 mSize)
 {
     if (!ptr) return FreeListAlloc(s, nMembers, mSize);
+    if (FreeListTryExpand(s, ptr, nMembers, mSize)) return ptr;
 
-    auto* pNode = _FreeListTreeNodeFromPtr(ptr);
-    s64 nodeSize = (s64)pNode->data.getSize() - (s64)sizeof(FreeList::Node);
+    s64 nodeSize;
+    u64 header = _FreeListHeader(ptr);
+    if (header & FreeListData::IS_SMALL_MASK)
+    {
+        nodeSize = _FreeListClassSize(header & ~FreeListData::IS_SMALL_MASK);
+    }
+    else
+    {
+        auto* pNode = _FreeListTreeNodeFromPtr(ptr);
+        nodeSize = (s64)pNode->data.getSize() - (s64)sizeof(FreeList::Node);
+        assert(!pNode->data.isFree());
+    }
     assert(nodeSize > 0);
 
-    if ((s64)nMembers*(s64)mSize <= nodeSize) return ptr;
-
-    assert(!pNode->data.isFree());
-
     auto* pRet = FreeListAlloc(s, nMembers, mSize);
     memcpy(pRet, ptr, nodeSize);
     FreeListFree(s, ptr);
@@ -361,12 +502,85 @@ FreeListRealloc(FreeList* s, void* ptr, u64 nMembers, u64 mSize)
     return pRet;
 }
 
+inline bool
+FreeListTryExpand(FreeList* s, void* ptr, u64 nMembers, u64 mSize)
+{
+    u64 requested = align8(nMembers * mSize);
+
+    u64 header = _FreeListHeader(ptr);
+    if (header & FreeListData::IS_SMALL_MASK)
+        return requested <= _FreeListClassSize(header & ~FreeListData::IS_SMALL_MASK);
+
+    auto* pThis = _FreeListTreeNodeFromPtr(ptr);
+    assert(!pThis->data.isFree());
+
+    const u64 size = pThis->data.getSize();
+    const u64 realSize = requested + sizeof(FreeList::Node);
+    if (realSize <= size) return true;
+
+    /* pNext is adjacent within the block */
+    FreeListData* pNext = pThis->data.pNext;
+    if (!pNext || !pNext->isFree() || size + pNext->getSize() < realSize) return false;
+
+    RBRemove(&s->tree, _FreeListTreeNodeFromPtr(pNext->pMem));
+
+    FreeListData* pAfter = pNext->pNext;
+    const u64 rest = size + pNext->getSize() - realSize;
+
+    if (rest <= sizeof(FreeList::Node))
+    {
+        /* take all of it */
+        pThis->data.addSize(pNext->getSize());
+        pThis->data.pNext = pAfter;
+        if (pAfter) pAfter->pPrev = &pThis->data;
+
+        return true;
+    }
+
+    /* what's left stays a free node */
+    auto* pRest = (FreeList::Node*)((u8*)pThis + realSize);
+    pRest->data.setSizeSetFree(rest, true);
+    pRest->data.pPrev = &pThis->data;
+    pRest->data.pNext = pAfter;
+    if (pAfter) pAfter->pPrev = &pRest->data;
+
+    pThis->data.setSize(realSize);
+    pThis->data.pNext = &pRest->data;
+
+    RBInsert(&s->tree, pRest, true);
+
+    return true;
+}
+
+inline AllocatorUsage
+FreeListUsage(FreeList* s)
+{
+    AllocatorUsage r {};
+
+    for (auto* it = s->pBlocks; it; it = it->pNext)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += it->size;
+    }
+
+    u64 nFree = 0;
+    RBTraverse<FreeListData>(nullptr, s->tree.pRoot, +[](FreeList::Node*, FreeList::Node* p, void* pArg) {
+        *(u64*)pArg += p->data.getSize();
+        return false;
+    }, &nFree, RB_ORDER::IN);
+
+    r.nBytesUsed = r.nBytesReserved - r.nBlocks*sizeof(FreeListBlock) - nFree;
+
+    return r;
+}
+
 inline const AllocatorVTable inl_FreeListAllocatorVTable {
     .alloc = decltype(AllocatorVTable::alloc)(FreeListAlloc),
     .zalloc = decltype(AllocatorVTable::zalloc)(FreeListZalloc),
     .realloc = decltype(AllocatorVTable::realloc)(FreeListRealloc),
     .free = decltype(AllocatorVTable::free)(FreeListFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(FreeListFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(FreeListTryExpand),
 };
 
 inline FreeList::FreeList(u64 _blockSize)
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "types.hh"
+
+#include <stdatomic.h>
+#include <climits>
+
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#elif _WIN32
+    #define WIN32_LEAN_AND_MEAN 1
+    #include <windows.h>
+    #include <synchapi.h>
+    #ifdef _MSC_VER
+        #pragma comment(lib, "Synchronization.lib")
+    #endif
+#else
+    #include <threads.h>
+#endif
+
+namespace adt
+{
+
+/* Wait on the value of an atomic_int, wake by address.
+ * Waits may return spuriously, callers recheck their condition in a loop.
+ * Waking an address nobody waits on (or that was already reused) is harmless. */
+
+inline void futexWait(atomic_int* p, int expected); /* sleeps only while *p == expected */
+inline void futexWakeOne(atomic_int* p);
+inline void futexWakeAll(atomic_int* p);
+
+inline void
+futexWait(atomic_int* p, int expected)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (int*)p, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif _WIN32
+    WaitOnAddress((volatile void*)p, &expected, sizeof(expected), INFINITE);
+#else
+    if (atomic_load_explicit(p, memory_order_relaxed) == expected) thrd_yield();
+#endif
+}
+
+inline void
+futexWakeOne(atomic_int* p)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (int*)p, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif _WIN32
+    WakeByAddressSingle((void*)p);
+#else
+    (void)p;
+#endif
+}
+
+inline void
+futexWakeAll(atomic_int* p)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (int*)p, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#elif _WIN32
+    WakeByAddressAll((void*)p);
+#else
+    (void)p;
+#endif
+}
+
+} /* namespace adt */
@@ -18,6 +18,7 @@ nextPowerOf2(u64 x)
     x |= x >> 4;
     x |= x >> 8;
     x |= x >> 16;
+    x |= x >> 32;
     ++x;
 
     return x;
@@ -31,6 +32,8 @@ constexpr u64 SIZE_8M = 8UL * SIZE_1M;
 constexpr u64 SIZE_1G = SIZE_1M * SIZE_1K; 
 constexpr u64 SIZE_8G = SIZE_1G * SIZE_1K;
 
+constexpr u64 CACHE_LINE_SIZE = 64;
+
 struct IAllocator;
 
 /* at least alloc() and free() or freeAll() must be supported */
@@ -41,6 +44,8 @@ struct AllocatorVTable
     void* (*realloc)(IAllocator* s, void* p, u64 mCount, u64 mSize);
     void (*free)(IAllocator* s, void* p);
     void (*freeAll)(IAllocator* s);
+    /* grow p to mCount * mSize bytes without moving it, false leaves p as it was. Optional, null fails */
+    bool (*tryExpand)(IAllocator* s, void* p, u64 mCount, u64 mSize);
 };
 
 struct IAllocator
@@ -48,10 +53,20 @@ struct IAllocator
     const AllocatorVTable* pVTable {};
 };
 
-[[nodiscard]] ADT_NO_UB constexpr void* alloc(IAllocator* s, u64 mCount, u64 mSize) { return s->pVTable->alloc(s, mCount, mSize); }
-[[nodiscard]] ADT_NO_UB constexpr void* zalloc(IAllocator* s, u64 mCount, u64 mSize) { return s->pVTable->zalloc(s, mCount, mSize); }
-[[nodiscard]] ADT_NO_UB constexpr void* realloc(IAllocator* s, void* p, u64 mCount, u64 mSize) { return s->pVTable->realloc(s, p, mCount, mSize); }
-ADT_NO_UB constexpr void free(IAllocator* s, void* p) { s->pVTable->free(s, p); }
-ADT_NO_UB constexpr void freeAll(IAllocator* s) { s->pVTable->freeAll(s); }
+/* what an allocator holds right now, see usage() overloads next to each allocator and StatsAllocator for call counts */
+struct AllocatorUsage
+{
+    u64 nBlocks {};
+    u64 nBytesReserved {}; /* taken from the os, headers included */
+    u64 nBytesUsed {}; /* handed out (rounded up), NPOS64 if the allocator doesn't know */
+};
+
+/* always inlined: StatsAllocator records __builtin_return_address() as the call site, even at -O0 */
+[[nodiscard]] ADT_NO_UB ADT_ALWAYS_INLINE constexpr void* alloc(IAllocator* s, u64 mCount, u64 mSize) { return s->pVTable->alloc(s, mCount, mSize); }
+[[nodiscard]] ADT_NO_UB ADT_ALWAYS_INLINE constexpr void* zalloc(IAllocator* s, u64 mCount, u64 mSize) { return s->pVTable->zalloc(s, mCount, mSize); }
+[[nodiscard]] ADT_NO_UB ADT_ALWAYS_INLINE constexpr void* realloc(IAllocator* s, void* p, u64 mCount, u64 mSize) { return s->pVTable->realloc(s, p, mCount, mSize); }
+ADT_NO_UB ADT_ALWAYS_INLINE constexpr void free(IAllocator* s, void* p) { s->pVTable->free(s, p); }
+ADT_NO_UB ADT_ALWAYS_INLINE constexpr void freeAll(IAllocator* s) { s->pVTable->freeAll(s); }
+[[nodiscard]] ADT_NO_UB ADT_ALWAYS_INLINE constexpr bool tryExpand(IAllocator* s, void* p, u64 mCount, u64 mSize) { return s->pVTable->tryExpand && s->pVTable->tryExpand(s, p, mCount, mSize); }
 
 } /* namespace adt */
@@ -1,4 +1,5 @@
 /* simple hashmap with linear probing.
+ * MapT<K, V, Arena> calls the allocator directly instead of through IAllocator's vtable.
  * For customr key types, add template<> hash::func(const key& x), (or template<> hash::funcHVal(const key& x, u64 hval) for reusable hash)
  * and bool operator==(const key& other) */
 
@@ -63,8 +64,8 @@ inline u32 MapNextI(MapBase<K, V>* s, u32 i);
 template<typename K, typename V>
 inline f32 MapLoadFactor(MapBase<K, V>* s);
 
-template<typename K, typename V>
-inline MapResult<K, V> MapInsert(MapBase<K ,V>* s, IAllocator* p, const K& key, const V& val);
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapInsert(MapBase<K ,V>* s, ALLOC_T* p, const K& key, const V& val);
 
 template<typename K, typename V>
 [[nodiscard]] inline MapResult<K, V> MapSearch(MapBase<K, V>* s, const K& key);
@@ -75,11 +76,11 @@ inline void MapRemove(MapBase<K, V>*s, u32 i);
 template<typename K, typename V>
 inline void MapRemove(MapBase<K, V>*s, const K& key);
 
-template<typename K, typename V>
-inline MapResult<K, V> MapTryInsert(MapBase<K, V>* s, IAllocator* p, const K& key, const V& val);
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapTryInsert(MapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val);
 
-template<typename K, typename V>
-inline void MapDestroy(MapBase<K, V>* s, IAllocator* p);
+template<typename K, typename V, typename ALLOC_T>
+inline void MapDestroy(MapBase<K, V>* s, ALLOC_T* p);
 
 template<typename K, typename V>
 inline u32 MapCap(MapBase<K, V>* s);
@@ -87,11 +88,11 @@ inline u32 MapCap(MapBase<K, V>* s);
 template<typename K, typename V>
 inline u32 MapSize(MapBase<K, V>* s);
 
-template<typename K, typename V>
-inline void _MapRehash(MapBase<K, V>* s, IAllocator* p, u32 size);
+template<typename K, typename V, typename ALLOC_T>
+inline void _MapRehash(MapBase<K, V>* s, ALLOC_T* p, u32 size);
 
-template<typename K, typename V>
-inline MapResult<K, V> _MapInsertHashed(MapBase<K ,V>* s, IAllocator* p, const K& key, const V& val, u64 hash);
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> _MapInsertHashed(MapBase<K ,V>* s, ALLOC_T* p, const K& key, const V& val, u64 hash);
 
 template<typename K, typename V>
 [[nodiscard]] inline MapResult<K, V> _MapSearchHashed(MapBase<K, V>* s, const K& key, u64 keyHash);
@@ -104,7 +105,8 @@ struct MapBase
     u32 nOccupied {};
 
     MapBase() = default;
-    MapBase(IAllocator* pAllocator, u32 prealloc = SIZE_MIN);
+    template<typename ALLOC_T>
+    MapBase(ALLOC_T* pAllocator, u32 prealloc = SIZE_MIN);
 
     struct It
     {
@@ -184,9 +186,9 @@ MapLoadFactor(MapBase<K, V>* s)
     return f32(s->nOccupied) / f32(VecCap(&s->aBuckets));
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline MapResult<K, V>
-MapInsert(MapBase<K ,V>* s, IAllocator* p, const K& key, const V& val)
+MapInsert(MapBase<K ,V>* s, ALLOC_T* p, const K& key, const V& val)
 {
     u64 keyHash = hash::func(key);
 
@@ -224,9 +226,9 @@ MapRemove(MapBase<K, V>*s, const K& key)
     MapRemove<K, V>(s, MapIdx(s, f));
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline MapResult<K, V>
-MapTryInsert(MapBase<K, V>* s, IAllocator* p, const K& key, const V& val)
+MapTryInsert(MapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val)
 {
     auto f = MapSearch<K, V>(s, key);
     if (f)
@@ -237,9 +239,9 @@ MapTryInsert(MapBase<K, V>* s, IAllocator* p, const K& key, const V& val)
     else return MapInsert<K, V>(s, p, key, val);
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline void
-MapDestroy(MapBase<K, V>* s, IAllocator* p)
+MapDestroy(MapBase<K, V>* s, ALLOC_T* p)
 {
     VecDestroy(&s->aBuckets, p);
 }
@@ -256,9 +258,9 @@ inline u32 MapSize(MapBase<K, V>* s)
     return s->nOccupied;
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline void
-_MapRehash(MapBase<K, V>* s, IAllocator* p, u32 size)
+_MapRehash(MapBase<K, V>* s, ALLOC_T* p, u32 size)
 {
     auto mNew = MapBase<K, V>(p, size);
 
@@ -270,9 +272,9 @@ _MapRehash(MapBase<K, V>* s, IAllocator* p, u32 size)
     *s = mNew;
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline MapResult<K, V>
-_MapInsertHashed(MapBase<K ,V>* s, IAllocator* p, const K& key, const V& val, u64 keyHash)
+_MapInsertHashed(MapBase<K ,V>* s, ALLOC_T* p, const K& key, const V& val, u64 keyHash)
 {
     u32 idx = u32(keyHash % VecCap(&s->aBuckets));
 
@@ -326,7 +328,8 @@ _MapSearchHashed(MapBase<K, V>* s, const K& key, u64 keyHash)
 
 
 template<typename K, typename V>
-MapBase<K, V>::MapBase(IAllocator* pAllocator, u32 prealloc)
+template<typename ALLOC_T>
+MapBase<K, V>::MapBase(ALLOC_T* pAllocator, u32 prealloc)
     : aBuckets(pAllocator, prealloc * MAP_DEFAULT_LOAD_FACTOR_INV),
       maxLoadFactor(MAP_DEFAULT_LOAD_FACTOR)
 {
@@ -340,7 +343,8 @@ struct MapBaseRehashed
     MapBase<K, V> base {};
 
     MapBaseRehashed() = default;
-    MapBaseRehashed(IAllocator* pAlloc, u32 prealloc = SIZE_MIN)
+    template<typename ALLOC_T>
+    MapBaseRehashed(ALLOC_T* pAlloc, u32 prealloc = SIZE_MIN)
         : base(pAlloc, prealloc) {}
 
     MapBase<K, V>::It begin() { return base.begin(); }
@@ -365,9 +369,9 @@ inline u32 MapNextI(MapBaseRehashed<K, V>* s, u32 i) { return MapNextI<K, V>(&s-
 template<typename K, typename V>
 inline f32 MapLoadFactor(MapBaseRehashed<K, V>* s) { return MapLoadFactor<K, V>(&s->base); }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline MapResult<K, V>
-MapInsert(MapBaseRehashed<K ,V>* s, IAllocator* p, const K& key, const V& val, u64 hashValue)
+MapInsert(MapBaseRehashed<K ,V>* s, ALLOC_T* p, const K& key, const V& val, u64 hashValue)
 {
     assert(MapSize(&s->base) < MapCap(&s->base) && "[MapRehashed]: no more space left (can't rehash)");
 
@@ -395,9 +399,9 @@ MapRemove(MapBaseRehashed<K, V>*s, const K& key, u64 hashValue)
     MapRemove<K, V>(&s->base, MapIdx<K, V>(&s->base, f));
 }
 
-template<typename K, typename V>
+template<typename K, typename V, typename ALLOC_T>
 inline MapResult<K, V>
-MapTryInsert(MapBaseRehashed<K, V>* s, IAllocator* p, const K& key, const V& val, u64 hashValue)
+MapTryInsert(MapBaseRehashed<K, V>* s, ALLOC_T* p, const K& key, const V& val, u64 hashValue)
 {
     auto f = MapSearch<K, V>(s, key, hashValue);
     if (f)
@@ -408,8 +412,8 @@ MapTryInsert(MapBaseRehashed<K, V>* s, IAllocator* p, const K& key, const V& val
     else return MapInsert<K, V>(s, p, key, val, hashValue);
 }
 
-template<typename K, typename V>
-inline void MapDestroy(MapBaseRehashed<K, V>* s, IAllocator* p) { MapDestroy<K, V>(&s->base, p); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapDestroy(MapBaseRehashed<K, V>* s, ALLOC_T* p) { MapDestroy<K, V>(&s->base, p); }
 
 template<typename K, typename V>
 inline u32 MapCap(MapBaseRehashed<K, V>* s) { return MapCap<K, V>(&s->base); }
@@ -417,14 +421,14 @@ inline u32 MapCap(MapBaseRehashed<K, V>* s) { return MapCap<K, V>(&s->base); }
 template<typename K, typename V>
 inline u32 MapSize(MapBaseRehashed<K, V>* s) { return MapSize<K, V>(&s->base); }
 
-template<typename K, typename V>
-struct Map
+template<typename K, typename V, typename ALLOC_T = IAllocator>
+struct MapT
 {
     MapBase<K, V> base {};
-    IAllocator* pA {};
+    ALLOC_T* pA {};
 
-    Map() = default;
-    Map(IAllocator* pAlloc, u32 prealloc = SIZE_MIN)
+    MapT() = default;
+    MapT(ALLOC_T* pAlloc, u32 prealloc = SIZE_MIN)
         : base(pAlloc, prealloc), pA(pAlloc) {}
 
     MapBase<K, V>::It begin() { return base.begin(); }
@@ -434,50 +438,53 @@ struct Map
     const MapBase<K, V>::It end() const { return base.end(); }
 };
 
-template<typename K, typename V>
-inline u32 MapIdx(Map<K, V>* s, MapResult<K, V> res) { return MapIdx<K, V>(&s->base, res); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapIdx(MapT<K, V, ALLOC_T>* s, MapResult<K, V> res) { return MapIdx<K, V>(&s->base, res); }
 
-template<typename K, typename V>
-inline u32 MapFirstI(Map<K, V>* s) { return MapFirstI<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapFirstI(MapT<K, V, ALLOC_T>* s) { return MapFirstI<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline u32 MapNextI(Map<K, V>* s, u32 i) { return MapNextI<K, V>(&s->base, i); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapNextI(MapT<K, V, ALLOC_T>* s, u32 i) { return MapNextI<K, V>(&s->base, i); }
 
-template<typename K, typename V>
-inline f32 MapLoadFactor(Map<K, V>* s) { return MapLoadFactor<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline f32 MapLoadFactor(MapT<K, V, ALLOC_T>* s) { return MapLoadFactor<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline MapResult<K, V> MapInsert(Map<K ,V>* s, const K& key, const V& val) { return MapInsert<K, V>(&s->base, s->pA, key, val); }
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapInsert(MapT<K, V, ALLOC_T>* s, const K& key, const V& val) { return MapInsert<K, V>(&s->base, s->pA, key, val); }
 
-template<typename K, typename V>
-[[nodiscard]] inline MapResult<K, V> MapSearch(Map<K, V>* s, const K& key) { return MapSearch<K, V>(&s->base, key); }
+template<typename K, typename V, typename ALLOC_T>
+[[nodiscard]] inline MapResult<K, V> MapSearch(MapT<K, V, ALLOC_T>* s, const K& key) { return MapSearch<K, V>(&s->base, key); }
 
-template<typename K, typename V>
-inline void MapRemove(Map<K, V>*s, u32 i) { MapRemove<K, V>(&s->base, i); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapRemove(MapT<K, V, ALLOC_T>*s, u32 i) { MapRemove<K, V>(&s->base, i); }
 
-template<typename K, typename V>
-inline void MapRemove(Map<K, V>*s, const K& key) { MapRemove<K, V>(&s->base, key); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapRemove(MapT<K, V, ALLOC_T>*s, const K& key) { MapRemove<K, V>(&s->base, key); }
 
-template<typename K, typename V>
-inline MapResult<K, V> MapTryInsert(Map<K, V>* s, const K& key, const V& val) { return MapTryInsert<K, V>(&s->base, s->pA, key, val); }
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapTryInsert(MapT<K, V, ALLOC_T>* s, const K& key, const V& val) { return MapTryInsert<K, V>(&s->base, s->pA, key, val); }
 
-template<typename K, typename V>
-inline void MapDestroy(Map<K, V>* s) { MapDestroy<K, V>(&s->base, s->pA); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapDestroy(MapT<K, V, ALLOC_T>* s) { MapDestroy<K, V>(&s->base, s->pA); }
 
-template<typename K, typename V>
-inline u32 MapCap(Map<K, V>* s) { return MapCap<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapCap(MapT<K, V, ALLOC_T>* s) { return MapCap<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline u32 MapSize(Map<K, V>* s) { return MapSize<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapSize(MapT<K, V, ALLOC_T>* s) { return MapSize<K, V>(&s->base); }
 
 template<typename K, typename V>
-struct MapRehashed
+using Map = MapT<K, V, IAllocator>;
+
+template<typename K, typename V, typename ALLOC_T = IAllocator>
+struct MapRehashedT
 {
     MapBaseRehashed<K, V> base {};
-    IAllocator* pA {};
+    ALLOC_T* pA {};
 
-    MapRehashed() = default;
-    MapRehashed(IAllocator* pAlloc, u32 prealloc = SIZE_MIN)
+    MapRehashedT() = default;
+    MapRehashedT(ALLOC_T* pAlloc, u32 prealloc = SIZE_MIN)
         : base(pAlloc, prealloc), pA(pAlloc) {}
 
     MapBase<K, V>::It begin() { return base.begin(); }
@@ -487,46 +494,49 @@ struct MapRehashed
     const MapBase<K, V>::It end() const { return base.end(); }
 };
 
-template<typename K, typename V>
-inline u32 MapIdx(MapRehashed<K, V>* s, KeyVal<K, V>* p) { return MapIdx<K, V>(&s->base, p); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapIdx(MapRehashedT<K, V, ALLOC_T>* s, KeyVal<K, V>* p) { return MapIdx<K, V>(&s->base, p); }
 
-template<typename K, typename V>
-inline u32 MapIdx(MapRehashed<K, V>* s, MapResult<K, V> res) { return MapIdx<K, V>(&s->base, res); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapIdx(MapRehashedT<K, V, ALLOC_T>* s, MapResult<K, V> res) { return MapIdx<K, V>(&s->base, res); }
 
-template<typename K, typename V>
-inline u32 MapFirstI(MapRehashed<K, V>* s) { return MapFirstI<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapFirstI(MapRehashedT<K, V, ALLOC_T>* s) { return MapFirstI<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline u32 MapNextI(MapRehashed<K, V>* s, u32 i) { return MapNextI<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapNextI(MapRehashedT<K, V, ALLOC_T>* s, u32 i) { return MapNextI<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline f32 MapLoadFactor(MapRehashed<K, V>* s) { return MapLoadFactor<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline f32 MapLoadFactor(MapRehashedT<K, V, ALLOC_T>* s) { return MapLoadFactor<K, V>(&s->base); }
 
-template<typename K, typename V>
-inline MapResult<K, V> MapInsert(MapRehashed<K ,V>* s, const K& key, const V& val, u64 hashValue)
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapInsert(MapRehashedT<K, V, ALLOC_T>* s, const K& key, const V& val, u64 hashValue)
 { return MapInsert<K, V>(&s->base, s->pA, key, val, hashValue); }
 
-template<typename K, typename V>
-[[nodiscard]] inline MapResult<K, V> MapSearch(MapRehashed<K, V>* s, const K& key, u64 hashValue) { return MapSearch<K, V>(&s->base, key, hashValue); }
+template<typename K, typename V, typename ALLOC_T>
+[[nodiscard]] inline MapResult<K, V> MapSearch(MapRehashedT<K, V, ALLOC_T>* s, const K& key, u64 hashValue) { return MapSearch<K, V>(&s->base, key, hashValue); }
 
-template<typename K, typename V>
-inline void MapRemove(MapRehashed<K, V>*s, u32 i) { MapRemove<K, V>(&s->base, i); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapRemove(MapRehashedT<K, V, ALLOC_T>*s, u32 i) { MapRemove<K, V>(&s->base, i); }
 
-template<typename K, typename V>
-inline void MapRemove(MapRehashed<K, V>*s, const K& key, u64 hashValue) { MapRemove<K, V>(&s->base, key, hashValue); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapRemove(MapRehashedT<K, V, ALLOC_T>*s, const K& key, u64 hashValue) { MapRemove<K, V>(&s->base, key, hashValue); }
 
-template<typename K, typename V>
-inline MapResult<K, V> MapTryInsert(MapRehashed<K, V>* s, const K& key, const V& val, u64 hashValue)
+template<typename K, typename V, typename ALLOC_T>
+inline MapResult<K, V> MapTryInsert(MapRehashedT<K, V, ALLOC_T>* s, const K& key, const V& val, u64 hashValue)
 { return MapTryInsert<K, V>(&s->base, s->pA, key, val, hashValue); }
 
-template<typename K, typename V>
-inline void MapDestroy(MapRehashed<K, V>* s) { MapDestroy<K, V>(&s->base, s->pA); }
+template<typename K, typename V, typename ALLOC_T>
+inline void MapDestroy(MapRehashedT<K, V, ALLOC_T>* s) { MapDestroy<K, V>(&s->base, s->pA); }
 
-template<typename K, typename V>
-inline u32 MapCap(MapRehashed<K, V>* s) { return MapCap<K, V>(&s->base); }
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapCap(MapRehashedT<K, V, ALLOC_T>* s) { return MapCap<K, V>(&s->base); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 MapSize(MapRehashedT<K, V, ALLOC_T>* s) { return MapSize<K, V>(&s->base); }
 
 template<typename K, typename V>
-inline u32 MapSize(MapRehashed<K, V>* s) { return MapSize<K, V>(&s->base); }
+using MapRehashed = MapRehashedT<K, V, IAllocator>;
 
 namespace print
 {
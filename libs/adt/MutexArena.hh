@@ -19,14 +19,18 @@ struct MutexArena
 inline void* MutexArenaAlloc(MutexArena* s, u64 mCount, u64 mSize);
 inline void* MutexArenaZalloc(MutexArena* s, u64 mCount, u64 mSize);
 inline void* MutexArenaRealloc(MutexArena* s, void* p, u64 mCount, u64 mSize);
+[[nodiscard]] inline bool MutexArenaTryExpand(MutexArena* s, void* p, u64 mCount, u64 mSize);
 inline void MutexArenaFree([[maybe_unused]] MutexArena* s, [[maybe_unused]] void* p);
 inline void MutexArenaFreeAll(MutexArena* s);
+[[nodiscard]] inline AllocatorUsage MutexArenaUsage(MutexArena* s);
 
 inline void* alloc(MutexArena* s, u64 mCount, u64 mSize) { return MutexArenaAlloc(s, mCount, mSize); }
 inline void* zalloc(MutexArena* s, u64 mCount, u64 mSize) { return MutexArenaZalloc(s, mCount, mSize); }
 inline void* realloc(MutexArena* s, void* p, u64 mCount, u64 mSize) { return MutexArenaRealloc(s, p, mCount, mSize); }
 inline void free(MutexArena* s, void* p) { MutexArenaFree(s, p); }
 inline void freeAll(MutexArena* s) { MutexArenaFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(MutexArena* s, void* p, u64 mCount, u64 mSize) { return MutexArenaTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(MutexArena* s) { return MutexArenaUsage(s); }
 
 inline void*
 MutexArenaAlloc(MutexArena* s, u64 mCount, u64 mSize)
@@ -58,6 +62,16 @@ MutexArenaRealloc(MutexArena* s, void* p, u64 mCount, u64 mSize)
     return r;
 }
 
+inline bool
+MutexArenaTryExpand(MutexArena* s, void* p, u64 mCount, u64 mSize)
+{
+    mtx_lock(&s->mtx);
+    bool r = ArenaTryExpand(&s->arena, p, mCount, mSize);
+    mtx_unlock(&s->mtx);
+
+    return r;
+}
+
 inline void
 MutexArenaFree([[maybe_unused]] MutexArena* s, [[maybe_unused]] void* p)
 {
@@ -71,12 +85,23 @@ MutexArenaFreeAll(MutexArena* s)
     mtx_destroy(&s->mtx);
 }
 
+inline AllocatorUsage
+MutexArenaUsage(MutexArena* s)
+{
+    mtx_lock(&s->mtx);
+    auto r = ArenaUsage(&s->arena);
+    mtx_unlock(&s->mtx);
+
+    return r;
+}
+
 inline const AllocatorVTable inl_AtomicArenaAllocatorVTable {
     .alloc = decltype(AllocatorVTable::alloc)(MutexArenaAlloc),
     .zalloc = decltype(AllocatorVTable::zalloc)(MutexArenaZalloc),
     .realloc = decltype(AllocatorVTable::realloc)(MutexArenaRealloc),
     .free = decltype(AllocatorVTable::free)(MutexArenaFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(MutexArenaFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(MutexArenaTryExpand),
 };
 
 inline
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "ThreadPool.hh"
+#include "ThreadArena.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace adt
+{
+
+struct NumaNode
+{
+    u32 id {}; /* kernel node number */
+    VecBase<u32> aCpus {};
+};
+
+/* nodes that have cpus, in kernel order */
+struct NumaTopology
+{
+    VecBase<NumaNode> aNodes {};
+};
+
+/* Reads /sys/devices/system/node, falls back to one node with every core */
+[[nodiscard]] inline NumaTopology NumaTopologyLoad(IAllocator* pAlloc);
+inline void NumaTopologyDestroy(NumaTopology* s, IAllocator* pAlloc);
+/* node that backs the page at p (faults it in if needed), -1 if unknown */
+[[nodiscard]] inline int numaNodeOf(const void* p);
+
+/* "0-3,8,10-11" style list, false on parse errors */
+inline bool
+_NumaParseList(const char* s, VecBase<u32>* pOut, IAllocator* pAlloc)
+{
+    while (*s && *s != '\n')
+    {
+        char* pEnd;
+        u32 first = strtoul(s, &pEnd, 10);
+        if (pEnd == s) return false;
+
+        u32 last = first;
+        s = pEnd;
+        if (*s == '-')
+        {
+            last = strtoul(s + 1, &pEnd, 10);
+            if (pEnd == s + 1 || last < first) return false;
+            s = pEnd;
+        }
+
+        for (u32 i = first; i <= last; ++i)
+            VecPush(pOut, pAlloc, i);
+
+        if (*s == ',') ++s;
+    }
+
+    return true;
+}
+
+inline bool
+_NumaReadList(const char* sPath, VecBase<u32>* pOut, IAllocator* pAlloc)
+{
+    FILE* pf = fopen(sPath, "rb");
+    if (!pf) return false;
+
+    /* big enough for any sane cpu list, ranges keep it short */
+    char aBuff[4096] {};
+    u64 n = fread(aBuff, 1, sizeof(aBuff) - 1, pf);
+    fclose(pf);
+
+    return n > 0 && _NumaParseList(aBuff, pOut, pAlloc);
+}
+
+inline NumaTopology
+NumaTopologyLoad(IAllocator* pAlloc)
+{
+    NumaTopology r {};
+
+#ifdef __linux__
+    VecBase<u32> aIds {};
+    if (_NumaReadList("/sys/devices/system/node/online", &aIds, pAlloc))
+    {
+        for (u32 id : aIds)
+        {
+            char aPath[128];
+            snprintf(aPath, sizeof(aPath), "/sys/devices/system/node/node%u/cpulist", id);
+
+            NumaNode node {.id = id};
+            /* memory only nodes have an empty list */
+            if (_NumaReadList(aPath, &node.aCpus, pAlloc) && VecSize(&node.aCpus) > 0)
+                VecPush(&r.aNodes, pAlloc, node);
+            else VecDestroy(&node.aCpus, pAlloc);
+        }
+    }
+    VecDestroy(&aIds, pAlloc);
+#endif
+
+    if (VecSize(&r.aNodes) == 0)
+    {
+        NumaNode node {};
+        for (int i = 0; i < getNCores(); ++i)
+            VecPush(&node.aCpus, pAlloc, u32(i));
+
+        VecPush(&r.aNodes, pAlloc, node);
+    }
+
+    return r;
+}
+
+inline void
+NumaTopologyDestroy(NumaTopology* s, IAllocator* pAlloc)
+{
+    for (auto& node : s->aNodes)
+        VecDestroy(&node.aCpus, pAlloc);
+
+    VecDestroy(&s->aNodes, pAlloc);
+}
+
+inline int
+numaNodeOf(const void* p)
+{
+#ifdef __linux__
+    constexpr unsigned long MPOL_F_NODE = 1 << 0;
+    constexpr unsigned long MPOL_F_ADDR = 1 << 1;
+
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, p, MPOL_F_NODE | MPOL_F_ADDR) != 0) return -1;
+
+    return node;
+#else
+    (void)p;
+    return -1;
+#endif
+}
+
+/* One ThreadPool per node with workers pinned to that node's cpus, plus a node local arena.
+ * Arena blocks are first touched by whoever allocates them, so allocate from tasks running on the node. */
+struct NumaPool
+{
+    IAllocator* pAlloc {};
+    NumaTopology topo {};
+    ThreadPool* aPools {};
+    ThreadArena* aArenas {};
+    atomic_uint nextNode; /* round robin for data without a known node */
+
+    NumaPool() = default;
+};
+
+inline void NumaPoolInit(
+    NumaPool* s, IAllocator* pAlloc, bool bPin = true,
+    THREAD_POOL_MODE eMode = THREAD_POOL_MODE::SHARED_QUEUE, u32 arenaBlockSize = SIZE_1M
+);
+[[nodiscard]] inline u32 NumaPoolNodesCount(const NumaPool* s);
+/* index into topo.aNodes for a kernel node number, 0 if it has no cpus */
+[[nodiscard]] inline u32 NumaPoolNodeIdx(const NumaPool* s, int nodeId);
+inline void NumaPoolSubmit(NumaPool* s, u32 nodeIdx, thrd_start_t pfnTask, void* pArgs);
+/* run on the node whose memory backs pData */
+inline void NumaPoolSubmitNear(NumaPool* s, const void* pData, thrd_start_t pfnTask, void* pArgs);
+[[nodiscard]] inline IAllocator* NumaPoolArena(NumaPool* s, u32 nodeIdx);
+inline void NumaPoolWait(NumaPool* s);
+inline void NumaPoolDestroy(NumaPool* s);
+
+inline void
+NumaPoolInit(NumaPool* s, IAllocator* pAlloc, bool bPin, THREAD_POOL_MODE eMode, u32 arenaBlockSize)
+{
+    s->pAlloc = pAlloc;
+    s->topo = NumaTopologyLoad(pAlloc);
+    atomic_store_explicit(&s->nextNode, 0, memory_order_relaxed);
+
+    const u32 nNodes = VecSize(&s->topo.aNodes);
+    s->aPools = (ThreadPool*)alloc(pAlloc, nNodes, sizeof(ThreadPool));
+    s->aArenas = (ThreadArena*)alloc(pAlloc, nNodes, sizeof(ThreadArena));
+
+    for (u32 i = 0; i < nNodes; ++i)
+    {
+        auto& node = s->topo.aNodes[i];
+
+        /* ThreadPool and ThreadArena hold atomics, construct in place */
+        new(&s->aPools[i]) ThreadPool(pAlloc, VecSize(&node.aCpus), eMode);
+        new(&s->aArenas[i]) ThreadArena(arenaBlockSize);
+
+        if (bPin) ThreadPoolSetAffinity(&s->aPools[i], node.aCpus.pData, VecSize(&node.aCpus));
+        ThreadPoolStart(&s->aPools[i]);
+    }
+}
+
+inline u32
+NumaPoolNodesCount(const NumaPool* s)
+{
+    return VecSize(&s->topo.aNodes);
+}
+
+inline u32
+NumaPoolNodeIdx(const NumaPool* s, int nodeId)
+{
+    for (u32 i = 0; i < VecSize(&s->topo.aNodes); ++i)
+        if (int(s->topo.aNodes[i].id) == nodeId) return i;
+
+    return 0;
+}
+
+inline void
+NumaPoolSubmit(NumaPool* s, u32 nodeIdx, thrd_start_t pfnTask, void* pArgs)
+{
+    assert(nodeIdx < NumaPoolNodesCount(s) && "[NumaPool]: node index out of range");
+    ThreadPoolSubmit(&s->aPools[nodeIdx], pfnTask, pArgs);
+}
+
+inline void
+NumaPoolSubmitNear(NumaPool* s, const void* pData, thrd_start_t pfnTask, void* pArgs)
+{
+    u32 idx;
+    if (NumaPoolNodesCount(s) == 1) idx = 0;
+    else
+    {
+        int nodeId = numaNodeOf(pData);
+        idx = nodeId >= 0 ?
+            NumaPoolNodeIdx(s, nodeId) :
+            atomic_fetch_add_explicit(&s->nextNode, 1, memory_order_relaxed) % NumaPoolNodesCount(s);
+    }
+
+    ThreadPoolSubmit(&s->aPools[idx], pfnTask, pArgs);
+}
+
+inline IAllocator*
+NumaPoolArena(NumaPool* s, u32 nodeIdx)
+{
+    assert(nodeIdx < NumaPoolNodesCount(s) && "[NumaPool]: node index out of range");
+    return &s->aArenas[nodeIdx].super;
+}
+
+inline void
+NumaPoolWait(NumaPool* s)
+{
+    for (u32 i = 0; i < NumaPoolNodesCount(s); ++i)
+        ThreadPoolWait(&s->aPools[i]);
+}
+
+inline void
+NumaPoolDestroy(NumaPool* s)
+{
+    for (u32 i = 0; i < NumaPoolNodesCount(s); ++i)
+    {
+        ThreadPoolDestroy(&s->aPools[i]);
+        ThreadArenaFreeAll(&s->aArenas[i]);
+    }
+
+    free(s->pAlloc, s->aPools);
+    free(s->pAlloc, s->aArenas);
+    NumaTopologyDestroy(&s->topo, s->pAlloc);
+}
+
+} /* namespace adt */
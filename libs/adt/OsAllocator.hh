@@ -15,6 +15,7 @@ struct OsAllocator;
 inline void* OsAlloc(OsAllocator* s, u64 mCount, u64 mSize);
 inline void* OsZalloc(OsAllocator* s, u64 mCount, u64 mSize);
 inline void* OsRealloc(OsAllocator* s, void* p, u64 mCount, u64 mSize);
+inline bool OsTryExpand(OsAllocator* s, void* p, u64 mCount, u64 mSize);
 inline void OsFree(OsAllocator* s, void* p);
 inline void _OsFreeAll(OsAllocator* s);
 
@@ -22,6 +23,7 @@ inline void* alloc(OsAllocator* s, u64 mCount, u64 mSize) { return OsAlloc(s, mC
 inline void* zalloc(OsAllocator* s, u64 mCount, u64 mSize) { return OsZalloc(s, mCount, mSize); }
 inline void* realloc(OsAllocator* s, void* p, u64 mCount, u64 mSize) { return OsRealloc(s, p, mCount, mSize); }
 inline void free(OsAllocator* s, void* p) { OsFree(s, p); }
+inline bool tryExpand(OsAllocator* s, void* p, u64 mCount, u64 mSize) { return OsTryExpand(s, p, mCount, mSize); }
 
 inline const AllocatorVTable inl_OsAllocatorVTable {
     .alloc = decltype(AllocatorVTable::alloc)(OsAlloc),
@@ -29,6 +31,7 @@ inline const AllocatorVTable inl_OsAllocatorVTable {
     .realloc = decltype(AllocatorVTable::realloc)(OsRealloc),
     .free = decltype(AllocatorVTable::free)(OsFree),
     .freeAll = decltype(AllocatorVTable::freeAll)(_OsFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(OsTryExpand),
 };
 
 struct OsAllocator
@@ -65,6 +68,18 @@ OsRealloc([[maybe_unused]] OsAllocator* s, void* p, u64 mCount, u64 mSize)
     return r;
 }
 
+/* malloc has no grow-only call, realloc() is the way (big blocks are mremap'ed there, not copied) */
+inline bool
+OsTryExpand(
+    [[maybe_unused]] OsAllocator* s,
+    [[maybe_unused]] void* p,
+    [[maybe_unused]] u64 mCount,
+    [[maybe_unused]] u64 mSize
+)
+{
+    return false;
+}
+
 inline void
 OsFree([[maybe_unused]] OsAllocator* s, void* p)
 {
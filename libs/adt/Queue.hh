@@ -13,17 +13,17 @@ namespace adt
 
 template<typename T> struct QueueBase;
 
-template<typename T>
-inline void QueueDestroy(QueueBase<T>*s, IAllocator* p);
+template<typename T, typename ALLOC_T>
+inline void QueueDestroy(QueueBase<T>*s, ALLOC_T* p);
 
-template<typename T>
-inline T* QueuePushFront(QueueBase<T>* s, IAllocator* p, const T& val);
+template<typename T, typename ALLOC_T>
+inline T* QueuePushFront(QueueBase<T>* s, ALLOC_T* p, const T& val);
 
-template<typename T>
-inline T* QueuePushBack(QueueBase<T>* s, IAllocator* p, const T& val);
+template<typename T, typename ALLOC_T>
+inline T* QueuePushBack(QueueBase<T>* s, ALLOC_T* p, const T& val);
 
-template<typename T>
-inline void QueueResize(QueueBase<T>* s, IAllocator* p, u32 size);
+template<typename T, typename ALLOC_T>
+inline void QueueResize(QueueBase<T>* s, ALLOC_T* p, u32 size);
 
 template<typename T>
 inline T* QueuePopFront(QueueBase<T>* s);
@@ -44,7 +44,8 @@ struct QueueBase
     int last {};
 
     QueueBase() = default;
-    QueueBase(IAllocator* p, u32 prealloc = SIZE_MIN)
+    template<typename ALLOC_T>
+    QueueBase(ALLOC_T* p, u32 prealloc = SIZE_MIN)
         : pData {(T*)alloc(p, prealloc, sizeof(T))},
           cap (prealloc) {}
 
@@ -97,16 +98,16 @@ struct QueueBase
     const It rend() const { return {this, {}, this->size}; }
 };
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-QueueDestroy(QueueBase<T>*s, IAllocator* p)
+QueueDestroy(QueueBase<T>*s, ALLOC_T* p)
 {
     free(p, s->pData);
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline T*
-QueuePushFront(QueueBase<T>* s, IAllocator* p, const T& val)
+QueuePushFront(QueueBase<T>* s, ALLOC_T* p, const T& val)
 {
     if (s->size >= s->cap) QueueResize(s, p, s->cap * 2);
 
@@ -119,9 +120,9 @@ QueuePushFront(QueueBase<T>* s, IAllocator* p, const T& val)
     return &s->pData[ni];
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline T*
-QueuePushBack(QueueBase<T>* s, IAllocator* p, const T& val)
+QueuePushBack(QueueBase<T>* s, ALLOC_T* p, const T& val)
 {
     if (s->size >= s->cap) QueueResize(s, p, s->cap * 2);
 
@@ -134,9 +135,9 @@ QueuePushBack(QueueBase<T>* s, IAllocator* p, const T& val)
     return &s->pData[i];
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-QueueResize(QueueBase<T>* s, IAllocator* p, u32 size)
+QueueResize(QueueBase<T>* s, ALLOC_T* p, u32 size)
 {
     auto nQ = QueueBase<T>(p, size);
 
@@ -179,14 +180,15 @@ QueueIdx(const QueueBase<T>* s, const T* pItem)
     return pItem - s->pData;
 }
 
-template<typename T>
-struct Queue
+/* QueueT<T, Arena> calls the allocator directly instead of through IAllocator's vtable */
+template<typename T, typename ALLOC_T = IAllocator>
+struct QueueT
 {
     QueueBase<T> base {};
-    IAllocator* pAlloc {};
+    ALLOC_T* pAlloc {};
 
-    Queue() = default;
-    Queue(IAllocator* p, u32 prealloc = SIZE_MIN)
+    QueueT() = default;
+    QueueT(ALLOC_T* p, u32 prealloc = SIZE_MIN)
         : base(p, prealloc), pAlloc(p) {}
 
     T& operator[](u32 i) { return base[i]; }
@@ -203,32 +205,35 @@ struct Queue
     const QueueBase<T>::It rend() const { return base.rend(); }
 };
 
-template<typename T>
-inline void QueueDestroy(Queue<T>*s) { QueueDestroy<T>(&s->base, s->pAlloc); }
+template<typename T, typename ALLOC_T>
+inline void QueueDestroy(QueueT<T, ALLOC_T>*s) { QueueDestroy<T>(&s->base, s->pAlloc); }
 
-template<typename T>
-inline T* QueuePushFront(Queue<T>* s, const T& val) { return QueuePushFront<T>(&s->base, s->pAlloc, val); }
+template<typename T, typename ALLOC_T>
+inline T* QueuePushFront(QueueT<T, ALLOC_T>* s, const T& val) { return QueuePushFront<T>(&s->base, s->pAlloc, val); }
 
-template<typename T>
-inline T* QueuePushBack(Queue<T>* s, const T& val) { return QueuePushBack<T>(&s->base, s->pAlloc, val); }
+template<typename T, typename ALLOC_T>
+inline T* QueuePushBack(QueueT<T, ALLOC_T>* s, const T& val) { return QueuePushBack<T>(&s->base, s->pAlloc, val); }
 
-template<typename T>
-inline void QueueResize(Queue<T>* s, u32 size) { QueueResize<T>(&s->base, s->pAlloc, size); }
+template<typename T, typename ALLOC_T>
+inline void QueueResize(QueueT<T, ALLOC_T>* s, u32 size) { QueueResize<T>(&s->base, s->pAlloc, size); }
 
-template<typename T>
-inline T* QueuePopFront(Queue<T>* s) { return QueuePopFront<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline T* QueuePopFront(QueueT<T, ALLOC_T>* s) { return QueuePopFront<T>(&s->base); }
 
-template<typename T>
-inline T* QueuePopBack(Queue<T>* s) { return QueuePopBack<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline T* QueuePopBack(QueueT<T, ALLOC_T>* s) { return QueuePopBack<T>(&s->base); }
+
+template<typename T, typename ALLOC_T>
+inline u32 QueueIdx(const QueueT<T, ALLOC_T>* s, const T* pItem) { return QueueIdx<T>(&s->base, pItem); }
 
 template<typename T>
-inline u32 QueueIdx(const Queue<T>* s, const T* pItem) { return QueueIdx<T>(&s->base, pItem); }
+using Queue = QueueT<T, IAllocator>;
 
 namespace utils
 {
 
 template<typename T> [[nodiscard]] inline bool empty(const QueueBase<T>* s) { return s->size == 0; }
-template<typename T> [[nodiscard]] inline bool empty(const Queue<T>* s) { return empty(&s->base); }
+template<typename T, typename ALLOC_T> [[nodiscard]] inline bool empty(const QueueT<T, ALLOC_T>* s) { return empty(&s->base); }
 
 } /* namespace utils */
 
@@ -237,10 +242,10 @@ template<typename T> [[nodiscard]] inline int QueuePrevI(const QueueBase<T>* s,
 template<typename T> [[nodiscard]] inline int QueueFirstI(const QueueBase<T>* s) { return utils::empty(s) ? -1 : s->first; }
 template<typename T> [[nodiscard]] inline int QueueLastI(const QueueBase<T>* s) { return utils::empty(s) ? 0 : s->last - 1; }
 
-template<typename T> [[nodiscard]] inline int QueueNextI(const Queue<T>*s, int i) { return QueueNextI<T>(&s->base, i); }
-template<typename T> [[nodiscard]] inline int QueuePrevI(const Queue<T>* s, int i) { return QueuePrevI<T>(&s->base, i); }
-template<typename T> [[nodiscard]] inline int QueueFirstI(const Queue<T>* s) { return QueueFirstI<T>(&s->base); }
-template<typename T> [[nodiscard]] inline int QueueLastI(const Queue<T>* s) { return QueueLastI<T>(&s->base); }
+template<typename T, typename ALLOC_T> [[nodiscard]] inline int QueueNextI(const QueueT<T, ALLOC_T>*s, int i) { return QueueNextI<T>(&s->base, i); }
+template<typename T, typename ALLOC_T> [[nodiscard]] inline int QueuePrevI(const QueueT<T, ALLOC_T>* s, int i) { return QueuePrevI<T>(&s->base, i); }
+template<typename T, typename ALLOC_T> [[nodiscard]] inline int QueueFirstI(const QueueT<T, ALLOC_T>* s) { return QueueFirstI<T>(&s->base); }
+template<typename T, typename ALLOC_T> [[nodiscard]] inline int QueueLastI(const QueueT<T, ALLOC_T>* s) { return QueueLastI<T>(&s->base); }
 
 namespace print
 {
@@ -270,9 +275,9 @@ formatToContext(Context ctx, [[maybe_unused]] FormatArgs fmtArgs, const QueueBas
     return print::copyBackToBuffer(ctx, aBuff, utils::size(aBuff));
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline u32
-formatToContext(Context ctx, FormatArgs fmtArgs, const Queue<T>& x)
+formatToContext(Context ctx, FormatArgs fmtArgs, const QueueT<T, ALLOC_T>& x)
 {
     return formatToContext(ctx, fmtArgs, x.base);
 }
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "IAllocator.hh"
+
+#include <stdatomic.h>
+#include <cassert>
+#include <type_traits>
+
+namespace adt
+{
+
+/* Bounded lock-free ring queues for handing items between threads.
+ * Capacity is fixed at construction (rounded up to a power of 2), push fails when full, pop fails when empty.
+ * T is copied in and out with plain assignment, so it has to be trivially copyable. */
+
+template<typename T> struct MPMCRing;
+template<typename T> struct MPSCRing;
+template<typename T> struct SPSCRing;
+
+template<typename T> [[nodiscard]] inline bool MPMCRingPush(MPMCRing<T>* s, const T& val);
+template<typename T> [[nodiscard]] inline bool MPMCRingPop(MPMCRing<T>* s, T* pVal);
+template<typename T> inline void MPMCRingDestroy(MPMCRing<T>* s, IAllocator* p);
+
+template<typename T> [[nodiscard]] inline bool MPSCRingPush(MPSCRing<T>* s, const T& val);
+template<typename T> [[nodiscard]] inline bool MPSCRingPop(MPSCRing<T>* s, T* pVal); /* consumer thread only */
+template<typename T> inline void MPSCRingDestroy(MPSCRing<T>* s, IAllocator* p);
+
+template<typename T> [[nodiscard]] inline bool SPSCRingPush(SPSCRing<T>* s, const T& val); /* producer thread only */
+template<typename T> [[nodiscard]] inline bool SPSCRingPop(SPSCRing<T>* s, T* pVal); /* consumer thread only */
+template<typename T> inline void SPSCRingDestroy(SPSCRing<T>* s, IAllocator* p);
+
+/* cell sequence numbers tell producers and consumers whose turn it is, so they never touch the other side's index */
+template<typename T>
+struct RingCell
+{
+    atomic_ullong seq;
+    T data;
+};
+
+template<typename T>
+inline RingCell<T>*
+_RingCellsAlloc(IAllocator* p, u64 cap)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "ring queues copy items with plain assignment");
+
+    auto* aCells = (RingCell<T>*)alloc(p, cap, sizeof(RingCell<T>));
+    for (u64 i = 0; i < cap; ++i)
+        atomic_store_explicit(&aCells[i].seq, i, memory_order_relaxed);
+
+    return aCells;
+}
+
+/* Vyukov's bounded MPMC queue */
+template<typename T>
+struct MPMCRing
+{
+    RingCell<T>* aCells {};
+    u64 mask {};
+    alignas(CACHE_LINE_SIZE) atomic_ullong enqPos;
+    alignas(CACHE_LINE_SIZE) atomic_ullong deqPos;
+
+    MPMCRing() = default;
+    MPMCRing(IAllocator* p, u32 cap)
+        : aCells(_RingCellsAlloc<T>(p, nextPowerOf2(cap))),
+          mask(nextPowerOf2(cap) - 1),
+          enqPos(0),
+          deqPos(0) { assert(cap > 1 && "[MPMCRing]: capacity must be at least 2"); }
+};
+
+template<typename T>
+inline bool
+MPMCRingPush(MPMCRing<T>* s, const T& val)
+{
+    u64 pos = atomic_load_explicit(&s->enqPos, memory_order_relaxed);
+
+    while (true)
+    {
+        RingCell<T>* pCell = &s->aCells[pos & s->mask];
+        const u64 seq = atomic_load_explicit(&pCell->seq, memory_order_acquire);
+        const s64 diff = s64(seq) - s64(pos);
+
+        if (diff == 0)
+        {
+            /* cell is free for this lap, claim it */
+            if (atomic_compare_exchange_weak_explicit(&s->enqPos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                pCell->data = val;
+                atomic_store_explicit(&pCell->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) return false; /* full */
+        else pos = atomic_load_explicit(&s->enqPos, memory_order_relaxed);
+    }
+}
+
+template<typename T>
+inline bool
+MPMCRingPop(MPMCRing<T>* s, T* pVal)
+{
+    u64 pos = atomic_load_explicit(&s->deqPos, memory_order_relaxed);
+
+    while (true)
+    {
+        RingCell<T>* pCell = &s->aCells[pos & s->mask];
+        const u64 seq = atomic_load_explicit(&pCell->seq, memory_order_acquire);
+        const s64 diff = s64(seq) - s64(pos + 1);
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&s->deqPos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *pVal = pCell->data;
+                /* hand the cell to the producer one lap ahead */
+                atomic_store_explicit(&pCell->seq, pos + s->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) return false; /* empty */
+        else pos = atomic_load_explicit(&s->deqPos, memory_order_relaxed);
+    }
+}
+
+template<typename T>
+inline void
+MPMCRingDestroy(MPMCRing<T>* s, IAllocator* p)
+{
+    free(p, s->aCells);
+    s->aCells = nullptr;
+}
+
+/* MPMCRing producers, the single consumer owns deqPos and skips the cas */
+template<typename T>
+struct MPSCRing
+{
+    RingCell<T>* aCells {};
+    u64 mask {};
+    alignas(CACHE_LINE_SIZE) atomic_ullong enqPos;
+    alignas(CACHE_LINE_SIZE) u64 deqPos {};
+
+    MPSCRing() = default;
+    MPSCRing(IAllocator* p, u32 cap)
+        : aCells(_RingCellsAlloc<T>(p, nextPowerOf2(cap))),
+          mask(nextPowerOf2(cap) - 1),
+          enqPos(0) { assert(cap > 1 && "[MPSCRing]: capacity must be at least 2"); }
+};
+
+template<typename T>
+inline bool
+MPSCRingPush(MPSCRing<T>* s, const T& val)
+{
+    u64 pos = atomic_load_explicit(&s->enqPos, memory_order_relaxed);
+
+    while (true)
+    {
+        RingCell<T>* pCell = &s->aCells[pos & s->mask];
+        const u64 seq = atomic_load_explicit(&pCell->seq, memory_order_acquire);
+        const s64 diff = s64(seq) - s64(pos);
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&s->enqPos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                pCell->data = val;
+                atomic_store_explicit(&pCell->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) return false;
+        else pos = atomic_load_explicit(&s->enqPos, memory_order_relaxed);
+    }
+}
+
+template<typename T>
+inline bool
+MPSCRingPop(MPSCRing<T>* s, T* pVal)
+{
+    const u64 pos = s->deqPos;
+    RingCell<T>* pCell = &s->aCells[pos & s->mask];
+
+    /* a claimed but not yet written cell reads as empty, the consumer just comes back later */
+    if (atomic_load_explicit(&pCell->seq, memory_order_acquire) != pos + 1) return false;
+
+    *pVal = pCell->data;
+    atomic_store_explicit(&pCell->seq, pos + s->mask + 1, memory_order_release);
+    s->deqPos = pos + 1;
+
+    return true;
+}
+
+template<typename T>
+inline void
+MPSCRingDestroy(MPSCRing<T>* s, IAllocator* p)
+{
+    free(p, s->aCells);
+    s->aCells = nullptr;
+}
+
+/* Lamport ring, each side keeps a stale copy of the other index and rereads it only when the ring looks full/empty */
+template<typename T>
+struct SPSCRing
+{
+    T* pData {};
+    u64 mask {};
+    alignas(CACHE_LINE_SIZE) atomic_ullong head; /* written by the consumer */
+    u64 tailCache {};
+    alignas(CACHE_LINE_SIZE) atomic_ullong tail; /* written by the producer */
+    u64 headCache {};
+
+    SPSCRing() = default;
+    SPSCRing(IAllocator* p, u32 cap)
+        : pData((T*)alloc(p, nextPowerOf2(cap), sizeof(T))),
+          mask(nextPowerOf2(cap) - 1),
+          head(0),
+          tail(0)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "ring queues copy items with plain assignment");
+        assert(cap > 1 && "[SPSCRing]: capacity must be at least 2");
+    }
+};
+
+template<typename T>
+inline bool
+SPSCRingPush(SPSCRing<T>* s, const T& val)
+{
+    const u64 t = atomic_load_explicit(&s->tail, memory_order_relaxed);
+
+    if (t - s->headCache > s->mask)
+    {
+        s->headCache = atomic_load_explicit(&s->head, memory_order_acquire);
+        if (t - s->headCache > s->mask) return false;
+    }
+
+    s->pData[t & s->mask] = val;
+    atomic_store_explicit(&s->tail, t + 1, memory_order_release);
+
+    return true;
+}
+
+template<typename T>
+inline bool
+SPSCRingPop(SPSCRing<T>* s, T* pVal)
+{
+    const u64 h = atomic_load_explicit(&s->head, memory_order_relaxed);
+
+    if (h == s->tailCache)
+    {
+        s->tailCache = atomic_load_explicit(&s->tail, memory_order_acquire);
+        if (h == s->tailCache) return false;
+    }
+
+    *pVal = s->pData[h & s->mask];
+    atomic_store_explicit(&s->head, h + 1, memory_order_release);
+
+    return true;
+}
+
+template<typename T>
+inline void
+SPSCRingDestroy(SPSCRing<T>* s, IAllocator* p)
+{
+    free(p, s->pData);
+    s->pData = nullptr;
+}
+
+} /* namespace adt */
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "IAllocator.hh"
+#include "utils.hh"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+namespace adt
+{
+
+constexpr u32 STATS_HISTOGRAM_SIZE = 48; /* bucket i: requests in [2^i, 2^(i+1)), 0 goes to bucket 0 */
+constexpr u32 STATS_TRACE_CAP = 256; /* distinct call sites, the rest only counts in nTracesDropped */
+constexpr u64 STATS_HEADER_SIZE = 16; /* keeps 16 byte alignment of the backing allocator */
+
+struct AllocatorStats
+{
+    u64 nAllocs {};
+    u64 nReallocs {};
+    u64 nReallocsInPlace {}; /* the backing allocator returned the same pointer */
+    u64 nFrees {};
+    u64 nExpands {}; /* tryExpand() calls that succeeded */
+    u64 nExpandsFailed {};
+    u64 nBytesRequested {}; /* over the whole lifetime, reallocs count their growth */
+    u64 nBytesLive {};
+    u64 nBytesPeak {};
+    u64 aHistogram[STATS_HISTOGRAM_SIZE] {};
+};
+
+/* allocations and their byte count per return address, symbolize with addr2line */
+struct StatsTrace
+{
+    void* pCaller {};
+    u64 nCalls {};
+    u64 nBytes {};
+};
+
+/* Wraps any IAllocator and counts what goes through it (not thread safe).
+ * Each allocation gets a 16 byte header with its size, so frees can be accounted.
+ * Only pass pointers from this wrapper to it, not from the backing allocator. */
+struct StatsAllocator
+{
+    IAllocator super {};
+    IAllocator* pBacking {};
+    bool bTrace {};
+    AllocatorStats stats {};
+    StatsTrace aTraces[STATS_TRACE_CAP] {};
+    u32 nTraces {};
+    u64 nTracesDropped {};
+
+    StatsAllocator() = default;
+    StatsAllocator(IAllocator* pBacking, bool bTrace = false);
+};
+
+inline void StatsFree(StatsAllocator* s, void* p);
+[[nodiscard]] inline bool StatsTryExpand(StatsAllocator* s, void* p, u64 mCount, u64 mSize);
+/* forwards to the backing allocator */
+inline void StatsFreeAll(StatsAllocator* s);
+inline void StatsReset(StatsAllocator* s);
+inline void StatsPrint(const StatsAllocator* s, FILE* pf);
+
+[[nodiscard]] constexpr u32
+_StatsBucket(u64 size)
+{
+    if (size == 0) return 0;
+    return utils::min(u32(63 - __builtin_clzll(size)), STATS_HISTOGRAM_SIZE - 1);
+}
+
+inline void
+_StatsRecord(StatsAllocator* s, u64 nBytes, void* pCaller)
+{
+    auto& st = s->stats;
+    st.nBytesRequested += nBytes;
+    st.nBytesLive += nBytes;
+    st.nBytesPeak = utils::max(st.nBytesPeak, st.nBytesLive);
+
+    if (!s->bTrace) return;
+
+    /* open addressing on the caller address */
+    u32 i = ((u64(pCaller) >> 2) * 0x9E3779B97F4A7C15ULL >> 32) % STATS_TRACE_CAP;
+    for (u32 nProbes = 0; nProbes < STATS_TRACE_CAP; ++nProbes, i = (i + 1) % STATS_TRACE_CAP)
+    {
+        auto& t = s->aTraces[i];
+        if (t.pCaller == pCaller || !t.pCaller)
+        {
+            if (!t.pCaller)
+            {
+                t.pCaller = pCaller;
+                ++s->nTraces;
+            }
+
+            ++t.nCalls;
+            t.nBytes += nBytes;
+            return;
+        }
+    }
+
+    ++s->nTracesDropped;
+}
+
+[[nodiscard]] inline u64*
+_StatsHeader(void* p)
+{
+    return (u64*)((u8*)p - STATS_HEADER_SIZE);
+}
+
+[[nodiscard]] inline void*
+_StatsAlloc(StatsAllocator* s, u64 size, bool bZero, void* pCaller)
+{
+    u8* p = (u8*)(bZero ?
+        zalloc(s->pBacking, 1, size + STATS_HEADER_SIZE) :
+        alloc(s->pBacking, 1, size + STATS_HEADER_SIZE)
+    );
+    *(u64*)p = size;
+
+    ++s->stats.nAllocs;
+    ++s->stats.aHistogram[_StatsBucket(size)];
+    _StatsRecord(s, size, pCaller);
+
+    return p + STATS_HEADER_SIZE;
+}
+
+/* not inlined, the return address is the call site */
+[[nodiscard, gnu::noinline]] inline void*
+StatsAlloc(StatsAllocator* s, u64 mCount, u64 mSize)
+{
+    return _StatsAlloc(s, mCount * mSize, false, __builtin_return_address(0));
+}
+
+[[nodiscard, gnu::noinline]] inline void*
+StatsZalloc(StatsAllocator* s, u64 mCount, u64 mSize)
+{
+    return _StatsAlloc(s, mCount * mSize, true, __builtin_return_address(0));
+}
+
+[[nodiscard, gnu::noinline]] inline void*
+StatsRealloc(StatsAllocator* s, void* p, u64 mCount, u64 mSize)
+{
+    if (!p) return _StatsAlloc(s, mCount * mSize, false, __builtin_return_address(0));
+
+    const u64 size = mCount * mSize;
+    u64* pHeader = _StatsHeader(p);
+    const u64 oldSize = *pHeader;
+
+    u64* pNew = (u64*)realloc(s->pBacking, pHeader, 1, size + STATS_HEADER_SIZE);
+    *pNew = size;
+
+    ++s->stats.nReallocs;
+    if (pNew == pHeader) ++s->stats.nReallocsInPlace;
+    ++s->stats.aHistogram[_StatsBucket(size)];
+
+    s->stats.nBytesLive -= oldSize;
+    _StatsRecord(s, size, __builtin_return_address(0));
+    /* only the growth is a new request */
+    s->stats.nBytesRequested -= utils::min(oldSize, size);
+
+    return (u8*)pNew + STATS_HEADER_SIZE;
+}
+
+[[nodiscard]] ADT_ALWAYS_INLINE inline void* alloc(StatsAllocator* s, u64 mCount, u64 mSize) { return StatsAlloc(s, mCount, mSize); }
+[[nodiscard]] ADT_ALWAYS_INLINE inline void* zalloc(StatsAllocator* s, u64 mCount, u64 mSize) { return StatsZalloc(s, mCount, mSize); }
+[[nodiscard]] ADT_ALWAYS_INLINE inline void* realloc(StatsAllocator* s, void* p, u64 mCount, u64 mSize) { return StatsRealloc(s, p, mCount, mSize); }
+inline void free(StatsAllocator* s, void* p) { StatsFree(s, p); }
+inline void freeAll(StatsAllocator* s) { StatsFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(StatsAllocator* s, void* p, u64 mCount, u64 mSize) { return StatsTryExpand(s, p, mCount, mSize); }
+
+inline void
+StatsFree(StatsAllocator* s, void* p)
+{
+    if (!p) return;
+
+    u64* pHeader = _StatsHeader(p);
+    ++s->stats.nFrees;
+    s->stats.nBytesLive -= *pHeader;
+
+    free(s->pBacking, pHeader);
+}
+
+inline bool
+StatsTryExpand(StatsAllocator* s, void* p, u64 mCount, u64 mSize)
+{
+    const u64 size = mCount * mSize;
+    u64* pHeader = _StatsHeader(p);
+
+    if (!tryExpand(s->pBacking, pHeader, 1, size + STATS_HEADER_SIZE))
+    {
+        ++s->stats.nExpandsFailed;
+        return false;
+    }
+
+    ++s->stats.nExpands;
+    if (size > *pHeader)
+    {
+        s->stats.nBytesRequested += size - *pHeader;
+        s->stats.nBytesLive += size - *pHeader;
+        s->stats.nBytesPeak = utils::max(s->stats.nBytesPeak, s->stats.nBytesLive);
+        *pHeader = size;
+    }
+
+    return true;
+}
+
+inline void
+StatsFreeAll(StatsAllocator* s)
+{
+    freeAll(s->pBacking);
+    s->stats.nBytesLive = 0;
+}
+
+inline void
+StatsReset(StatsAllocator* s)
+{
+    u64 nLive = s->stats.nBytesLive;
+    s->stats = {.nBytesLive = nLive, .nBytesPeak = nLive};
+
+    for (auto& t : s->aTraces) t = {};
+    s->nTraces = 0;
+    s->nTracesDropped = 0;
+}
+
+inline void
+StatsPrint(const StatsAllocator* s, FILE* pf)
+{
+    const auto& st = s->stats;
+
+    fprintf(pf, "[StatsAllocator]: allocs: %llu, reallocs: %llu (%llu in place, %.1f%%), frees: %llu\n",
+        st.nAllocs, st.nReallocs, st.nReallocsInPlace,
+        st.nReallocs ? 100.0 * st.nReallocsInPlace / st.nReallocs : 0.0, st.nFrees
+    );
+    fprintf(pf, "[StatsAllocator]: expands: %llu (%llu failed)\n", st.nExpands, st.nExpandsFailed);
+    fprintf(pf, "[StatsAllocator]: requested: %llu, live: %llu, peak: %llu bytes\n",
+        st.nBytesRequested, st.nBytesLive, st.nBytesPeak
+    );
+
+    for (u32 i = 0; i < STATS_HISTOGRAM_SIZE; ++i)
+        if (st.aHistogram[i]) fprintf(pf, "    [%llu, %llu): %llu\n", 1ULL << i, 2ULL << i, st.aHistogram[i]);
+
+    if (!s->bTrace) return;
+
+    /* biggest call sites first */
+    StatsTrace aSorted[STATS_TRACE_CAP];
+    u32 n = 0;
+    for (const auto& t : s->aTraces)
+    {
+        if (!t.pCaller) continue;
+
+        u32 j = n++;
+        for (; j > 0 && aSorted[j - 1].nBytes < t.nBytes; --j) aSorted[j] = aSorted[j - 1];
+        aSorted[j] = t;
+    }
+
+    fprintf(pf, "[StatsAllocator]: %u call sites (%llu dropped):\n", n, s->nTracesDropped);
+    for (u32 i = 0; i < n; ++i)
+        fprintf(pf, "    %p: %llu calls, %llu bytes\n", aSorted[i].pCaller, aSorted[i].nCalls, aSorted[i].nBytes);
+}
+
+inline const AllocatorVTable inl_StatsAllocatorVTable {
+    .alloc = decltype(AllocatorVTable::alloc)(StatsAlloc),
+    .zalloc = decltype(AllocatorVTable::zalloc)(StatsZalloc),
+    .realloc = decltype(AllocatorVTable::realloc)(StatsRealloc),
+    .free = decltype(AllocatorVTable::free)(StatsFree),
+    .freeAll = decltype(AllocatorVTable::freeAll)(StatsFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(StatsTryExpand),
+};
+
+inline
+StatsAllocator::StatsAllocator(IAllocator* _pBacking, bool _bTrace)
+    : super(&inl_StatsAllocatorVTable), pBacking(_pBacking), bTrace(_bTrace) {}
+
+} /* namespace adt */
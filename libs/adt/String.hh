@@ -35,6 +35,8 @@ constexpr u32 StringLastOf(String sv, char c);
 inline void StringDestroy(IAllocator* p, String* s);
 inline String StringCat(IAllocator* p, const String l, const String r);
 inline void StringAppend(String* l, const String r);
+/* l must come from StringAlloc(p, ...), grows in place if p can */
+inline void StringAppend(IAllocator* p, String* l, const String r);
 inline void StringTrimEnd(String* s);
 constexpr void StringRemoveNLEnd(String* s); /* removes nextline character if it ends with one */
 constexpr bool StringContains(String l, const String r);
@@ -317,6 +319,19 @@ StringAppend(String* l, const String r)
     l->size += r.size;
 }
 
+inline void
+StringAppend(IAllocator* p, String* l, const String r)
+{
+    u32 len = l->size + r.size;
+
+    if (!tryExpand(p, l->pData, len + 1, sizeof(char)))
+        l->pData = (char*)realloc(p, l->pData, len + 1, sizeof(char));
+
+    memcpy(l->pData + l->size, r.pData, r.size);
+    l->pData[len] = '\0';
+    l->size = len;
+}
+
 inline void
 StringTrimEnd(String* s)
 {
@@ -362,32 +377,33 @@ StringContains(String l, const String r)
     return false;
 }
 
+/* xxh64: strings used as keys are often long (paths, dictionary entries), fnv goes byte by byte */
 template<>
-constexpr u64
+inline u64
 hash::func(String& str)
 {
-    return hash::fnvStr(str.pData, str.size);
+    return hash::xxh64(str.pData, str.size);
 }
 
 template<>
-constexpr u64
+inline u64
 hash::func(const String& str)
 {
-    return hash::fnvStr(str.pData, str.size);
+    return hash::xxh64(str.pData, str.size);
 }
 
 template<>
 inline u64
 hash::funcHVal(String& str, u64 hashValue)
 {
-    return hash::fnvBuffHVal(str.pData, str.size, hashValue);
+    return hash::xxh64(str.pData, str.size, hashValue);
 }
 
 template<>
 inline u64
 hash::funcHVal(const String& str, u64 hashValue)
 {
-    return hash::fnvBuffHVal(str.pData, str.size, hashValue);
+    return hash::xxh64(str.pData, str.size, hashValue);
 }
 
 namespace utils
@@ -0,0 +1,517 @@
+/* open addressing hashmap with a separate control byte array (SwissTable layout).
+ * Each slot has a control byte: EMPTY, DELETED or the top 7 bits of the hash (h2).
+ * Lookups compare h2 against 16 control bytes at once (SSE2) and only touch slots that match,
+ * so a miss costs one control group load instead of walking the buckets.
+ * Capacity is a power of 2 (masking instead of %), groups are probed triangularly.
+ * When the load hits 7/8 and at least half of it is tombstones, the table rehashes in place without allocating.
+ * Keys and values are copied with operator=, same requirements as Map (hash::func() and operator==). */
+
+#pragma once
+
+#include "Map.hh"
+
+#if defined __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace adt
+{
+
+constexpr u32 SWISS_GROUP_WIDTH = 16;
+constexpr u32 SWISS_MIN_CAP = SWISS_GROUP_WIDTH;
+
+enum SWISS_CTRL : s8 { SWISS_EMPTY = -128, SWISS_DELETED = -2 }; /* full slots are 0..127 */
+
+template<typename K, typename V>
+struct SwissMapResult
+{
+    KeyVal<K, V>* pData {};
+    u64 hash {};
+    MAP_RESULT_STATUS eStatus {};
+
+    constexpr explicit operator bool() const
+    {
+        return this->pData != nullptr;
+    }
+};
+
+template<typename K, typename V> struct SwissMapBase;
+
+template<typename K, typename V>
+inline u32 SwissMapIdx(SwissMapBase<K, V>* s, SwissMapResult<K, V> res);
+
+template<typename K, typename V>
+inline u32 SwissMapFirstI(SwissMapBase<K, V>* s);
+
+template<typename K, typename V>
+inline u32 SwissMapNextI(SwissMapBase<K, V>* s, u32 i);
+
+template<typename K, typename V>
+inline f32 SwissMapLoadFactor(SwissMapBase<K, V>* s);
+
+/* does not check for duplicates */
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V> SwissMapInsert(SwissMapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val);
+
+template<typename K, typename V>
+[[nodiscard]] inline SwissMapResult<K, V> SwissMapSearch(SwissMapBase<K, V>* s, const K& key);
+
+template<typename K, typename V>
+inline void SwissMapRemove(SwissMapBase<K, V>* s, u32 i);
+
+template<typename K, typename V>
+inline void SwissMapRemove(SwissMapBase<K, V>* s, const K& key);
+
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V> SwissMapTryInsert(SwissMapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val);
+
+template<typename K, typename V, typename ALLOC_T>
+inline void SwissMapDestroy(SwissMapBase<K, V>* s, ALLOC_T* p);
+
+template<typename K, typename V>
+inline u32 SwissMapCap(SwissMapBase<K, V>* s);
+
+template<typename K, typename V>
+inline u32 SwissMapSize(SwissMapBase<K, V>* s);
+
+template<typename K, typename V, typename ALLOC_T>
+inline void _SwissMapResize(SwissMapBase<K, V>* s, ALLOC_T* p, u32 cap);
+
+template<typename K, typename V>
+inline void _SwissMapRehashInPlace(SwissMapBase<K, V>* s);
+
+template<typename K, typename V>
+struct SwissMapBase
+{
+    KeyVal<K, V>* pSlots {};
+    s8* pCtrl {}; /* cap + SWISS_GROUP_WIDTH bytes, the tail mirrors the first group so loads never wrap */
+    u32 cap {};
+    u32 nOccupied {};
+    u32 nGrowthLeft {}; /* free slots before the next resize/rehash, tombstones don't count as free */
+
+    SwissMapBase() = default;
+    template<typename ALLOC_T>
+    SwissMapBase(ALLOC_T* pAllocator, u32 prealloc = SIZE_MIN);
+
+    struct It
+    {
+        SwissMapBase* s {};
+        u32 i = 0;
+
+        It(SwissMapBase* _s, u32 _i) : s(_s), i(_i) {}
+
+        KeyVal<K, V>& operator*() { return s->pSlots[i]; }
+        KeyVal<K, V>* operator->() { return &s->pSlots[i]; }
+
+        It operator++()
+        {
+            i = SwissMapNextI(s, i);
+            return {s, i};
+        }
+        It operator++(int) { It tmp = *this; i = SwissMapNextI(s, i); return tmp; }
+
+        friend bool operator==(const It& l, const It& r) { return l.i == r.i; }
+        friend bool operator!=(const It& l, const It& r) { return l.i != r.i; }
+    };
+
+    It begin() { return {this, SwissMapFirstI(this)}; }
+    It end() { return {this, NPOS}; }
+
+    const It begin() const { return {this, SwissMapFirstI(this)}; }
+    const It end() const { return {this, NPOS}; }
+};
+
+/* the multiplicative hash::func() has weak low bits, fold the high ones in before masking */
+[[nodiscard]] constexpr u64
+_SwissH1(u64 hash)
+{
+    return hash ^ (hash >> 29);
+}
+
+[[nodiscard]] constexpr s8
+_SwissH2(u64 hash)
+{
+    return s8(hash >> 57);
+}
+
+[[nodiscard]] constexpr u32
+_SwissMaxLoad(u32 cap)
+{
+    return cap - cap / 8;
+}
+
+/* bit i set: pCtrl[i] == h2 */
+[[nodiscard]] inline u32
+_SwissMatch(const s8* pCtrl, s8 h2)
+{
+#if defined __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)pCtrl);
+    return u32(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2))));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < SWISS_GROUP_WIDTH; ++i)
+        mask |= u32(pCtrl[i] == h2) << i;
+    return mask;
+#endif
+}
+
+[[nodiscard]] inline u32
+_SwissMatchEmpty(const s8* pCtrl)
+{
+    return _SwissMatch(pCtrl, SWISS_EMPTY);
+}
+
+/* EMPTY and DELETED both have the sign bit set */
+[[nodiscard]] inline u32
+_SwissMatchEmptyOrDeleted(const s8* pCtrl)
+{
+#if defined __SSE2__
+    return u32(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)pCtrl)));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < SWISS_GROUP_WIDTH; ++i)
+        mask |= u32(pCtrl[i] < 0) << i;
+    return mask;
+#endif
+}
+
+template<typename K, typename V>
+inline void
+_SwissSetCtrl(SwissMapBase<K, V>* s, u32 i, s8 c)
+{
+    s->pCtrl[i] = c;
+    if (i < SWISS_GROUP_WIDTH) s->pCtrl[s->cap + i] = c;
+}
+
+/* first slot on the probe sequence that is empty or deleted, there is always one */
+template<typename K, typename V>
+[[nodiscard]] inline u32
+_SwissFindFree(SwissMapBase<K, V>* s, u64 hash)
+{
+    const u32 mask = s->cap - 1;
+    u32 pos = u32(_SwissH1(hash)) & mask;
+
+    for (u32 step = SWISS_GROUP_WIDTH; ; step += SWISS_GROUP_WIDTH)
+    {
+        u32 m = _SwissMatchEmptyOrDeleted(&s->pCtrl[pos]);
+        if (m) return (pos + __builtin_ctz(m)) & mask;
+
+        pos = (pos + step) & mask;
+    }
+}
+
+template<typename K, typename V>
+inline u32
+SwissMapIdx(SwissMapBase<K, V>* s, SwissMapResult<K, V> res)
+{
+    auto idx = res.pData - s->pSlots;
+    assert(idx < s->cap);
+    return idx;
+}
+
+template<typename K, typename V>
+inline u32
+SwissMapFirstI(SwissMapBase<K, V>* s)
+{
+    return SwissMapNextI(s, -1U);
+}
+
+template<typename K, typename V>
+inline u32
+SwissMapNextI(SwissMapBase<K, V>* s, u32 i)
+{
+    do ++i;
+    while (i < s->cap && s->pCtrl[i] < 0);
+
+    if (i >= s->cap) i = NPOS;
+
+    return i;
+}
+
+template<typename K, typename V>
+inline f32
+SwissMapLoadFactor(SwissMapBase<K, V>* s)
+{
+    return f32(s->nOccupied) / f32(s->cap);
+}
+
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V>
+SwissMapInsert(SwissMapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val)
+{
+    u64 keyHash = hash::func(key);
+
+    if (s->cap == 0) *s = {p};
+
+    u32 idx = _SwissFindFree(s, keyHash);
+
+    /* reusing a tombstone doesn't eat into the growth budget */
+    if (s->nGrowthLeft == 0 && s->pCtrl[idx] != SWISS_DELETED)
+    {
+        if (s->nOccupied <= _SwissMaxLoad(s->cap) / 2) _SwissMapRehashInPlace(s);
+        else _SwissMapResize(s, p, s->cap * 2);
+
+        idx = _SwissFindFree(s, keyHash);
+    }
+
+    if (s->pCtrl[idx] == SWISS_EMPTY) --s->nGrowthLeft;
+    _SwissSetCtrl(s, idx, _SwissH2(keyHash));
+    s->pSlots[idx].key = key;
+    s->pSlots[idx].val = val;
+    ++s->nOccupied;
+
+    return {
+        .pData = &s->pSlots[idx],
+        .hash = keyHash,
+        .eStatus = MAP_RESULT_STATUS::INSERTED
+    };
+}
+
+template<typename K, typename V>
+[[nodiscard]] inline SwissMapResult<K, V>
+SwissMapSearch(SwissMapBase<K, V>* s, const K& key)
+{
+    SwissMapResult<K, V> res {.eStatus = MAP_RESULT_STATUS::NOT_FOUND};
+
+    if (s->nOccupied == 0) return res;
+
+    u64 keyHash = hash::func(key);
+    res.hash = keyHash;
+
+    const u32 mask = s->cap - 1;
+    const s8 h2 = _SwissH2(keyHash);
+    u32 pos = u32(_SwissH1(keyHash)) & mask;
+
+    for (u32 step = SWISS_GROUP_WIDTH; step <= s->cap; step += SWISS_GROUP_WIDTH)
+    {
+        const s8* pGroup = &s->pCtrl[pos];
+
+        for (u32 m = _SwissMatch(pGroup, h2); m; m &= m - 1)
+        {
+            u32 idx = (pos + __builtin_ctz(m)) & mask;
+            if (s->pSlots[idx].key == key)
+            {
+                res.pData = &s->pSlots[idx];
+                res.eStatus = MAP_RESULT_STATUS::FOUND;
+                return res;
+            }
+        }
+
+        if (_SwissMatchEmpty(pGroup)) break;
+
+        pos = (pos + step) & mask;
+    }
+
+    return res;
+}
+
+template<typename K, typename V>
+inline void
+SwissMapRemove(SwissMapBase<K, V>* s, u32 i)
+{
+    assert(i < s->cap && s->pCtrl[i] >= 0 && "[SwissMap]: removing empty slot");
+
+    /* No probe sequence can have passed through this slot if every 16 wide window around it has an empty byte,
+     * then it's safe to mark it empty again instead of leaving a tombstone. */
+    const u32 mask = s->cap - 1;
+    u32 emptyBefore = _SwissMatchEmpty(&s->pCtrl[(i - SWISS_GROUP_WIDTH) & mask]);
+    u32 emptyAfter = _SwissMatchEmpty(&s->pCtrl[i]);
+    bool bWasNeverFull = emptyBefore && emptyAfter &&
+        u32(__builtin_ctz(emptyAfter)) + u32(__builtin_clz(emptyBefore) - 16) < SWISS_GROUP_WIDTH;
+
+    if (bWasNeverFull)
+    {
+        _SwissSetCtrl(s, i, SWISS_EMPTY);
+        ++s->nGrowthLeft;
+    }
+    else _SwissSetCtrl(s, i, SWISS_DELETED);
+
+    --s->nOccupied;
+}
+
+template<typename K, typename V>
+inline void
+SwissMapRemove(SwissMapBase<K, V>* s, const K& key)
+{
+    auto f = SwissMapSearch<K, V>(s, key);
+    assert(f && "[SwissMap]: not found");
+    SwissMapRemove<K, V>(s, SwissMapIdx(s, f));
+}
+
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V>
+SwissMapTryInsert(SwissMapBase<K, V>* s, ALLOC_T* p, const K& key, const V& val)
+{
+    auto f = SwissMapSearch<K, V>(s, key);
+    if (f)
+    {
+        f.eStatus = MAP_RESULT_STATUS::FOUND;
+        return f;
+    }
+    else return SwissMapInsert<K, V>(s, p, key, val);
+}
+
+template<typename K, typename V, typename ALLOC_T>
+inline void
+SwissMapDestroy(SwissMapBase<K, V>* s, ALLOC_T* p)
+{
+    free(p, s->pSlots);
+    *s = {};
+}
+
+template<typename K, typename V>
+inline u32
+SwissMapCap(SwissMapBase<K, V>* s)
+{
+    return s->cap;
+}
+
+template<typename K, typename V>
+inline u32
+SwissMapSize(SwissMapBase<K, V>* s)
+{
+    return s->nOccupied;
+}
+
+template<typename K, typename V, typename ALLOC_T>
+inline void
+_SwissMapResize(SwissMapBase<K, V>* s, ALLOC_T* p, u32 cap)
+{
+    auto mNew = SwissMapBase<K, V>(p, _SwissMaxLoad(cap));
+
+    for (u32 i = 0; i < s->cap; ++i)
+    {
+        if (s->pCtrl[i] < 0) continue;
+
+        u64 keyHash = hash::func(s->pSlots[i].key);
+        u32 idx = _SwissFindFree(&mNew, keyHash);
+        _SwissSetCtrl(&mNew, idx, _SwissH2(keyHash));
+        mNew.pSlots[idx] = s->pSlots[i];
+    }
+
+    mNew.nOccupied = s->nOccupied;
+    mNew.nGrowthLeft -= s->nOccupied;
+
+    SwissMapDestroy(s, p);
+    *s = mNew;
+}
+
+/* Drops all tombstones without allocating.
+ * Full slots are marked DELETED first, then each one is moved to the first free slot of its probe sequence,
+ * swapping with not yet processed entries when that slot is taken by one. */
+template<typename K, typename V>
+inline void
+_SwissMapRehashInPlace(SwissMapBase<K, V>* s)
+{
+    const u32 mask = s->cap - 1;
+
+    for (u32 i = 0; i < s->cap; ++i)
+        s->pCtrl[i] = s->pCtrl[i] < 0 ? SWISS_EMPTY : SWISS_DELETED;
+    memcpy(&s->pCtrl[s->cap], s->pCtrl, SWISS_GROUP_WIDTH);
+
+    for (u32 i = 0; i < s->cap; ++i)
+    {
+        if (s->pCtrl[i] != SWISS_DELETED) continue;
+
+        u64 keyHash = hash::func(s->pSlots[i].key);
+        const s8 h2 = _SwissH2(keyHash);
+        u32 probeStart = u32(_SwissH1(keyHash)) & mask;
+        u32 idx = _SwissFindFree(s, keyHash);
+
+        /* already in the right group for its probe sequence */
+        if (((idx - probeStart) & mask) / SWISS_GROUP_WIDTH == ((i - probeStart) & mask) / SWISS_GROUP_WIDTH)
+        {
+            _SwissSetCtrl(s, i, h2);
+            continue;
+        }
+
+        if (s->pCtrl[idx] == SWISS_EMPTY)
+        {
+            _SwissSetCtrl(s, idx, h2);
+            s->pSlots[idx] = s->pSlots[i];
+            _SwissSetCtrl(s, i, SWISS_EMPTY);
+        }
+        else
+        {
+            /* idx holds an entry that wasn't placed yet, swap and process slot i again */
+            _SwissSetCtrl(s, idx, h2);
+            utils::swap(&s->pSlots[idx], &s->pSlots[i]);
+            --i;
+        }
+    }
+
+    s->nGrowthLeft = _SwissMaxLoad(s->cap) - s->nOccupied;
+}
+
+template<typename K, typename V>
+template<typename ALLOC_T>
+SwissMapBase<K, V>::SwissMapBase(ALLOC_T* pAllocator, u32 prealloc)
+{
+    /* enough slots to hold prealloc entries under the max load */
+    cap = utils::max(u32(nextPowerOf2(prealloc + prealloc / 7)), SWISS_MIN_CAP);
+    nGrowthLeft = _SwissMaxLoad(cap);
+
+    /* slots first so they keep the allocator's alignment */
+    u8* pMem = (u8*)alloc(pAllocator, 1, sizeof(KeyVal<K, V>) * cap + cap + SWISS_GROUP_WIDTH);
+    pSlots = (KeyVal<K, V>*)pMem;
+    pCtrl = (s8*)(pMem + sizeof(KeyVal<K, V>) * cap);
+    memset(pCtrl, SWISS_EMPTY, cap + SWISS_GROUP_WIDTH);
+}
+
+template<typename K, typename V, typename ALLOC_T = IAllocator>
+struct SwissMapT
+{
+    SwissMapBase<K, V> base {};
+    ALLOC_T* pA {};
+
+    SwissMapT() = default;
+    SwissMapT(ALLOC_T* pAlloc, u32 prealloc = SIZE_MIN)
+        : base(pAlloc, prealloc), pA(pAlloc) {}
+
+    SwissMapBase<K, V>::It begin() { return base.begin(); }
+    SwissMapBase<K, V>::It end() { return base.end(); }
+
+    const SwissMapBase<K, V>::It begin() const { return base.begin(); }
+    const SwissMapBase<K, V>::It end() const { return base.end(); }
+};
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 SwissMapIdx(SwissMapT<K, V, ALLOC_T>* s, SwissMapResult<K, V> res) { return SwissMapIdx<K, V>(&s->base, res); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 SwissMapFirstI(SwissMapT<K, V, ALLOC_T>* s) { return SwissMapFirstI<K, V>(&s->base); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 SwissMapNextI(SwissMapT<K, V, ALLOC_T>* s, u32 i) { return SwissMapNextI<K, V>(&s->base, i); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline f32 SwissMapLoadFactor(SwissMapT<K, V, ALLOC_T>* s) { return SwissMapLoadFactor<K, V>(&s->base); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V> SwissMapInsert(SwissMapT<K, V, ALLOC_T>* s, const K& key, const V& val) { return SwissMapInsert<K, V>(&s->base, s->pA, key, val); }
+
+template<typename K, typename V, typename ALLOC_T>
+[[nodiscard]] inline SwissMapResult<K, V> SwissMapSearch(SwissMapT<K, V, ALLOC_T>* s, const K& key) { return SwissMapSearch<K, V>(&s->base, key); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline void SwissMapRemove(SwissMapT<K, V, ALLOC_T>* s, u32 i) { SwissMapRemove<K, V>(&s->base, i); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline void SwissMapRemove(SwissMapT<K, V, ALLOC_T>* s, const K& key) { SwissMapRemove<K, V>(&s->base, key); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline SwissMapResult<K, V> SwissMapTryInsert(SwissMapT<K, V, ALLOC_T>* s, const K& key, const V& val) { return SwissMapTryInsert<K, V>(&s->base, s->pA, key, val); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline void SwissMapDestroy(SwissMapT<K, V, ALLOC_T>* s) { SwissMapDestroy<K, V>(&s->base, s->pA); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 SwissMapCap(SwissMapT<K, V, ALLOC_T>* s) { return SwissMapCap<K, V>(&s->base); }
+
+template<typename K, typename V, typename ALLOC_T>
+inline u32 SwissMapSize(SwissMapT<K, V, ALLOC_T>* s) { return SwissMapSize<K, V>(&s->base); }
+
+template<typename K, typename V>
+using SwissMap = SwissMapT<K, V, IAllocator>;
+
+} /* namespace adt */
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "Arena.hh"
+
+#include <stdatomic.h>
+
+namespace adt
+{
+
+/* Thread caching arena, drop-in for MutexArena.
+ * Every thread bumps through its own region (one block handed out with an atomic), so the fast path has no locks or atomics.
+ * Each allocation carries an 8 byte size header for realloc.
+ * ThreadArenaReset() and ThreadArenaFreeAll() must not race with allocations, like ArenaReset() / ArenaFreeAll(). */
+struct ThreadArena
+{
+    IAllocator super {};
+    u64 id {}; /* never reused, keys the thread caches so a new arena at the same address starts clean */
+    u64 blockSize {};
+    atomic_ullong epoch; /* bumped on reset, caches from older epochs are dropped */
+    _Atomic(ArenaBlock*) pBlocks; /* every block, lock-free push only */
+    ArenaBlock** aReuse {}; /* blocks kept by the last reset */
+    u32 nReuse {};
+    atomic_uint reuseNext;
+
+    ThreadArena() = default;
+    ThreadArena(u64 blockSize);
+};
+
+[[nodiscard]] inline void* ThreadArenaAlloc(ThreadArena* s, u64 mCount, u64 mSize);
+[[nodiscard]] inline void* ThreadArenaZalloc(ThreadArena* s, u64 mCount, u64 mSize);
+[[nodiscard]] inline void* ThreadArenaRealloc(ThreadArena* s, void* p, u64 mCount, u64 mSize);
+/* only the calling thread's last allocation can grow */
+[[nodiscard]] inline bool ThreadArenaTryExpand(ThreadArena* s, void* p, u64 mCount, u64 mSize);
+inline void ThreadArenaFree(ThreadArena* s, void* p);
+inline void ThreadArenaFreeAll(ThreadArena* s);
+inline void ThreadArenaReset(ThreadArena* s);
+/* nBytesUsed is unknown, the bump pointers are per thread */
+[[nodiscard]] inline AllocatorUsage ThreadArenaUsage(ThreadArena* s);
+
+[[nodiscard]] inline void* alloc(ThreadArena* s, u64 mCount, u64 mSize) { return ThreadArenaAlloc(s, mCount, mSize); }
+[[nodiscard]] inline void* zalloc(ThreadArena* s, u64 mCount, u64 mSize) { return ThreadArenaZalloc(s, mCount, mSize); }
+[[nodiscard]] inline void* realloc(ThreadArena* s, void* p, u64 mCount, u64 mSize) { return ThreadArenaRealloc(s, p, mCount, mSize); }
+inline void free(ThreadArena* s, void* p) { ThreadArenaFree(s, p); }
+inline void freeAll(ThreadArena* s) { ThreadArenaFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(ThreadArena* s, void* p, u64 mCount, u64 mSize) { return ThreadArenaTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(ThreadArena* s) { return ThreadArenaUsage(s); }
+
+constexpr u32 THREAD_ARENA_CACHE_SLOTS = 8; /* arenas a thread can use without evicting its regions */
+constexpr u64 THREAD_ARENA_HEADER = 8;
+
+struct ThreadArenaCache
+{
+    u64 arenaId {}; /* 0: free slot */
+    u64 epoch {};
+    u8* pCur {};
+    u8* pEnd {};
+    u8* pLast {}; /* last allocation, grows in place */
+};
+
+inline thread_local ThreadArenaCache inl_aThreadArenaCaches[THREAD_ARENA_CACHE_SLOTS] {};
+inline thread_local u32 inl_threadArenaEvict {};
+inline atomic_ullong inl_threadArenaNextId {1};
+
+[[nodiscard]] inline ThreadArenaCache*
+_ThreadArenaCache(ThreadArena* s)
+{
+    const u64 epoch = atomic_load_explicit(&s->epoch, memory_order_relaxed);
+
+    for (auto& c : inl_aThreadArenaCaches)
+    {
+        if (c.arenaId == s->id)
+        {
+            if (c.epoch != epoch) c = {.arenaId = s->id, .epoch = epoch};
+            return &c;
+        }
+    }
+
+    /* the evicted region's tail is just left unused */
+    auto* pC = &inl_aThreadArenaCaches[inl_threadArenaEvict++ % THREAD_ARENA_CACHE_SLOTS];
+    *pC = {.arenaId = s->id, .epoch = epoch};
+
+    return pC;
+}
+
+inline void
+_ThreadArenaPushBlock(ThreadArena* s, ArenaBlock* pBlock)
+{
+    ArenaBlock* pHead = atomic_load_explicit(&s->pBlocks, memory_order_relaxed);
+    do pBlock->pNext = pHead;
+    while (!atomic_compare_exchange_weak_explicit(&s->pBlocks, &pHead, pBlock, memory_order_release, memory_order_relaxed));
+}
+
+[[nodiscard]] inline ArenaBlock*
+_ThreadArenaNewBlock(ThreadArena* s, u64 size)
+{
+    /* no calloc, zalloc clears what it hands out */
+    auto* pBlock = (ArenaBlock*)::malloc(sizeof(ArenaBlock) + size);
+    *pBlock = {.size = size};
+    _ThreadArenaPushBlock(s, pBlock);
+
+    return pBlock;
+}
+
+inline void
+_ThreadArenaRefill(ThreadArena* s, ThreadArenaCache* pC)
+{
+    ArenaBlock* pBlock = nullptr;
+
+    if (atomic_load_explicit(&s->reuseNext, memory_order_relaxed) < s->nReuse)
+    {
+        u32 i = atomic_fetch_add_explicit(&s->reuseNext, 1, memory_order_relaxed);
+        if (i < s->nReuse) pBlock = s->aReuse[i];
+    }
+
+    if (!pBlock) pBlock = _ThreadArenaNewBlock(s, s->blockSize);
+
+    pC->pCur = pBlock->pMem;
+    pC->pEnd = pBlock->pMem + pBlock->size;
+    pC->pLast = nullptr;
+}
+
+inline void*
+ThreadArenaAlloc(ThreadArena* s, u64 mCount, u64 mSize)
+{
+    const u64 size = align8(mCount * mSize);
+    const u64 need = size + THREAD_ARENA_HEADER;
+
+    ThreadArenaCache* pC = _ThreadArenaCache(s);
+
+    if (u64(pC->pEnd - pC->pCur) < need)
+    {
+        /* big ones get their own block and leave the current region alone */
+        if (need > s->blockSize / 4)
+        {
+            auto* pBlock = _ThreadArenaNewBlock(s, need);
+            *(u64*)pBlock->pMem = size;
+            return pBlock->pMem + THREAD_ARENA_HEADER;
+        }
+
+        _ThreadArenaRefill(s, pC);
+    }
+
+    u8* p = pC->pCur;
+    *(u64*)p = size;
+    pC->pCur += need;
+    pC->pLast = p + THREAD_ARENA_HEADER;
+
+    return pC->pLast;
+}
+
+inline void*
+ThreadArenaZalloc(ThreadArena* s, u64 mCount, u64 mSize)
+{
+    auto* p = ThreadArenaAlloc(s, mCount, mSize);
+    memset(p, 0, mCount * mSize);
+    return p;
+}
+
+inline void*
+ThreadArenaRealloc(ThreadArena* s, void* p, u64 mCount, u64 mSize)
+{
+    if (!p) return ThreadArenaAlloc(s, mCount, mSize);
+    if (ThreadArenaTryExpand(s, p, mCount, mSize)) return p;
+
+    auto* pRet = ThreadArenaAlloc(s, mCount, mSize);
+    memcpy(pRet, p, *(u64*)((u8*)p - THREAD_ARENA_HEADER));
+
+    return pRet;
+}
+
+inline bool
+ThreadArenaTryExpand(ThreadArena* s, void* p, u64 mCount, u64 mSize)
+{
+    u64* pHeader = (u64*)((u8*)p - THREAD_ARENA_HEADER);
+    const u64 size = align8(mCount * mSize);
+    if (size <= *pHeader) return true;
+
+    ThreadArenaCache* pC = _ThreadArenaCache(s);
+    if (pC->pLast != p || (u8*)p + size > pC->pEnd) return false;
+
+    /* bump case */
+    *pHeader = size;
+    pC->pCur = (u8*)p + size;
+
+    return true;
+}
+
+inline void
+ThreadArenaFree([[maybe_unused]] ThreadArena* s, [[maybe_unused]] void* p)
+{
+    /* no individual frees */
+}
+
+inline void
+ThreadArenaFreeAll(ThreadArena* s)
+{
+    atomic_fetch_add_explicit(&s->epoch, 1, memory_order_relaxed);
+
+    auto* it = atomic_load_explicit(&s->pBlocks, memory_order_acquire);
+    while (it)
+    {
+        auto* pNext = it->pNext;
+        ::free(it);
+        it = pNext;
+    }
+    atomic_store_explicit(&s->pBlocks, nullptr, memory_order_relaxed);
+
+    ::free(s->aReuse);
+    s->aReuse = nullptr;
+    s->nReuse = 0;
+    atomic_store_explicit(&s->reuseNext, 0, memory_order_relaxed);
+}
+
+/* keeps regular blocks for the next round of allocations, frees the oversized ones */
+inline void
+ThreadArenaReset(ThreadArena* s)
+{
+    atomic_fetch_add_explicit(&s->epoch, 1, memory_order_relaxed);
+
+    u32 nBlocks = 0;
+    for (auto* it = atomic_load_explicit(&s->pBlocks, memory_order_acquire); it; it = it->pNext)
+        ++nBlocks;
+
+    ::free(s->aReuse);
+    s->aReuse = (ArenaBlock**)::malloc(utils::max(nBlocks, 1U) * sizeof(ArenaBlock*));
+    s->nReuse = 0;
+
+    ArenaBlock* pKept = nullptr;
+    auto* it = atomic_load_explicit(&s->pBlocks, memory_order_relaxed);
+    while (it)
+    {
+        auto* pNext = it->pNext;
+        if (it->size == s->blockSize)
+        {
+            it->pNext = pKept;
+            pKept = it;
+            s->aReuse[s->nReuse++] = it;
+        }
+        else ::free(it);
+
+        it = pNext;
+    }
+
+    atomic_store_explicit(&s->pBlocks, pKept, memory_order_relaxed);
+    atomic_store_explicit(&s->reuseNext, 0, memory_order_release);
+}
+
+inline AllocatorUsage
+ThreadArenaUsage(ThreadArena* s)
+{
+    AllocatorUsage r {.nBytesUsed = NPOS64};
+
+    for (auto* it = atomic_load_explicit(&s->pBlocks, memory_order_acquire); it; it = it->pNext)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += it->size + sizeof(ArenaBlock);
+    }
+
+    return r;
+}
+
+inline const AllocatorVTable inl_ThreadArenaVTable {
+    .alloc = decltype(AllocatorVTable::alloc)(ThreadArenaAlloc),
+    .zalloc = decltype(AllocatorVTable::zalloc)(ThreadArenaZalloc),
+    .realloc = decltype(AllocatorVTable::realloc)(ThreadArenaRealloc),
+    .free = decltype(AllocatorVTable::free)(ThreadArenaFree),
+    .freeAll = decltype(AllocatorVTable::freeAll)(ThreadArenaFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(ThreadArenaTryExpand),
+};
+
+inline
+ThreadArena::ThreadArena(u64 _blockSize)
+    : super(&inl_ThreadArenaVTable),
+      id(atomic_fetch_add_explicit(&inl_threadArenaNextId, 1, memory_order_relaxed)),
+      blockSize(align8(_blockSize)),
+      epoch(0),
+      pBlocks(nullptr),
+      reuseNext(0) {}
+
+} /* namespace adt */
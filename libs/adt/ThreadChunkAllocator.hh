@@ -0,0 +1,303 @@
+#pragma once
+
+#include "IAllocator.hh"
+#include "utils.hh"
+
+#include <stdatomic.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+namespace adt
+{
+
+/* Thread caching ChunkAllocator (slab with magazines), safe to use from any thread.
+ * Each thread keeps two magazines of free chunks and swaps whole magazines with a lock-free depot,
+ * new chunks are carved from a block the thread owns. Alloc/free touch no atomics unless a magazine runs full or empty.
+ * Chunks may be freed by a different thread than the one that allocated them.
+ * Chunks cached by exited threads are only reclaimed by freeAll(). Calling realloc() is an error. */
+struct ThreadChunkAllocator;
+
+[[nodiscard]] inline void* ThreadChunkAlloc(ThreadChunkAllocator* s, u64 ignored0, u64 ignored1);
+[[nodiscard]] inline void* ThreadChunkZalloc(ThreadChunkAllocator* s, u64 ignored0, u64 ignored1);
+inline void ThreadChunkFree(ThreadChunkAllocator* s, void* p);
+/* fits if it fits the chunk */
+[[nodiscard]] inline bool ThreadChunkTryExpand(ThreadChunkAllocator* s, void* p, u64 mCount, u64 mSize);
+/* must not race with other calls */
+inline void ThreadChunkFreeAll(ThreadChunkAllocator* s);
+/* nBytesUsed is unknown, free chunks sit in per thread magazines */
+[[nodiscard]] inline AllocatorUsage ThreadChunkUsage(ThreadChunkAllocator* s);
+
+[[nodiscard]] inline void* alloc(ThreadChunkAllocator* s, u64 mCount, u64 mSize) { return ThreadChunkAlloc(s, mCount, mSize); }
+[[nodiscard]] inline void* zalloc(ThreadChunkAllocator* s, u64 mCount, u64 mSize) { return ThreadChunkZalloc(s, mCount, mSize); }
+inline void free(ThreadChunkAllocator* s, void* p) { ThreadChunkFree(s, p); }
+inline void freeAll(ThreadChunkAllocator* s) { ThreadChunkFreeAll(s); }
+[[nodiscard]] inline bool tryExpand(ThreadChunkAllocator* s, void* p, u64 mCount, u64 mSize) { return ThreadChunkTryExpand(s, p, mCount, mSize); }
+[[nodiscard]] inline AllocatorUsage usage(ThreadChunkAllocator* s) { return ThreadChunkUsage(s); }
+
+constexpr u32 CHUNK_MAGAZINE_CAP = 64;
+constexpr u32 CHUNK_CACHE_SLOTS = 8; /* allocators a thread can use without evicting its magazines */
+
+/* blockSize aligned, the owner of a chunk is found by masking */
+struct ThreadChunkBlock
+{
+    ThreadChunkBlock* pNext {};
+    ThreadChunkAllocator* pOwner {};
+    u8 pMem[];
+};
+
+/* lives in free chunks */
+struct ThreadChunkNode
+{
+    ThreadChunkNode* pNext {}; /* within a magazine */
+    ThreadChunkNode* pNextMagazine {}; /* depot stack, first chunk of a full magazine */
+};
+
+struct ThreadChunkAllocator
+{
+    IAllocator super {};
+    u64 id {};
+    u64 chunkSize {};
+    u64 blockSize {}; /* power of 2 */
+    atomic_ullong epoch; /* bumped by freeAll(), older thread caches are dropped */
+    _Atomic(ThreadChunkBlock*) pBlocks;
+    /* Treiber stack of full magazines, the top 16 bits are an ABA tag (48 bit user space pointers) */
+    atomic_ullong depot;
+
+    ThreadChunkAllocator() = default;
+    ThreadChunkAllocator(u64 chunkSize, u64 blockSize);
+};
+
+struct ThreadChunkCache
+{
+    u64 allocatorId {}; /* 0: free slot */
+    u64 epoch {};
+    ThreadChunkNode* pLoaded {};
+    u32 nLoaded {};
+    ThreadChunkNode* pPrev {};
+    u32 nPrev {};
+    u8* pCur {}; /* carving region */
+    u8* pEnd {};
+};
+
+inline thread_local ThreadChunkCache inl_aThreadChunkCaches[CHUNK_CACHE_SLOTS] {};
+inline thread_local u32 inl_threadChunkEvict {};
+inline thread_local ThreadChunkCache* inl_pThreadChunkLast = &inl_aThreadChunkCaches[0]; /* most recently used */
+inline atomic_ullong inl_threadChunkNextId {1};
+
+constexpr u64 CHUNK_DEPOT_PTR_MASK = (1ULL << 48) - 1;
+
+[[nodiscard]] inline ThreadChunkCache*
+_ThreadChunkCache(ThreadChunkAllocator* s)
+{
+    const u64 epoch = atomic_load_explicit(&s->epoch, memory_order_relaxed);
+
+    ThreadChunkCache* pC = inl_pThreadChunkLast;
+    if (pC->allocatorId == s->id && pC->epoch == epoch) [[likely]] return pC;
+
+    pC = nullptr;
+    for (auto& c : inl_aThreadChunkCaches)
+    {
+        if (c.allocatorId == s->id)
+        {
+            pC = &c;
+            if (c.epoch != epoch) c = {.allocatorId = s->id, .epoch = epoch};
+            break;
+        }
+    }
+
+    if (!pC)
+    {
+        /* evicted magazines stay unused until freeAll() */
+        pC = &inl_aThreadChunkCaches[inl_threadChunkEvict++ % CHUNK_CACHE_SLOTS];
+        *pC = {.allocatorId = s->id, .epoch = epoch};
+    }
+
+    inl_pThreadChunkLast = pC;
+    return pC;
+}
+
+inline void
+_ThreadChunkDepotPush(ThreadChunkAllocator* s, ThreadChunkNode* pMagazine)
+{
+    u64 old = atomic_load_explicit(&s->depot, memory_order_relaxed);
+    u64 next;
+    do
+    {
+        pMagazine->pNextMagazine = (ThreadChunkNode*)(old & CHUNK_DEPOT_PTR_MASK);
+        next = ((old & ~CHUNK_DEPOT_PTR_MASK) + (1ULL << 48)) | u64(pMagazine);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&s->depot, &old, next, memory_order_release, memory_order_relaxed));
+}
+
+[[nodiscard]] inline ThreadChunkNode*
+_ThreadChunkDepotPop(ThreadChunkAllocator* s)
+{
+    u64 old = atomic_load_explicit(&s->depot, memory_order_acquire);
+    ThreadChunkNode* pTop;
+    u64 next;
+    do
+    {
+        pTop = (ThreadChunkNode*)(old & CHUNK_DEPOT_PTR_MASK);
+        if (!pTop) return nullptr;
+
+        /* pTop may be popped and reused meanwhile, then the tag makes the cas fail */
+        next = ((old & ~CHUNK_DEPOT_PTR_MASK) + (1ULL << 48)) | u64(pTop->pNextMagazine);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&s->depot, &old, next, memory_order_acquire, memory_order_acquire));
+
+    return pTop;
+}
+
+inline void
+_ThreadChunkNewBlock(ThreadChunkAllocator* s, ThreadChunkCache* pC)
+{
+    auto* pBlock = (ThreadChunkBlock*)::aligned_alloc(s->blockSize, s->blockSize);
+    assert(pBlock != nullptr && "[ThreadChunkAllocator]: aligned_alloc failed");
+    pBlock->pOwner = s;
+
+    ThreadChunkBlock* pHead = atomic_load_explicit(&s->pBlocks, memory_order_relaxed);
+    do pBlock->pNext = pHead;
+    while (!atomic_compare_exchange_weak_explicit(&s->pBlocks, &pHead, pBlock, memory_order_release, memory_order_relaxed));
+
+    pC->pCur = pBlock->pMem;
+    pC->pEnd = (u8*)pBlock + s->blockSize;
+}
+
+inline void*
+ThreadChunkAlloc(ThreadChunkAllocator* s, [[maybe_unused]] u64 ignored0, [[maybe_unused]] u64 ignored1)
+{
+    ThreadChunkCache* pC = _ThreadChunkCache(s);
+
+    if (!pC->pLoaded)
+    {
+        if (pC->pPrev)
+        {
+            utils::swap(&pC->pLoaded, &pC->pPrev);
+            utils::swap(&pC->nLoaded, &pC->nPrev);
+        }
+        else if (auto* pMagazine = _ThreadChunkDepotPop(s))
+        {
+            pC->pLoaded = pMagazine;
+            pC->nLoaded = CHUNK_MAGAZINE_CAP;
+        }
+        else
+        {
+            if (u64(pC->pEnd - pC->pCur) < s->chunkSize) _ThreadChunkNewBlock(s, pC);
+
+            void* pRet = pC->pCur;
+            pC->pCur += s->chunkSize;
+            return pRet;
+        }
+    }
+
+    auto* pNode = pC->pLoaded;
+    pC->pLoaded = pNode->pNext;
+    --pC->nLoaded;
+
+    return pNode;
+}
+
+inline void*
+ThreadChunkZalloc(ThreadChunkAllocator* s, u64 ignored0, u64 ignored1)
+{
+    auto* p = ThreadChunkAlloc(s, ignored0, ignored1);
+    memset(p, 0, s->chunkSize);
+    return p;
+}
+
+inline void*
+_ThreadChunkRealloc(
+    [[maybe_unused]] ThreadChunkAllocator* s,
+    [[maybe_unused]] void* ___ignored,
+    [[maybe_unused]] u64 _ignored,
+    [[maybe_unused]] u64 __ignored
+)
+{
+    assert(false && "ThreadChunkAllocator can't realloc()");
+    return nullptr;
+}
+
+inline bool
+ThreadChunkTryExpand(ThreadChunkAllocator* s, [[maybe_unused]] void* p, u64 mCount, u64 mSize)
+{
+    return mCount * mSize <= s->chunkSize;
+}
+
+inline void
+ThreadChunkFree(ThreadChunkAllocator* s, void* p)
+{
+    if (!p) return;
+
+    assert(((ThreadChunkBlock*)(u64(p) & ~(s->blockSize - 1)))->pOwner == s && "[ThreadChunkAllocator]: bad pointer?");
+
+    ThreadChunkCache* pC = _ThreadChunkCache(s);
+
+    if (pC->nLoaded == CHUNK_MAGAZINE_CAP)
+    {
+        if (pC->nPrev == CHUNK_MAGAZINE_CAP) _ThreadChunkDepotPush(s, pC->pPrev);
+        else assert(pC->nPrev == 0);
+
+        pC->pPrev = pC->pLoaded;
+        pC->nPrev = CHUNK_MAGAZINE_CAP;
+        pC->pLoaded = nullptr;
+        pC->nLoaded = 0;
+    }
+
+    auto* pNode = (ThreadChunkNode*)p;
+    pNode->pNext = pC->pLoaded;
+    pC->pLoaded = pNode;
+    ++pC->nLoaded;
+}
+
+inline void
+ThreadChunkFreeAll(ThreadChunkAllocator* s)
+{
+    atomic_fetch_add_explicit(&s->epoch, 1, memory_order_relaxed);
+
+    auto* it = atomic_load_explicit(&s->pBlocks, memory_order_acquire);
+    while (it)
+    {
+        auto* pNext = it->pNext;
+        ::free(it);
+        it = pNext;
+    }
+
+    atomic_store_explicit(&s->pBlocks, nullptr, memory_order_relaxed);
+    atomic_store_explicit(&s->depot, 0, memory_order_relaxed);
+}
+
+inline AllocatorUsage
+ThreadChunkUsage(ThreadChunkAllocator* s)
+{
+    AllocatorUsage r {.nBytesUsed = NPOS64};
+
+    for (auto* it = atomic_load_explicit(&s->pBlocks, memory_order_acquire); it; it = it->pNext)
+    {
+        ++r.nBlocks;
+        r.nBytesReserved += s->blockSize;
+    }
+
+    return r;
+}
+
+inline const AllocatorVTable inl_threadChunkAllocatorVTable {
+    .alloc = decltype(AllocatorVTable::alloc)(ThreadChunkAlloc),
+    .zalloc = decltype(AllocatorVTable::zalloc)(ThreadChunkZalloc),
+    .realloc = decltype(AllocatorVTable::realloc)(_ThreadChunkRealloc),
+    .free = decltype(AllocatorVTable::free)(ThreadChunkFree),
+    .freeAll = decltype(AllocatorVTable::freeAll)(ThreadChunkFreeAll),
+    .tryExpand = decltype(AllocatorVTable::tryExpand)(ThreadChunkTryExpand),
+};
+
+inline
+ThreadChunkAllocator::ThreadChunkAllocator(u64 _chunkSize, u64 _blockSize)
+    : super {&inl_threadChunkAllocatorVTable},
+      id {atomic_fetch_add_explicit(&inl_threadChunkNextId, 1, memory_order_relaxed)},
+      chunkSize {align8(utils::max(_chunkSize, u64(sizeof(ThreadChunkNode))))},
+      blockSize {nextPowerOf2(utils::max(_blockSize, sizeof(ThreadChunkBlock) + chunkSize * 16))},
+      epoch {0},
+      pBlocks {nullptr},
+      depot {0} {}
+
+} /* namespace adt */
@@ -4,6 +4,7 @@
 #include "Vec.hh"
 #include "defer.hh"
 #include "guard.hh"
+#include "Futex.hh"
 
 #include <stdatomic.h>
 #include <cstdio>
@@ -13,6 +14,8 @@ namespace adt
 
 #ifdef __linux__
     #include <sys/sysinfo.h>
+    #include <pthread.h>
+    #include <sched.h>
 
     #define ADT_GET_NCORES() get_nprocs()
 #elif _WIN32
@@ -71,9 +74,7 @@ inline void ThreadPoolLockDestroy(ThreadPoolLock* s);
 /* wait for individual task completion without ThreadPoolWait */
 struct ThreadPoolLock
 {
-    atomic_bool bSignaled;
-    mtx_t mtx;
-    cnd_t cnd;
+    atomic_int bSignaled; /* set by the worker, cleared again by ThreadPoolLockWait() */
 
     ThreadPoolLock() = default;
     ThreadPoolLock(INIT_FLAG e) { if (e == INIT_FLAG::INIT) ThreadPoolLockInit(this); }
@@ -82,78 +83,290 @@ struct ThreadPoolLock
 inline void
 ThreadPoolLockInit(ThreadPoolLock* s)
 {
-    atomic_store_explicit(&s->bSignaled, false, memory_order_relaxed);
-    mtx_init(&s->mtx, mtx_plain);
-    cnd_init(&s->cnd);
+    atomic_store_explicit(&s->bSignaled, 0, memory_order_relaxed);
 }
 
 inline void
 ThreadPoolLockWait(ThreadPoolLock* s)
 {
-    guard::Mtx lock(&s->mtx);
-    cnd_wait(&s->cnd, &s->mtx);
-    /* notify thread pool's spinlock that we have woken up */
-    atomic_store_explicit(&s->bSignaled, true, memory_order_relaxed);
+    while (atomic_load_explicit(&s->bSignaled, memory_order_acquire) == 0)
+        futexWait(&s->bSignaled, 0);
+
+    /* ready for the next ThreadPoolSubmitSignal() */
+    atomic_store_explicit(&s->bSignaled, 0, memory_order_relaxed);
 }
 
 inline void
-ThreadPoolLockDestroy(ThreadPoolLock* s)
+ThreadPoolLockDestroy([[maybe_unused]] ThreadPoolLock* s)
 {
-    mtx_destroy(&s->mtx);
-    cnd_destroy(&s->cnd);
 }
 
+struct ThreadPool;
+struct ThreadPoolGroup;
+
+inline void ThreadPoolGroupInit(ThreadPoolGroup* s, ThreadPool* pPool);
+inline void ThreadPoolGroupSubmit(ThreadPoolGroup* s, thrd_start_t pfnTask, void* pArgs);
+/* Blocks until every task submitted to the group has finished.
+ * Runs queued tasks of the pool meanwhile, so waiting from inside a worker doesn't starve the pool. */
+inline void ThreadPoolGroupWait(ThreadPoolGroup* s);
+inline void ThreadPoolGroupDestroy(ThreadPoolGroup* s);
+
+/* counts unfinished tasks, reusable after ThreadPoolGroupWait() */
+struct ThreadPoolGroup
+{
+    ThreadPool* pPool;
+    atomic_int nPending; /* waiters sleep on it, the task that brings it to zero wakes them */
+
+    ThreadPoolGroup() = default;
+    ThreadPoolGroup(ThreadPool* pPool) { ThreadPoolGroupInit(this, pPool); }
+};
+
+struct ThreadPoolFuture;
+
+inline void ThreadPoolFutureInit(ThreadPoolFuture* s, ThreadPool* pPool);
+inline void ThreadPoolSubmitFuture(ThreadPoolFuture* s, thrd_start_t pfnTask, void* pArgs);
+[[nodiscard]] inline int ThreadPoolFutureWait(ThreadPoolFuture* s); /* return value of pfnTask */
+inline void ThreadPoolFutureDestroy(ThreadPoolFuture* s);
+
+/* result of one task */
+struct ThreadPoolFuture
+{
+    ThreadPoolGroup group;
+    int result;
+
+    ThreadPoolFuture() = default;
+    ThreadPoolFuture(ThreadPool* pPool) { ThreadPoolFutureInit(this, pPool); }
+};
+
 struct ThreadTask
 {
     thrd_start_t pfn {};
     void* pArgs {};
     WAIT_FLAG eWait {};
     ThreadPoolLock* pLock {};
+    ThreadPoolGroup* pGroup {}; /* counted down after pfn returns */
+    int* pResult {}; /* gets pfn's return value */
 };
 
+enum class THREAD_POOL_MODE : u8
+{
+    SHARED_QUEUE, /* one queue under mtxQ */
+    WORK_STEALING, /* per worker deques, qTasks only takes submissions from outside of the pool */
+};
+
+constexpr s64 WORK_DEQUE_CAP = 1024; /* power of 2, local submits spill into qTasks when full */
+
+struct WorkDeque;
+
+inline bool WorkDequePush(WorkDeque* s, const ThreadTask& task); /* owner only, false if full */
+inline bool WorkDequePop(WorkDeque* s, ThreadTask* pTask); /* owner only, LIFO */
+inline bool WorkDequeSteal(WorkDeque* s, ThreadTask* pTask); /* any thread, FIFO, false if empty or lost a race */
+inline bool WorkDequeEmpty(WorkDeque* s);
+
+/* Chase-Lev deque with a fixed ring (Le, Pop, Cohen, Nardelli: "Correct and Efficient Work-Stealing for Weak Memory Models") */
+struct WorkDeque
+{
+    atomic_llong top;
+    atomic_llong bottom;
+    ThreadTask* pData;
+};
+
+struct ThreadPoolWorker
+{
+    WorkDeque dq;
+    ThreadPool* pPool;
+    u64 rngState; /* victim selection */
+    u32 idx;
+};
+
+/* worker of the pool that runs on this thread, if any */
+inline thread_local ThreadPoolWorker* inl_pThreadPoolWorker {};
+
 struct ThreadPool
 {
     IAllocator* pAlloc {};
     QueueBase<ThreadTask> qTasks {};
     VecBase<thrd_t> aThreads {};
-    cnd_t cndQ {}, cndWait {};
-    mtx_t mtxQ {}, mtxWait {};
+    cnd_t cndQ {};
+    mtx_t mtxQ {};
     atomic_int nActiveTasks {};
-    atomic_int nActiveThreadsInLoop {};
+    atomic_int idleSeq {}; /* bumped whenever the pool runs out of work, ThreadPoolWait() sleeps on it */
+    atomic_int nIdleWaiters {}; /* skip the wake syscall when nobody is in ThreadPoolWait() */
     atomic_bool bDone {};
     bool bStarted {};
 
+    THREAD_POOL_MODE eMode {};
+    ThreadPoolWorker* aWorkers {}; /* WORK_STEALING only */
+    atomic_int nPending {}; /* WORK_STEALING: submitted and not yet finished */
+    atomic_int nQueued {}; /* WORK_STEALING: qTasks size, readable without mtxQ */
+    atomic_int nSleeping {}; /* WORK_STEALING: parked on cndQ */
+    VecBase<u32> aAffinity {}; /* worker i runs on cpu aAffinity[i % size], empty means no pinning */
+
     ThreadPool() = default;
-    ThreadPool(IAllocator* pAlloc, u32 _nThreads = ADT_GET_NCORES());
+    ThreadPool(IAllocator* pAlloc, u32 _nThreads = ADT_GET_NCORES(), THREAD_POOL_MODE eMode = THREAD_POOL_MODE::SHARED_QUEUE);
 };
 
 inline void ThreadPoolStart(ThreadPool* s);
+/* pin workers round robin to aCpus (linux only), call before ThreadPoolStart() */
+inline void ThreadPoolSetAffinity(ThreadPool* s, const u32* aCpus, u32 nCpus);
 inline bool ThreadPoolBusy(ThreadPool* s);
 inline void ThreadPoolSubmit(ThreadPool* s, ThreadTask task);
 inline void ThreadPoolSubmit(ThreadPool* s, thrd_start_t pfnTask, void* pArgs);
-/* Signal ThreadPoolLock after completion.
- * If ThreadPoolLockWait was never called for this pTpLock, the task will spinlock forever,
- * unless pTpLock->bSignaled is manually set to true; */
+/* Signal ThreadPoolLock after completion, ThreadPoolLockWait() returns right away if the task has already finished. */
 inline void ThreadPoolSubmitSignal(ThreadPool* s, thrd_start_t pfnTask, void* pArgs, ThreadPoolLock* pTpLock);
 inline void ThreadPoolWait(ThreadPool* s); /* wait for all active tasks to finish, without joining */
 
+/* Calls fn(chunkBegin, chunkEnd) for [begin, end) split into grain sized chunks.
+ * Chunks are handed out dynamically to at most one task per worker plus the calling thread, returns when all are done. */
+template<typename FN>
+inline void parallelFor(ThreadPool* s, u64 begin, u64 end, u64 grain, FN fn);
+
+inline bool
+WorkDequePush(WorkDeque* s, const ThreadTask& task)
+{
+    const s64 b = atomic_load_explicit(&s->bottom, memory_order_relaxed);
+    const s64 t = atomic_load_explicit(&s->top, memory_order_acquire);
+    if (b - t >= WORK_DEQUE_CAP) return false;
+
+    s->pData[b & (WORK_DEQUE_CAP - 1)] = task;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+inline bool
+WorkDequePop(WorkDeque* s, ThreadTask* pTask)
+{
+    const s64 b = atomic_load_explicit(&s->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&s->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 t = atomic_load_explicit(&s->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        atomic_store_explicit(&s->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *pTask = s->pData[b & (WORK_DEQUE_CAP - 1)];
+    if (t < b) return true;
+
+    /* last task, race thieves for it */
+    bool bWon = atomic_compare_exchange_strong_explicit(&s->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&s->bottom, b + 1, memory_order_relaxed);
+
+    return bWon;
+}
+
+inline bool
+WorkDequeSteal(WorkDeque* s, ThreadTask* pTask)
+{
+    s64 t = atomic_load_explicit(&s->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const s64 b = atomic_load_explicit(&s->bottom, memory_order_acquire);
+
+    if (t >= b) return false;
+
+    /* the owner may overwrite this slot once top moves on, the cas fails in that case and the copy is dropped */
+    ThreadTask task = s->pData[t & (WORK_DEQUE_CAP - 1)];
+    if (!atomic_compare_exchange_strong_explicit(&s->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return false;
+
+    *pTask = task;
+    return true;
+}
+
+inline bool
+WorkDequeEmpty(WorkDeque* s)
+{
+    return atomic_load_explicit(&s->bottom, memory_order_relaxed) - atomic_load_explicit(&s->top, memory_order_relaxed) <= 0;
+}
+
 inline
-ThreadPool::ThreadPool(IAllocator* _pAlloc, u32 _nThreads)
+ThreadPool::ThreadPool(IAllocator* _pAlloc, u32 _nThreads, THREAD_POOL_MODE _eMode)
     : pAlloc(_pAlloc),
       qTasks(_pAlloc, _nThreads),
       aThreads(_pAlloc, _nThreads),
       nActiveTasks(0),
-      nActiveThreadsInLoop(0),
+      idleSeq(0),
+      nIdleWaiters(0),
       bDone(true),
-      bStarted(false)
+      bStarted(false),
+      eMode(_eMode),
+      nPending(0),
+      nQueued(0),
+      nSleeping(0)
 {
     assert(_nThreads != 0 && "can't have thread pool with zero threads");
     VecSetSize(&aThreads, _pAlloc, _nThreads);
 
+    if (eMode == THREAD_POOL_MODE::WORK_STEALING)
+    {
+        aWorkers = (ThreadPoolWorker*)zalloc(_pAlloc, _nThreads, sizeof(ThreadPoolWorker));
+        for (u32 i = 0; i < _nThreads; ++i)
+        {
+            auto& w = aWorkers[i];
+            atomic_store_explicit(&w.dq.top, 0, memory_order_relaxed);
+            atomic_store_explicit(&w.dq.bottom, 0, memory_order_relaxed);
+            w.dq.pData = (ThreadTask*)alloc(_pAlloc, WORK_DEQUE_CAP, sizeof(ThreadTask));
+            w.pPool = this;
+            w.rngState = (i + 1) * 0x9e3779b97f4a7c15ULL;
+            w.idx = i;
+        }
+    }
+
     cnd_init(&cndQ);
     mtx_init(&mtxQ, mtx_plain);
-    cnd_init(&cndWait);
-    mtx_init(&mtxWait, mtx_plain);
+}
+
+inline void
+_ThreadPoolGroupDone(ThreadPoolGroup* s)
+{
+    /* the waiter may already be gone by the time we wake it, that's fine for futexes */
+    if (atomic_fetch_sub_explicit(&s->nPending, 1, memory_order_acq_rel) == 1)
+        futexWakeAll(&s->nPending);
+}
+
+inline void
+_ThreadPoolSignalTask(ThreadTask* pTask, int result)
+{
+    if (pTask->pResult) *pTask->pResult = result;
+    if (pTask->pGroup) _ThreadPoolGroupDone(pTask->pGroup);
+
+    if (pTask->eWait == WAIT_FLAG::WAIT)
+    {
+        atomic_store_explicit(&pTask->pLock->bSignaled, 1, memory_order_release);
+        futexWakeOne(&pTask->pLock->bSignaled);
+    }
+}
+
+/* task is already counted in nActiveTasks (SHARED_QUEUE) or nPending (WORK_STEALING) */
+inline void
+_ThreadPoolRunTask(ThreadPool* s, ThreadTask* pTask)
+{
+    int result = pTask->pfn(pTask->pArgs);
+
+    bool bIdle;
+    if (s->eMode == THREAD_POOL_MODE::WORK_STEALING)
+    {
+        _ThreadPoolSignalTask(pTask, result);
+        bIdle = atomic_fetch_sub_explicit(&s->nPending, 1, memory_order_acq_rel) == 1;
+    }
+    else
+    {
+        atomic_fetch_sub_explicit(&s->nActiveTasks, 1, memory_order_relaxed);
+        _ThreadPoolSignalTask(pTask, result);
+        bIdle = !ThreadPoolBusy(s);
+    }
+
+    if (bIdle)
+    {
+        /* a waiter that read idleSeq before this bump won't go to sleep on the stale value */
+        atomic_fetch_add_explicit(&s->idleSeq, 1, memory_order_seq_cst);
+        if (atomic_load_explicit(&s->nIdleWaiters, memory_order_seq_cst) > 0)
+            futexWakeAll(&s->idleSeq);
+    }
 }
 
 inline int
@@ -161,9 +374,6 @@ _ThreadPoolLoop(void* p)
 {
     auto* s = (ThreadPool*)p;
 
-    atomic_fetch_add_explicit(&s->nActiveThreadsInLoop, 1, memory_order_relaxed);
-    defer( atomic_fetch_sub_explicit(&s->nActiveThreadsInLoop, 1, memory_order_relaxed) );
-
     while (!s->bDone)
     {
         ThreadTask task;
@@ -180,18 +390,84 @@ _ThreadPoolLoop(void* p)
             atomic_fetch_add_explicit(&s->nActiveTasks, 1, memory_order_relaxed);
         }
 
-        task.pfn(task.pArgs);
-        atomic_fetch_sub_explicit(&s->nActiveTasks, 1, memory_order_relaxed);
+        _ThreadPoolRunTask(s, &task);
+    }
+
+    return thrd_success;
+}
+
+inline bool
+_ThreadPoolPopQueued(ThreadPool* s, ThreadTask* pTask)
+{
+    if (atomic_load_explicit(&s->nQueued, memory_order_relaxed) <= 0) return false;
+
+    guard::Mtx lock(&s->mtxQ);
+    if (utils::empty(&s->qTasks)) return false;
+
+    *pTask = *QueuePopFront(&s->qTasks);
+    atomic_fetch_sub_explicit(&s->nQueued, 1, memory_order_relaxed);
+
+    return true;
+}
+
+inline bool
+_ThreadPoolSteal(ThreadPoolWorker* w, ThreadTask* pTask)
+{
+    ThreadPool* s = w->pPool;
+    const u32 nWorkers = VecSize(&s->aThreads);
+
+    for (u32 nTries = 0; nTries < nWorkers * 2; ++nTries)
+    {
+        /* xorshift64 */
+        w->rngState ^= w->rngState << 13;
+        w->rngState ^= w->rngState >> 7;
+        w->rngState ^= w->rngState << 17;
+
+        const u32 victim = w->rngState % nWorkers;
+        if (victim == w->idx) continue;
+
+        if (WorkDequeSteal(&s->aWorkers[victim].dq, pTask)) return true;
+    }
+
+    return false;
+}
+
+inline bool
+_ThreadPoolHasWork(ThreadPool* s)
+{
+    if (atomic_load_explicit(&s->nQueued, memory_order_relaxed) > 0) return true;
+
+    for (u32 i = 0; i < VecSize(&s->aThreads); ++i)
+        if (!WorkDequeEmpty(&s->aWorkers[i].dq)) return true;
+
+    return false;
+}
 
-        if (task.eWait == WAIT_FLAG::WAIT)
+inline int
+_ThreadPoolStealingLoop(void* p)
+{
+    auto* w = (ThreadPoolWorker*)p;
+    ThreadPool* s = w->pPool;
+    inl_pThreadPoolWorker = w;
+
+    while (!s->bDone)
+    {
+        ThreadTask task;
+        if (WorkDequePop(&w->dq, &task) || _ThreadPoolPopQueued(s, &task) || _ThreadPoolSteal(w, &task))
         {
-            /* keep signaling until it's truly awakaned */
-            while (atomic_load_explicit(&task.pLock->bSignaled, memory_order_relaxed) == false)
-                cnd_signal(&task.pLock->cnd);
+            _ThreadPoolRunTask(s, &task);
+            continue;
         }
 
-        if (!ThreadPoolBusy(s))
-            cnd_signal(&s->cndWait);
+        /* park, submitters signal cndQ only when they see nSleeping > 0 */
+        guard::Mtx lock(&s->mtxQ);
+        atomic_fetch_add_explicit(&s->nSleeping, 1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        while (!s->bDone && !_ThreadPoolHasWork(s))
+            cnd_wait(&s->cndQ, &s->mtxQ);
+
+        atomic_fetch_sub_explicit(&s->nSleeping, 1, memory_order_relaxed);
     }
 
     return thrd_success;
@@ -207,18 +483,44 @@ ThreadPoolStart(ThreadPool* s)
     fprintf(stderr, "[ThreadPool]: staring %d threads\n", VecSize(&s->aThreads));
 #endif
 
-    for (auto& thread : s->aThreads)
+    for (u32 i = 0; i < VecSize(&s->aThreads); ++i)
     {
-        [[maybe_unused]] int t = thrd_create(&thread, _ThreadPoolLoop, s);
+        [[maybe_unused]] int t = s->eMode == THREAD_POOL_MODE::WORK_STEALING ?
+            thrd_create(&s->aThreads[i], _ThreadPoolStealingLoop, &s->aWorkers[i]) :
+            thrd_create(&s->aThreads[i], _ThreadPoolLoop, s);
 #ifndef NDEBUG
         assert(t == 0 && "failed to create thread");
 #endif
+
+#ifdef __linux__
+        if (VecSize(&s->aAffinity) > 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(s->aAffinity[i % VecSize(&s->aAffinity)], &set);
+            /* thrd_t is a pthread_t with glibc and musl */
+            pthread_setaffinity_np(s->aThreads[i], sizeof(set), &set);
+        }
+#endif
     }
 }
 
+inline void
+ThreadPoolSetAffinity(ThreadPool* s, const u32* aCpus, u32 nCpus)
+{
+    assert(!s->bStarted && "[ThreadPool]: set affinity before ThreadPoolStart()");
+
+    VecSetSize(&s->aAffinity, s->pAlloc, nCpus);
+    for (u32 i = 0; i < nCpus; ++i)
+        s->aAffinity[i] = aCpus[i];
+}
+
 inline bool
 ThreadPoolBusy(ThreadPool* s)
 {
+    if (s->eMode == THREAD_POOL_MODE::WORK_STEALING)
+        return atomic_load_explicit(&s->nPending, memory_order_acquire) > 0;
+
     bool ret;
     {
         guard::Mtx lock(&s->mtxQ);
@@ -228,9 +530,38 @@ ThreadPoolBusy(ThreadPool* s)
     return ret;
 }
 
+/* from a worker of s: onto its own deque, otherwise into qTasks */
+inline void
+_ThreadPoolSubmitStealing(ThreadPool* s, const ThreadTask& task)
+{
+    atomic_fetch_add_explicit(&s->nPending, 1, memory_order_relaxed);
+
+    ThreadPoolWorker* w = inl_pThreadPoolWorker;
+    if (!w || w->pPool != s || !WorkDequePush(&w->dq, task))
+    {
+        guard::Mtx lock(&s->mtxQ);
+        QueuePushBack(&s->qTasks, s->pAlloc, task);
+        atomic_fetch_add_explicit(&s->nQueued, 1, memory_order_relaxed);
+    }
+
+    /* pairs with the fence in the parking path: either we see the sleeper or it sees the task */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s->nSleeping, memory_order_relaxed) > 0)
+    {
+        guard::Mtx lock(&s->mtxQ);
+        cnd_signal(&s->cndQ);
+    }
+}
+
 inline void
 ThreadPoolSubmit(ThreadPool* s, ThreadTask task)
 {
+    if (s->eMode == THREAD_POOL_MODE::WORK_STEALING)
+    {
+        _ThreadPoolSubmitStealing(s, task);
+        return;
+    }
+
     {
         guard::Mtx lock(&s->mtxQ);
         QueuePushBack(&s->qTasks, s->pAlloc, task);
@@ -250,7 +581,7 @@ ThreadPoolSubmit(ThreadPool* s, thrd_start_t pfnTask, void* pArgs)
 inline void
 ThreadPoolSubmitSignal(ThreadPool* s, thrd_start_t pfnTask, void* pArgs, ThreadPoolLock* pTpLock)
 {
-    ThreadPoolSubmit(s, {pfnTask, pArgs, WAIT_FLAG::WAIT, pTpLock});
+    ThreadPoolSubmit(s, {.pfn = pfnTask, .pArgs = pArgs, .eWait = WAIT_FLAG::WAIT, .pLock = pTpLock});
 }
 
 inline void
@@ -258,11 +589,153 @@ ThreadPoolWait(ThreadPool* s)
 {
     assert(s->bStarted && "[ThreadPool]: never called ThreadPoolStart()");
 
-    while (ThreadPoolBusy(s))
+    atomic_fetch_add_explicit(&s->nIdleWaiters, 1, memory_order_seq_cst);
+
+    while (true)
+    {
+        const int seq = atomic_load_explicit(&s->idleSeq, memory_order_seq_cst);
+        if (!ThreadPoolBusy(s)) break;
+
+        futexWait(&s->idleSeq, seq);
+    }
+
+    atomic_fetch_sub_explicit(&s->nIdleWaiters, 1, memory_order_relaxed);
+}
+
+/* run one queued task on the calling thread, false if there was nothing to take */
+inline bool
+_ThreadPoolRunOne(ThreadPool* s)
+{
+    ThreadTask task;
+
+    if (s->eMode == THREAD_POOL_MODE::WORK_STEALING)
+    {
+        ThreadPoolWorker* w = inl_pThreadPoolWorker;
+        const bool bWorker = w && w->pPool == s;
+
+        bool bGot = (bWorker && WorkDequePop(&w->dq, &task)) ||
+            _ThreadPoolPopQueued(s, &task) ||
+            (bWorker && _ThreadPoolSteal(w, &task));
+
+        if (!bGot) return false;
+    }
+    else
     {
-        guard::Mtx lock(&s->mtxWait);
-        cnd_wait(&s->cndWait, &s->mtxWait);
+        guard::Mtx lock(&s->mtxQ);
+        if (utils::empty(&s->qTasks)) return false;
+
+        task = *QueuePopFront(&s->qTasks);
+        atomic_fetch_add_explicit(&s->nActiveTasks, 1, memory_order_relaxed);
     }
+
+    _ThreadPoolRunTask(s, &task);
+    return true;
+}
+
+inline void
+ThreadPoolGroupInit(ThreadPoolGroup* s, ThreadPool* pPool)
+{
+    s->pPool = pPool;
+    atomic_store_explicit(&s->nPending, 0, memory_order_relaxed);
+}
+
+inline void
+ThreadPoolGroupSubmit(ThreadPoolGroup* s, thrd_start_t pfnTask, void* pArgs)
+{
+    atomic_fetch_add_explicit(&s->nPending, 1, memory_order_relaxed);
+    ThreadPoolSubmit(s->pPool, {.pfn = pfnTask, .pArgs = pArgs, .pGroup = s});
+}
+
+inline void
+ThreadPoolGroupWait(ThreadPoolGroup* s)
+{
+    while (atomic_load_explicit(&s->nPending, memory_order_acquire) > 0)
+        if (!_ThreadPoolRunOne(s->pPool)) break;
+
+    /* the rest is running on other threads */
+    int n;
+    while ((n = atomic_load_explicit(&s->nPending, memory_order_acquire)) > 0)
+        futexWait(&s->nPending, n);
+}
+
+inline void
+ThreadPoolGroupDestroy([[maybe_unused]] ThreadPoolGroup* s)
+{
+}
+
+inline void
+ThreadPoolFutureInit(ThreadPoolFuture* s, ThreadPool* pPool)
+{
+    ThreadPoolGroupInit(&s->group, pPool);
+    s->result = 0;
+}
+
+inline void
+ThreadPoolSubmitFuture(ThreadPoolFuture* s, thrd_start_t pfnTask, void* pArgs)
+{
+    assert(atomic_load_explicit(&s->group.nPending, memory_order_relaxed) == 0 && "[ThreadPool]: future is already in use");
+
+    atomic_fetch_add_explicit(&s->group.nPending, 1, memory_order_relaxed);
+    ThreadPoolSubmit(s->group.pPool, {.pfn = pfnTask, .pArgs = pArgs, .pGroup = &s->group, .pResult = &s->result});
+}
+
+inline int
+ThreadPoolFutureWait(ThreadPoolFuture* s)
+{
+    ThreadPoolGroupWait(&s->group);
+    return s->result;
+}
+
+inline void
+ThreadPoolFutureDestroy(ThreadPoolFuture* s)
+{
+    ThreadPoolGroupDestroy(&s->group);
+}
+
+template<typename FN>
+inline void
+parallelFor(ThreadPool* s, u64 begin, u64 end, u64 grain, FN fn)
+{
+    if (begin >= end) return;
+    if (grain == 0) grain = 1;
+
+    struct Range
+    {
+        FN* pFn;
+        atomic_ullong next;
+        u64 end;
+        u64 grain;
+    } range;
+
+    range.pFn = &fn;
+    atomic_store_explicit(&range.next, begin, memory_order_relaxed);
+    range.end = end;
+    range.grain = grain;
+
+    auto work = +[](void* p) -> int {
+        auto* r = (Range*)p;
+
+        while (true)
+        {
+            u64 i = atomic_fetch_add_explicit(&r->next, r->grain, memory_order_relaxed);
+            if (i >= r->end) break;
+
+            (*r->pFn)(i, utils::min(r->end - i, r->grain) + i);
+        }
+
+        return thrd_success;
+    };
+
+    const u64 nChunks = (end - begin + grain - 1) / grain;
+    const u64 nTasks = utils::min(nChunks, u64(VecSize(&s->aThreads)) + 1) - 1; /* the caller takes a share too */
+
+    ThreadPoolGroup group(s);
+    for (u64 i = 0; i < nTasks; ++i)
+        ThreadPoolGroupSubmit(&group, work, &range);
+
+    work(&range);
+    ThreadPoolGroupWait(&group);
+    ThreadPoolGroupDestroy(&group);
 }
 
 inline void
@@ -278,11 +751,12 @@ _ThreadPoolStop(ThreadPool* s)
         return;
     }
 
-    atomic_store(&s->bDone, true);
-
-    /* some threads might not cnd_wait() in time, so keep signaling untill all return from the loop */
-    while (atomic_load_explicit(&s->nActiveThreadsInLoop, memory_order_relaxed) > 0)
+    {
+        /* workers check bDone under mtxQ before every cnd_wait(), so one broadcast reaches all of them */
+        guard::Mtx lock(&s->mtxQ);
+        atomic_store(&s->bDone, true);
         cnd_broadcast(&s->cndQ);
+    }
 
     for (auto& thread : s->aThreads)
         thrd_join(thread, nullptr);
@@ -293,12 +767,18 @@ ThreadPoolDestroy(ThreadPool* s)
 {
     _ThreadPoolStop(s);
 
+    if (s->aWorkers)
+    {
+        for (u32 i = 0; i < VecSize(&s->aThreads); ++i)
+            free(s->pAlloc, s->aWorkers[i].dq.pData);
+        free(s->pAlloc, s->aWorkers);
+    }
+
+    VecDestroy(&s->aAffinity, s->pAlloc);
     VecDestroy(&s->aThreads, s->pAlloc);
     QueueDestroy(&s->qTasks, s->pAlloc);
     cnd_destroy(&s->cndQ);
     mtx_destroy(&s->mtxQ);
-    cnd_destroy(&s->cndWait);
-    mtx_destroy(&s->mtxWait);
 }
 
 } /* namespace adt */
@@ -12,11 +12,13 @@ namespace adt
 #define ADT_VEC_FOREACH_I(A, I) for (u32 I = 0; I < (A)->size; ++I)
 #define ADT_VEC_FOREACH_I_REV(A, I) for (u32 I = (A)->size - 1; I != -1U ; --I)
 
-/* Dynamic array (aka Vector) */
+/* Dynamic array (aka Vector).
+ * VecBase takes the allocator per call, any allocator type with alloc()/realloc()/free() overloads works.
+ * Passing the concrete type (Arena* instead of IAllocator*) skips the vtable and lets the fast path inline. */
 template<typename T> struct VecBase;
 
-template<typename T> inline u32
-VecPush(VecBase<T>* s, IAllocator* p, const T& data);
+template<typename T, typename ALLOC_T> inline u32
+VecPush(VecBase<T>* s, ALLOC_T* p, const T& data);
 
 template<typename T>
 [[nodiscard]] inline T& VecLast(VecBase<T>* s);
@@ -33,11 +35,11 @@ template<typename T>
 template<typename T>
 inline T* VecPop(VecBase<T>* s);
 
-template<typename T>
-inline void VecSetSize(VecBase<T>* s, IAllocator* p, u32 size);
+template<typename T, typename ALLOC_T>
+inline void VecSetSize(VecBase<T>* s, ALLOC_T* p, u32 size);
 
-template<typename T>
-inline void VecSetCap(VecBase<T>* s, IAllocator* p, u32 cap);
+template<typename T, typename ALLOC_T>
+inline void VecSetCap(VecBase<T>* s, ALLOC_T* p, u32 cap);
 
 template<typename T>
 inline void VecSwapWithLast(VecBase<T>* s, u32 i);
@@ -57,8 +59,8 @@ template<typename T>
 template<typename T>
 [[nodiscard]] inline const T& VecAt(const VecBase<T>* s, u32 at);
 
-template<typename T>
-inline void VecDestroy(VecBase<T>* s, IAllocator* p);
+template<typename T, typename ALLOC_T>
+inline void VecDestroy(VecBase<T>* s, ALLOC_T* p);
 
 template<typename T>
 [[nodiscard]] inline u32 VecSize(const VecBase<T>* s);
@@ -72,11 +74,11 @@ template<typename T>
 template<typename T>
 inline void VecZeroOut(VecBase<T>* s);
 
-template<typename T>
-[[nodiscard]] inline VecBase<T> VecClone(const VecBase<T>* s, IAllocator* pAlloc);
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline VecBase<T> VecClone(const VecBase<T>* s, ALLOC_T* pAlloc);
 
-template<typename T>
-inline void _VecGrow(VecBase<T>* s, IAllocator* p, u32 newCapacity);
+template<typename T, typename ALLOC_T>
+inline void _VecGrow(VecBase<T>* s, ALLOC_T* p, u32 newCapacity);
 
 template<typename T>
 struct VecBase
@@ -86,7 +88,8 @@ struct VecBase
     u32 capacity = 0;
 
     VecBase() = default;
-    VecBase(IAllocator* p, u32 prealloc = 1)
+    template<typename ALLOC_T>
+    VecBase(ALLOC_T* p, u32 prealloc = 1)
         : pData((T*)alloc(p, prealloc, sizeof(T))),
           size(0),
           capacity(prealloc) {}
@@ -124,9 +127,9 @@ struct VecBase
     const It rend() const { return {this->pData - 1}; }
 };
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline u32
-VecPush(VecBase<T>* s, IAllocator* p, const T& data)
+VecPush(VecBase<T>* s, ALLOC_T* p, const T& data)
 {
     if (s->size >= s->capacity) _VecGrow(s, p, utils::max(s->capacity * 2U, u32(SIZE_MIN)));
 
@@ -170,18 +173,18 @@ VecPop(VecBase<T>* s)
     return &s->pData[--s->size];
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-VecSetSize(VecBase<T>* s, IAllocator* p, u32 size)
+VecSetSize(VecBase<T>* s, ALLOC_T* p, u32 size)
 {
     if (s->capacity < size) _VecGrow(s, p, size);
 
     s->size = size;
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-VecSetCap(VecBase<T>* s, IAllocator* p, u32 cap)
+VecSetCap(VecBase<T>* s, ALLOC_T* p, u32 cap)
 {
     s->pData = (T*)realloc(p, s->pData, cap, sizeof(T));
     s->capacity = cap;
@@ -235,9 +238,9 @@ VecAt(const VecBase<T>* s, u32 at)
     return s->pData[at];
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-VecDestroy(VecBase<T>* s, IAllocator* p)
+VecDestroy(VecBase<T>* s, ALLOC_T* p)
 {
     free(p, s->pData);
 }
@@ -270,9 +273,9 @@ VecZeroOut(VecBase<T>* s)
     memset(s->pData, 0, s->size * sizeof(T));
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 [[nodiscard]] inline VecBase<T>
-VecClone(const VecBase<T>* s, IAllocator* pAlloc)
+VecClone(const VecBase<T>* s, ALLOC_T* pAlloc)
 {
     auto nVec = VecBase<T>(pAlloc, s->capacity);
     memcpy(nVec.pData, s->pData, s->size * sizeof(T));
@@ -281,23 +284,28 @@ VecClone(const VecBase<T>* s, IAllocator* pAlloc)
     return nVec;
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline void
-_VecGrow(VecBase<T>* s, IAllocator* p, u32 newCapacity)
+_VecGrow(VecBase<T>* s, ALLOC_T* p, u32 newCapacity)
 {
     assert(newCapacity * sizeof(T) > 0);
+
+    /* no copy if the allocator can grow it where it is */
+    if (!s->pData || !tryExpand(p, s->pData, newCapacity, sizeof(T)))
+        s->pData = (T*)realloc(p, s->pData, newCapacity, sizeof(T));
+
     s->capacity = newCapacity;
-    s->pData = (T*)realloc(p, s->pData, newCapacity, sizeof(T));
 }
 
-template<typename T>
-struct Vec
+/* VecT<T, Arena> resolves allocations statically, growing the last allocation of an Arena is an in-place bump */
+template<typename T, typename ALLOC_T = IAllocator>
+struct VecT
 {
     VecBase<T> base {};
-    IAllocator* pAlloc = nullptr;
+    ALLOC_T* pAlloc = nullptr;
 
-    Vec() = default;
-    Vec(IAllocator* p, u32 prealloc = 1) : base(p, prealloc), pAlloc(p) {}
+    VecT() = default;
+    VecT(ALLOC_T* p, u32 prealloc = 1) : base(p, prealloc), pAlloc(p) {}
 
     T& operator[](u32 i) { return base[i]; }
     const T& operator[](u32 i) const { return base[i]; }
@@ -313,82 +321,85 @@ struct Vec
     const VecBase<T>::It rend() const { return rend(); }
 };
 
-template<typename T>
-inline u32 VecPush(Vec<T>* s, const T& data) { return VecPush<T>(&s->base, s->pAlloc, data); }
+template<typename T, typename ALLOC_T>
+inline u32 VecPush(VecT<T, ALLOC_T>* s, const T& data) { return VecPush<T>(&s->base, s->pAlloc, data); }
 
-template<typename T>
-[[nodiscard]] inline T& VecLast(Vec<T>* s) { return VecLast<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline T& VecLast(VecT<T, ALLOC_T>* s) { return VecLast<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline const T& VecLast(Vec<T>* s) { return VecLast<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline const T& VecLast(VecT<T, ALLOC_T>* s) { return VecLast<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline T& VecFirst(Vec<T>* s) { return VecFirst<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline T& VecFirst(VecT<T, ALLOC_T>* s) { return VecFirst<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline const T& VecFirst(const Vec<T>* s) { return VecFirst<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline const T& VecFirst(const VecT<T, ALLOC_T>* s) { return VecFirst<T>(&s->base); }
 
-template<typename T>
-inline T* VecPop(Vec<T>* s) { return VecPop<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline T* VecPop(VecT<T, ALLOC_T>* s) { return VecPop<T>(&s->base); }
 
-template<typename T>
-inline void VecSetSize(Vec<T>* s, u32 size) { VecSetSize<T>(&s->base, s->pAlloc, size); }
+template<typename T, typename ALLOC_T>
+inline void VecSetSize(VecT<T, ALLOC_T>* s, u32 size) { VecSetSize<T>(&s->base, s->pAlloc, size); }
 
-template<typename T>
-inline void VecSetCap(Vec<T>* s, u32 cap) { VecSetCap<T>(&s->base, s->pAlloc, cap); }
+template<typename T, typename ALLOC_T>
+inline void VecSetCap(VecT<T, ALLOC_T>* s, u32 cap) { VecSetCap<T>(&s->base, s->pAlloc, cap); }
 
-template<typename T>
-inline void VecSwapWithLast(Vec<T>* s, u32 i) { VecSwapWithLast<T>(&s->base, i); }
+template<typename T, typename ALLOC_T>
+inline void VecSwapWithLast(VecT<T, ALLOC_T>* s, u32 i) { VecSwapWithLast<T>(&s->base, i); }
 
-template<typename T>
-inline void VecPopAsLast(Vec<T>* s, u32 i) { VecPopAsLast<T>(&s->base, i); }
+template<typename T, typename ALLOC_T>
+inline void VecPopAsLast(VecT<T, ALLOC_T>* s, u32 i) { VecPopAsLast<T>(&s->base, i); }
 
-template<typename T>
-[[nodiscard]] inline u32 VecIdx(const Vec<T>* s, const T* x) { return VecIdx<T>(&s->base, x); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline u32 VecIdx(const VecT<T, ALLOC_T>* s, const T* x) { return VecIdx<T>(&s->base, x); }
 
-template<typename T>
-[[nodiscard]] inline u32 VecLastI(const Vec<T>* s) { return VecLastI<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline u32 VecLastI(const VecT<T, ALLOC_T>* s) { return VecLastI<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline T& VecAt(Vec<T>* s, u32 at) { return VecAt<T>(&s->base, at); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline T& VecAt(VecT<T, ALLOC_T>* s, u32 at) { return VecAt<T>(&s->base, at); }
 
-template<typename T>
-[[nodiscard]] inline const T& VecAt(const Vec<T>* s, u32 at) { return VecAt<T>(&s->base, at); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline const T& VecAt(const VecT<T, ALLOC_T>* s, u32 at) { return VecAt<T>(&s->base, at); }
 
-template<typename T>
-inline void VecDestroy(Vec<T>* s) { VecDestroy<T>(&s->base, s->pAlloc); }
+template<typename T, typename ALLOC_T>
+inline void VecDestroy(VecT<T, ALLOC_T>* s) { VecDestroy<T>(&s->base, s->pAlloc); }
 
-template<typename T>
-inline u32 VecSize(const Vec<T>* s) { return VecSize<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline u32 VecSize(const VecT<T, ALLOC_T>* s) { return VecSize<T>(&s->base); }
 
-template<typename T>
-inline u32 VecCap(const Vec<T>* s) { return VecCap<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline u32 VecCap(const VecT<T, ALLOC_T>* s) { return VecCap<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline T* VecData(Vec<T>* s) { return VecData<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline T* VecData(VecT<T, ALLOC_T>* s) { return VecData<T>(&s->base); }
 
-template<typename T>
-inline void VecZeroOut(Vec<T>* s) { VecZeroOut<T>(&s->base); }
+template<typename T, typename ALLOC_T>
+inline void VecZeroOut(VecT<T, ALLOC_T>* s) { VecZeroOut<T>(&s->base); }
 
-template<typename T>
-[[nodiscard]] inline Vec<T>
-VecClone(const Vec<T>* s, IAllocator* pAlloc)
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline VecT<T, ALLOC_T>
+VecClone(const VecT<T, ALLOC_T>* s, ALLOC_T* pAlloc)
 {
     auto base = VecClone(&s->base, pAlloc);
-    Vec<T> nVec;
+    VecT<T, ALLOC_T> nVec;
     nVec.base = base;
     nVec.pAlloc = pAlloc;
     return nVec;
 }
 
+template<typename T>
+using Vec = VecT<T, IAllocator>;
+
 namespace utils
 {
 
 template<typename T>
 [[nodiscard]] inline bool empty(const VecBase<T>* s) { return s->size == 0; }
 
-template<typename T>
-[[nodiscard]] inline bool empty(const Vec<T>* s) { return empty(&s->base); }
+template<typename T, typename ALLOC_T>
+[[nodiscard]] inline bool empty(const VecT<T, ALLOC_T>* s) { return empty(&s->base); }
 
 } /* namespace utils */
 
@@ -420,9 +431,9 @@ formatToContext(Context ctx, [[maybe_unused]] FormatArgs fmtArgs, const VecBase<
     return print::copyBackToBuffer(ctx, aBuff, utils::size(aBuff));
 }
 
-template<typename T>
+template<typename T, typename ALLOC_T>
 inline u32
-formatToContext(Context ctx, FormatArgs fmtArgs, const Vec<T>& x)
+formatToContext(Context ctx, FormatArgs fmtArgs, const VecT<T, ALLOC_T>& x)
 {
     return formatToContext(ctx, fmtArgs, x.base);
 }
@@ -58,6 +58,12 @@
 
 #include "types.hh"
 
+#include <cstring>
+
+#if defined __x86_64__
+    #include <nmmintrin.h>
+#endif
+
 namespace adt
 {
 namespace hash
@@ -177,5 +183,248 @@ funcHVal(const char (&aChars)[N], u64 hashValue)
     return fnvACharHVal(aChars, hashValue);
 }
 
+/* XXH64 (Yann Collet's xxHash, 64 bit variant).
+ * Four independent lanes eat 8 bytes per multiply each, instead of FNV's one byte, use it for anything longer than a few words.
+ * xxh64() hashes a whole buffer, Xxh64State does the same incrementally (same result for the same bytes). */
+
+constexpr u64 XXH64_P1 = 0x9E3779B185EBCA87ULL;
+constexpr u64 XXH64_P2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr u64 XXH64_P3 = 0x165667B19E3779F9ULL;
+constexpr u64 XXH64_P4 = 0x85EBCA77C2B2AE63ULL;
+constexpr u64 XXH64_P5 = 0x27D4EB2F165667C5ULL;
+constexpr u32 XXH64_STRIPE = 32;
+
+struct Xxh64State
+{
+    u64 aAcc[4] {};
+    u8 aBuff[XXH64_STRIPE] {};
+    u64 totalSize {};
+    u64 seed {};
+    u32 buffSize {};
+};
+
+[[nodiscard]] inline u64 xxh64(const void* pBuf, u64 byteSize, u64 seed = 0);
+inline void xxh64Init(Xxh64State* s, u64 seed = 0);
+inline void xxh64Update(Xxh64State* s, const void* pBuf, u64 byteSize);
+[[nodiscard]] inline u64 xxh64Digest(const Xxh64State* s);
+
+/* Castagnoli CRC (iSCSI, ext4, btrfs), chain calls by passing the previous result as crc.
+ * Uses the SSE4.2 crc32 instruction when the cpu has it, table lookups otherwise. */
+[[nodiscard]] inline u32 crc32c(const void* pBuf, u64 byteSize, u32 crc = 0);
+
+[[nodiscard]] constexpr u64
+_rotl64(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+[[nodiscard]] inline u64
+_read64(const u8* p)
+{
+    u64 r;
+    memcpy(&r, p, sizeof(r));
+    return r;
+}
+
+[[nodiscard]] inline u32
+_read32(const u8* p)
+{
+    u32 r;
+    memcpy(&r, p, sizeof(r));
+    return r;
+}
+
+[[nodiscard]] constexpr u64
+_xxh64Round(u64 acc, u64 input)
+{
+    acc += input * XXH64_P2;
+    acc = _rotl64(acc, 31);
+    return acc * XXH64_P1;
+}
+
+[[nodiscard]] constexpr u64
+_xxh64MergeRound(u64 acc, u64 val)
+{
+    acc ^= _xxh64Round(0, val);
+    return acc * XXH64_P1 + XXH64_P4;
+}
+
+inline void
+_xxh64Stripe(u64 aAcc[4], const u8* p)
+{
+    aAcc[0] = _xxh64Round(aAcc[0], _read64(p));
+    aAcc[1] = _xxh64Round(aAcc[1], _read64(p + 8));
+    aAcc[2] = _xxh64Round(aAcc[2], _read64(p + 16));
+    aAcc[3] = _xxh64Round(aAcc[3], _read64(p + 24));
+}
+
+[[nodiscard]] constexpr u64
+_xxh64MergeAcc(const u64 aAcc[4])
+{
+    u64 h = _rotl64(aAcc[0], 1) + _rotl64(aAcc[1], 7) + _rotl64(aAcc[2], 12) + _rotl64(aAcc[3], 18);
+    for (int i = 0; i < 4; ++i) h = _xxh64MergeRound(h, aAcc[i]);
+    return h;
+}
+
+/* the last < 32 bytes and avalanche */
+[[nodiscard]] inline u64
+_xxh64Finalize(u64 h, const u8* p, u64 size)
+{
+    for (; size >= 8; p += 8, size -= 8)
+    {
+        h ^= _xxh64Round(0, _read64(p));
+        h = _rotl64(h, 27) * XXH64_P1 + XXH64_P4;
+    }
+
+    if (size >= 4)
+    {
+        h ^= u64(_read32(p)) * XXH64_P1;
+        h = _rotl64(h, 23) * XXH64_P2 + XXH64_P3;
+        p += 4, size -= 4;
+    }
+
+    for (; size > 0; ++p, --size)
+    {
+        h ^= u64(*p) * XXH64_P5;
+        h = _rotl64(h, 11) * XXH64_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH64_P2;
+    h ^= h >> 29;
+    h *= XXH64_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+inline u64
+xxh64(const void* pBuf, u64 byteSize, u64 seed)
+{
+    const u8* p = (const u8*)pBuf;
+    u64 h;
+
+    if (byteSize >= XXH64_STRIPE)
+    {
+        u64 aAcc[4] {seed + XXH64_P1 + XXH64_P2, seed + XXH64_P2, seed, seed - XXH64_P1};
+        const u8* pEnd = p + byteSize - XXH64_STRIPE;
+        for (; p <= pEnd; p += XXH64_STRIPE) _xxh64Stripe(aAcc, p);
+
+        h = _xxh64MergeAcc(aAcc);
+    }
+    else h = seed + XXH64_P5;
+
+    h += byteSize;
+
+    return _xxh64Finalize(h, p, byteSize % XXH64_STRIPE);
+}
+
+inline void
+xxh64Init(Xxh64State* s, u64 seed)
+{
+    *s = {};
+    s->seed = seed;
+    s->aAcc[0] = seed + XXH64_P1 + XXH64_P2;
+    s->aAcc[1] = seed + XXH64_P2;
+    s->aAcc[2] = seed;
+    s->aAcc[3] = seed - XXH64_P1;
+}
+
+inline void
+xxh64Update(Xxh64State* s, const void* pBuf, u64 byteSize)
+{
+    const u8* p = (const u8*)pBuf;
+    s->totalSize += byteSize;
+
+    /* top up the partial stripe first */
+    if (s->buffSize > 0)
+    {
+        u32 nFill = u32(byteSize < XXH64_STRIPE - s->buffSize ? byteSize : XXH64_STRIPE - s->buffSize);
+        memcpy(s->aBuff + s->buffSize, p, nFill);
+        s->buffSize += nFill;
+        p += nFill, byteSize -= nFill;
+
+        if (s->buffSize < XXH64_STRIPE) return;
+
+        _xxh64Stripe(s->aAcc, s->aBuff);
+        s->buffSize = 0;
+    }
+
+    for (; byteSize >= XXH64_STRIPE; p += XXH64_STRIPE, byteSize -= XXH64_STRIPE)
+        _xxh64Stripe(s->aAcc, p);
+
+    memcpy(s->aBuff, p, byteSize);
+    s->buffSize = u32(byteSize);
+}
+
+inline u64
+xxh64Digest(const Xxh64State* s)
+{
+    u64 h = s->totalSize >= XXH64_STRIPE ? _xxh64MergeAcc(s->aAcc) : s->seed + XXH64_P5;
+    h += s->totalSize;
+
+    return _xxh64Finalize(h, s->aBuff, s->buffSize);
+}
+
+struct _Crc32cTable
+{
+    u32 a[256] {};
+
+    constexpr _Crc32cTable()
+    {
+        for (u32 i = 0; i < 256; ++i)
+        {
+            u32 c = i;
+            for (int j = 0; j < 8; ++j) c = (c >> 1) ^ (c & 1 ? 0x82F63B78U : 0);
+            a[i] = c;
+        }
+    }
+};
+
+inline constexpr _Crc32cTable inl_crc32cTable {};
+
+[[nodiscard]] inline u32
+_crc32cSw(const u8* p, u64 size, u32 crc)
+{
+    for (u64 i = 0; i < size; ++i)
+        crc = inl_crc32cTable.a[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined __x86_64__
+
+[[nodiscard, gnu::target("sse4.2")]] inline u32
+_crc32cHw(const u8* p, u64 size, u32 crc)
+{
+    u64 c = crc;
+    for (; size >= 8; p += 8, size -= 8) c = _mm_crc32_u64(c, _read64(p));
+
+    u32 c32 = u32(c);
+    for (; size > 0; ++p, --size) c32 = _mm_crc32_u8(c32, *p);
+
+    return c32;
+}
+
+#endif
+
+inline u32
+crc32c(const void* pBuf, u64 byteSize, u32 crc)
+{
+    const u8* p = (const u8*)pBuf;
+    crc = ~crc;
+
+#if defined __SSE4_2__
+    crc = _crc32cHw(p, byteSize, crc);
+#elif defined __x86_64__
+    if (__builtin_cpu_supports("sse4.2")) crc = _crc32cHw(p, byteSize, crc);
+    else crc = _crc32cSw(p, byteSize, crc);
+#else
+    crc = _crc32cSw(p, byteSize, crc);
+#endif
+
+    return ~crc;
+}
+
 } /* namespace hash */
 } /* namespace adt */
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "utils.hh"
+#include "ThreadPool.hh"
+
+#include <type_traits>
 
 namespace adt
 {
@@ -117,12 +120,20 @@ heapMax(auto* a, const u32 size)
     }
 }
 
-constexpr auto
-median3(const auto& x, const auto& y, const auto& z)
+template<typename T, auto FN_CMP = utils::compare<T>>
+constexpr const T&
+median3(const T& x, const T& y, const T& z)
 {
-    if ((x < y && y < z) || (z < y && y < x)) return y;
-    else if ((y < x && x < z) || (z < x && x < y)) return x;
-    else return z;
+    if (FN_CMP(x, y) < 0)
+    {
+        if (FN_CMP(y, z) < 0) return y;
+        return FN_CMP(x, z) < 0 ? z : x;
+    }
+    else
+    {
+        if (FN_CMP(x, z) < 0) return x;
+        return FN_CMP(y, z) < 0 ? z : y;
+    }
 }
 
 template<typename T, auto FN_CMP = utils::compare<T>>
@@ -152,7 +163,7 @@ quick(T a[], long l, long r)
             return;
         }
 
-        T pivot = a[ median3(l, (l + r) / 2, r) ];
+        T pivot = median3<T, FN_CMP>(a[l], a[(l + r) / 2], a[r]);
         long i = l, j = r;
 
         while (i <= j)
@@ -176,5 +187,319 @@ quick(CON_T<T>* pArrayContainer)
     quick<T, FN_CMP>(pArrayContainer->pData, 0, pArrayContainer->size - 1);
 }
 
+constexpr u64 RADIX_INSERTION_SIZE = 64; /* smaller ranges are not worth a histogram */
+
+/* Default radix key: the integer itself.
+ * Signed integers get their sign bit flipped, so negative keys sort in front as unsigned. */
+template<typename T>
+constexpr auto
+radixKey(const T& x)
+{
+    static_assert(std::is_integral_v<T>, "[sort]: radix() needs FN_KEY for non integer types");
+
+    using U = std::make_unsigned_t<T>;
+    if constexpr (std::is_signed_v<T>) return U(U(x) ^ (U(1) << (sizeof(U) * 8 - 1)));
+    else return U(x);
+}
+
+template<typename T, auto FN_KEY>
+constexpr long
+_radixCompare(const T& l, const T& r)
+{
+    const auto kl = FN_KEY(l), kr = FN_KEY(r);
+    return (kr < kl) - (kl < kr);
+}
+
+/* LSD radix sort, stable. FN_KEY maps T to an unsigned key (u8 to u64), one pass per key byte.
+ * aTmp holds size elements, passes where every key has the same byte are skipped. */
+template<typename T, auto FN_KEY = radixKey<T>>
+inline void
+radix(T* a, T* aTmp, const u64 size)
+{
+    using K = decltype(FN_KEY(*a));
+    static_assert(std::is_unsigned_v<K>, "[sort]: FN_KEY must return an unsigned integer");
+    static_assert(std::is_trivially_copyable_v<T>, "[sort]: radix() moves elements with memcpy");
+
+    constexpr u32 N_PASSES = sizeof(K);
+
+    if (size < RADIX_INSERTION_SIZE)
+    {
+        if (size > 1) insertion<T, _radixCompare<T, FN_KEY>>(a, 0, size - 1);
+        return;
+    }
+
+    /* all histograms in one read */
+    u64 aCounts[N_PASSES][256] {};
+    for (u64 i = 0; i < size; ++i)
+    {
+        const K key = FN_KEY(a[i]);
+        for (u32 p = 0; p < N_PASSES; ++p)
+            ++aCounts[p][(key >> (p * 8)) & 0xff];
+    }
+
+    T* pFrom = a;
+    T* pTo = aTmp;
+    const K first = FN_KEY(a[0]);
+
+    for (u32 p = 0; p < N_PASSES; ++p)
+    {
+        const u32 shift = p * 8;
+        u64* aOff = aCounts[p];
+        if (aOff[(first >> shift) & 0xff] == size) continue;
+
+        u64 sum = 0;
+        for (u32 b = 0; b < 256; ++b)
+        {
+            const u64 n = aOff[b];
+            aOff[b] = sum;
+            sum += n;
+        }
+
+        for (u64 i = 0; i < size; ++i)
+            pTo[aOff[(FN_KEY(pFrom[i]) >> shift) & 0xff]++] = pFrom[i];
+
+        utils::swap(&pFrom, &pTo);
+    }
+
+    if (pFrom != a) memcpy(a, pFrom, size * sizeof(T));
+}
+
+template<typename T, auto FN_KEY = radixKey<T>, typename ALLOC_T = IAllocator>
+inline void
+radix(ALLOC_T* pAlloc, T* a, const u64 size)
+{
+    if (size < RADIX_INSERTION_SIZE)
+    {
+        radix<T, FN_KEY>(a, nullptr, size);
+        return;
+    }
+
+    auto* aTmp = (T*)alloc(pAlloc, size, sizeof(T));
+    radix<T, FN_KEY>(a, aTmp, size);
+    free(pAlloc, aTmp);
+}
+
+template<template<typename> typename CON_T, typename T, auto FN_KEY = radixKey<T>, typename ALLOC_T = IAllocator>
+inline void
+radix(ALLOC_T* pAlloc, CON_T<T>* pArrayContainer)
+{
+    radix<T, FN_KEY>(pAlloc, pArrayContainer->pData, pArrayContainer->size);
+}
+
+template<typename T, auto FN_KEY>
+inline void
+_radixMSD(T* a, const u64 size, u32 byte)
+{
+    using K = decltype(FN_KEY(*a));
+
+again:
+    if (size < RADIX_INSERTION_SIZE)
+    {
+        if (size > 1) insertion<T, _radixCompare<T, FN_KEY>>(a, 0, size - 1);
+        return;
+    }
+
+    const u32 shift = byte * 8;
+    auto digit = [&](const T& x) -> u32 { return (K(FN_KEY(x)) >> shift) & 0xff; };
+
+    u64 aCount[256] {};
+    for (u64 i = 0; i < size; ++i) ++aCount[digit(a[i])];
+
+    /* same byte everywhere, nothing to move */
+    if (aCount[digit(a[0])] == size)
+    {
+        if (byte == 0) return;
+        --byte;
+        goto again;
+    }
+
+    u64 aHead[256], aTail[256];
+    u64 sum = 0;
+    for (u32 b = 0; b < 256; ++b)
+    {
+        aHead[b] = sum;
+        sum += aCount[b];
+        aTail[b] = sum;
+    }
+
+    /* American flag sort: cycle every misplaced element to the head of its bucket */
+    for (u32 b = 0; b < 256; ++b)
+    {
+        while (aHead[b] < aTail[b])
+        {
+            T x = a[aHead[b]];
+            u32 d = digit(x);
+            while (d != b)
+            {
+                utils::swap(&x, &a[aHead[d]++]);
+                d = digit(x);
+            }
+
+            a[aHead[b]++] = x;
+        }
+    }
+
+    if (byte == 0) return;
+
+    u64 start = 0;
+    for (u32 b = 0; b < 256; ++b)
+    {
+        if (aCount[b] > 1) _radixMSD<T, FN_KEY>(&a[start], aCount[b], byte - 1);
+        start += aCount[b];
+    }
+}
+
+/* In place MSD radix sort (American flag sort), not stable.
+ * Recursion depth is at most sizeof(key), no scratch memory. */
+template<typename T, auto FN_KEY = radixKey<T>>
+inline void
+radixMSD(T* a, const u64 size)
+{
+    using K = decltype(FN_KEY(*a));
+    static_assert(std::is_unsigned_v<K>, "[sort]: FN_KEY must return an unsigned integer");
+
+    _radixMSD<T, FN_KEY>(a, size, sizeof(K) - 1);
+}
+
+template<template<typename> typename CON_T, typename T, auto FN_KEY = radixKey<T>>
+inline void
+radixMSD(CON_T<T>* pArrayContainer)
+{
+    radixMSD<T, FN_KEY>(pArrayContainer->pData, pArrayContainer->size);
+}
+
+constexpr u64 SAMPLE_SORT_MIN_SIZE = 1 << 16; /* quick() on the calling thread below that */
+constexpr u64 SAMPLE_SORT_OVERSAMPLE = 32; /* samples per bucket */
+constexpr u64 SAMPLE_SORT_MAX_BUCKETS = 256; /* bucket indices are u8 */
+
+/* number of splitters <= x */
+template<typename T, auto FN_CMP>
+inline u64
+_sampleSortBucket(const T* aSplitters, const u64 nSplitters, const T& x)
+{
+    u64 lo = 0, n = nSplitters;
+    while (n > 0)
+    {
+        const u64 half = n / 2;
+        if (FN_CMP(aSplitters[lo + half], x) <= 0)
+        {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else n = half;
+    }
+
+    return lo;
+}
+
+/* Parallel sample sort on pPool, not stable.
+ * Splitters are picked from a sorted random sample, every block of the input is classified and scattered into
+ * per bucket ranges of a scratch copy, then buckets are sorted with quick() and copied back in parallel. */
+template<typename T, auto FN_CMP = utils::compare<T>, typename ALLOC_T = IAllocator>
+inline void
+parallel(ThreadPool* pPool, ALLOC_T* pAlloc, T* a, const u64 size)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "[sort]: parallel() moves elements with memcpy");
+
+    const u64 nWorkers = VecSize(&pPool->aThreads) + 1; /* parallelFor() runs on the caller too */
+    if (size < SAMPLE_SORT_MIN_SIZE || nWorkers <= 1)
+    {
+        if (size > 1) quick<T, FN_CMP>(a, 0, size - 1);
+        return;
+    }
+
+    /* a few buckets per worker even out the sizes */
+    const u64 nBuckets = utils::min(nWorkers * 4, SAMPLE_SORT_MAX_BUCKETS);
+    const u64 nSplitters = nBuckets - 1;
+    const u64 nBlocks = nBuckets;
+    const u64 blockSize = (size + nBlocks - 1) / nBlocks;
+
+    const u64 nSamples = nBuckets * SAMPLE_SORT_OVERSAMPLE;
+    auto* aSamples = (T*)alloc(pAlloc, nSamples, sizeof(T));
+
+    u64 rng = size * 0x9e3779b97f4a7c15ULL + 1;
+    for (u64 i = 0; i < nSamples; ++i)
+    {
+        /* xorshift64 */
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        aSamples[i] = a[rng % size];
+    }
+    quick<T, FN_CMP>(aSamples, 0, nSamples - 1);
+
+    /* splitters go into the front of aSamples, no longer needed past them */
+    for (u64 i = 0; i < nSplitters; ++i) aSamples[i] = aSamples[(i + 1) * SAMPLE_SORT_OVERSAMPLE];
+    const T* aSplitters = aSamples;
+
+    auto* aBucketOf = (u8*)alloc(pAlloc, size, sizeof(u8));
+    /* aOffsets[block * nBuckets + bucket]: counts, then write positions in aTmp */
+    auto* aOffsets = (u64*)zalloc(pAlloc, nBlocks * nBuckets, sizeof(u64));
+    auto* aBucketStart = (u64*)alloc(pAlloc, nBuckets + 1, sizeof(u64));
+    auto* aTmp = (T*)alloc(pAlloc, size, sizeof(T));
+
+    parallelFor(pPool, 0, nBlocks, 1, [&](u64 b, u64 e) {
+        for (u64 block = b; block < e; ++block)
+        {
+            u64* aCount = &aOffsets[block * nBuckets];
+            const u64 end = utils::min(size, (block + 1) * blockSize);
+            for (u64 i = block * blockSize; i < end; ++i)
+            {
+                const u64 bucket = _sampleSortBucket<T, FN_CMP>(aSplitters, nSplitters, a[i]);
+                aBucketOf[i] = bucket;
+                ++aCount[bucket];
+            }
+        }
+    });
+
+    /* buckets are contiguous in aTmp, blocks keep their order inside a bucket */
+    u64 sum = 0;
+    for (u64 bucket = 0; bucket < nBuckets; ++bucket)
+    {
+        aBucketStart[bucket] = sum;
+        for (u64 block = 0; block < nBlocks; ++block)
+        {
+            const u64 n = aOffsets[block * nBuckets + bucket];
+            aOffsets[block * nBuckets + bucket] = sum;
+            sum += n;
+        }
+    }
+    aBucketStart[nBuckets] = size;
+
+    parallelFor(pPool, 0, nBlocks, 1, [&](u64 b, u64 e) {
+        for (u64 block = b; block < e; ++block)
+        {
+            u64* aOff = &aOffsets[block * nBuckets];
+            const u64 end = utils::min(size, (block + 1) * blockSize);
+            for (u64 i = block * blockSize; i < end; ++i)
+                aTmp[aOff[aBucketOf[i]]++] = a[i];
+        }
+    });
+
+    parallelFor(pPool, 0, nBuckets, 1, [&](u64 b, u64 e) {
+        for (u64 bucket = b; bucket < e; ++bucket)
+        {
+            const u64 start = aBucketStart[bucket];
+            const u64 n = aBucketStart[bucket + 1] - start;
+
+            if (n > 1) quick<T, FN_CMP>(aTmp, start, start + n - 1);
+            memcpy(&a[start], &aTmp[start], n * sizeof(T));
+        }
+    });
+
+    free(pAlloc, aTmp);
+    free(pAlloc, aBucketStart);
+    free(pAlloc, aOffsets);
+    free(pAlloc, aBucketOf);
+    free(pAlloc, aSamples);
+}
+
+template<template<typename> typename CON_T, typename T, auto FN_CMP = utils::compare<T>, typename ALLOC_T = IAllocator>
+inline void
+parallel(ThreadPool* pPool, ALLOC_T* pAlloc, CON_T<T>* pArrayContainer)
+{
+    parallel<T, FN_CMP>(pPool, pAlloc, pArrayContainer->pData, pArrayContainer->size);
+}
+
 } /* namespace sort */
 } /* namespace adt */
@@ -53,8 +53,10 @@ enum INIT_FLAG : u8 { NO_INIT, INIT };
 
 #if defined __clang__ || __GNUC__
     #define ADT_NO_UB __attribute__((no_sanitize("undefined")))
+    #define ADT_ALWAYS_INLINE __attribute__((always_inline))
 #else
     #define ADT_NO_UB
+    #define ADT_ALWAYS_INLINE
 #endif
 
 } /* namespace adt */
@@ -91,18 +91,19 @@ even(const auto& a)
     return !odd(a);
 }
 
+/* not l - r: that wraps for unsigned types and truncates for floats */
 template<typename T>
 [[nodiscard]] constexpr long
 compare(const T& l, const T& r)
 {
-    return l - r;
+    return (r < l) - (l < r);
 }
 
 template<typename T>
 [[nodiscard]] constexpr long
 compareRev(const T& l, const T& r)
 {
-    return r - l;
+    return (l < r) - (r < l);
 }
 
 [[nodiscard]] inline long
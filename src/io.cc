@@ -0,0 +1,596 @@
+#include "io.hh"
+
+#include "adt/logs.hh"
+#include "adt/defer.hh"
+#include "adt/utils.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined __linux__
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+#endif
+
+namespace io
+{
+
+#if defined __linux__
+
+static int
+sysSetup(u32 entries, io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sysEnter(int fd, u32 toSubmit, u32 minComplete, u32 flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int
+sysRegister(int fd, u32 opcode, void* pArg, u32 nArgs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, pArg, nArgs);
+}
+
+/* READ/WRITE came with the probe in 5.6, 5.1-5.5 set up a ring that fails every request with -EINVAL */
+static bool
+UringProbeOps(Uring* s)
+{
+    constexpr u32 N_OPS = 64;
+    alignas(io_uring_probe) u8 aProbe[sizeof(io_uring_probe) + N_OPS * sizeof(io_uring_probe_op)] {};
+    auto* pProbe = (io_uring_probe*)aProbe;
+
+    if (sysRegister(s->fd, IORING_REGISTER_PROBE, pProbe, N_OPS) < 0) return false;
+
+    constexpr u8 aNeeded[] {IORING_OP_READ, IORING_OP_WRITE};
+    for (const u8 op : aNeeded)
+        if (op > pProbe->last_op || !(pProbe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+
+    return true;
+}
+
+static bool
+UringMap(Uring* s, const io_uring_params& p)
+{
+    s->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(u32);
+    s->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    /* since 5.4 both rings live in one mapping */
+    const bool bSingle = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (bSingle) s->sqMapSize = s->cqMapSize = utils::max(s->sqMapSize, s->cqMapSize);
+
+    s->pSqMap = mmap(nullptr, s->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, IORING_OFF_SQ_RING);
+    if (s->pSqMap == MAP_FAILED) return false;
+
+    if (bSingle) s->pCqMap = s->pSqMap;
+    else
+    {
+        s->pCqMap = mmap(nullptr, s->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, IORING_OFF_CQ_RING);
+        if (s->pCqMap == MAP_FAILED) return false;
+    }
+
+    s->sqesMapSize = p.sq_entries * sizeof(io_uring_sqe);
+    s->aSqes = mmap(nullptr, s->sqesMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->fd, IORING_OFF_SQES);
+    if (s->aSqes == MAP_FAILED) return false;
+
+    u8* pSq = (u8*)s->pSqMap;
+    s->pSqHead = (u32*)(pSq + p.sq_off.head);
+    s->pSqTail = (u32*)(pSq + p.sq_off.tail);
+    s->sqMask = *(u32*)(pSq + p.sq_off.ring_mask);
+    s->pSqArray = (u32*)(pSq + p.sq_off.array);
+
+    u8* pCq = (u8*)s->pCqMap;
+    s->pCqHead = (u32*)(pCq + p.cq_off.head);
+    s->pCqTail = (u32*)(pCq + p.cq_off.tail);
+    s->cqMask = *(u32*)(pCq + p.cq_off.ring_mask);
+    s->aCqes = pCq + p.cq_off.cqes;
+
+    return true;
+}
+
+static void
+UringUnmap(Uring* s)
+{
+    if (s->aSqes && s->aSqes != MAP_FAILED) munmap(s->aSqes, s->sqesMapSize);
+    if (s->pCqMap && s->pCqMap != MAP_FAILED && s->pCqMap != s->pSqMap) munmap(s->pCqMap, s->cqMapSize);
+    if (s->pSqMap && s->pSqMap != MAP_FAILED) munmap(s->pSqMap, s->sqMapSize);
+    s->aSqes = s->pCqMap = s->pSqMap = nullptr;
+}
+
+static bool
+UringPrep(Uring* s, const u8 opcode, int fd, const void* pBuff, u32 size, u64 offset, u64 userData)
+{
+    /* we are the only producer, the kernel only moves the head */
+    const u32 tail = *s->pSqTail;
+    const u32 idx = tail & s->sqMask;
+
+    io_uring_sqe* pSqe = &((io_uring_sqe*)s->aSqes)[idx];
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = opcode;
+    pSqe->fd = fd;
+    pSqe->addr = (u64)pBuff;
+    pSqe->len = size;
+    pSqe->off = offset;
+    pSqe->user_data = userData;
+
+    s->pSqArray[idx] = idx;
+    __atomic_store_n(s->pSqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ++s->nQueued;
+    ++s->nInFlight;
+    return true;
+}
+
+#endif
+
+/* synchronous fallback: do the transfer now and queue its completion */
+static bool
+UringPrepSync(Uring* s, const bool bWrite, int fd, const void* pBuff, u32 size, u64 offset, u64 userData)
+{
+    ssize_t res = bWrite ? pwrite(fd, pBuff, size, offset) : pread(fd, (void*)pBuff, size, offset);
+
+    s->aDone[(s->doneHead + s->nDone) % s->depth] = {.userData = userData, .res = res < 0 ? -errno : res};
+    ++s->nDone;
+    ++s->nInFlight;
+    return true;
+}
+
+bool
+UringInit(Uring* s, IAllocator* pAlloc, u32 depth)
+{
+    *s = {};
+    s->depth = depth;
+
+#if defined __linux__
+    io_uring_params p {};
+    s->fd = sysSetup(depth, &p);
+    if (s->fd >= 0)
+    {
+        if (UringMap(s, p) && UringProbeOps(s)) return true;
+
+        UringUnmap(s);
+        close(s->fd);
+        s->fd = -1;
+    }
+#endif
+
+    s->aDone = (UringCompletion*)alloc(pAlloc, depth, sizeof(UringCompletion));
+    return s->aDone != nullptr;
+}
+
+void
+UringDestroy(Uring* s, IAllocator* pAlloc)
+{
+#if defined __linux__
+    if (s->fd >= 0)
+    {
+        UringUnmap(s);
+        close(s->fd);
+    }
+#endif
+
+    if (s->aDone) free(pAlloc, s->aDone);
+    *s = {};
+}
+
+bool
+UringIsAsync(const Uring* s)
+{
+    return s->fd >= 0;
+}
+
+bool
+UringRead(Uring* s, int fd, void* pBuff, u32 size, u64 offset, u64 userData)
+{
+    if (s->nInFlight >= s->depth) return false;
+
+#if defined __linux__
+    if (s->fd >= 0) return UringPrep(s, IORING_OP_READ, fd, pBuff, size, offset, userData);
+#endif
+
+    return UringPrepSync(s, false, fd, pBuff, size, offset, userData);
+}
+
+bool
+UringWrite(Uring* s, int fd, const void* pBuff, u32 size, u64 offset, u64 userData)
+{
+    if (s->nInFlight >= s->depth) return false;
+
+#if defined __linux__
+    if (s->fd >= 0) return UringPrep(s, IORING_OP_WRITE, fd, pBuff, size, offset, userData);
+#endif
+
+    return UringPrepSync(s, true, fd, pBuff, size, offset, userData);
+}
+
+bool
+UringSubmit(Uring* s)
+{
+#if defined __linux__
+    while (s->fd >= 0 && s->nQueued > 0)
+    {
+        int r = sysEnter(s->fd, s->nQueued, 0, 0);
+        if (r < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return false;
+        }
+        s->nQueued -= r;
+    }
+#endif
+
+    return true;
+}
+
+bool
+UringWait(Uring* s, UringCompletion* pOut)
+{
+    if (s->nInFlight == 0) return false;
+
+#if defined __linux__
+    if (s->fd >= 0)
+    {
+        while (true)
+        {
+            const u32 head = *s->pCqHead;
+            if (head != __atomic_load_n(s->pCqTail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe& cqe = ((io_uring_cqe*)s->aCqes)[head & s->cqMask];
+                *pOut = {.userData = cqe.user_data, .res = cqe.res};
+                __atomic_store_n(s->pCqHead, head + 1, __ATOMIC_RELEASE);
+                --s->nInFlight;
+                return true;
+            }
+
+            int r = sysEnter(s->fd, s->nQueued, 1, IORING_ENTER_GETEVENTS);
+            if (r < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return false;
+            }
+            s->nQueued -= r;
+        }
+    }
+#endif
+
+    *pOut = s->aDone[s->doneHead];
+    s->doneHead = (s->doneHead + 1) % s->depth;
+    --s->nDone;
+    --s->nInFlight;
+    return true;
+}
+
+enum class SLOT : u8 { FREE, PENDING, READY };
+
+struct Slot
+{
+    u8* pData {};
+    u64 offset {}; /* file offset */
+    u32 size {};
+    u32 nDone {}; /* bytes transferred so far, short transfers get resubmitted */
+    SLOT eState {};
+};
+
+enum IO_KIND : u64 { IO_KIND_READ, IO_KIND_WRITE };
+
+static inline u64 ioUserData(const IO_KIND eKind, const u32 slot) { return (u64(eKind) << 32) | slot; }
+
+/* Read-ahead ring of input blocks in file order plus a pool of write-behind output buffers,
+ * all requests share one ring. Block k always lands in aRead[k % READ_AHEAD]. */
+struct Pipeline
+{
+    Uring ring {};
+    int fdIn = -1;
+    int fdOut = -1;
+    u64 inSize {};
+    u64 nBlocks {};
+    u64 nextRead {}; /* next block to request */
+    u64 outOffset {};
+    u64 writeSlotSize {};
+    Slot aRead[READ_AHEAD] {};
+    Slot aWrite[WRITE_BEHIND] {};
+    bool bError {};
+};
+
+static bool
+PipelineInit(Pipeline* s, IAllocator* pAlloc, int fdIn, int fdOut, u64 writeSlotSize)
+{
+    struct stat st {};
+    if (fstat(fdIn, &st) != 0)
+    {
+        LOG_BAD("fstat failed: {}\n", strerror(errno));
+        return false;
+    }
+
+    s->fdIn = fdIn;
+    s->fdOut = fdOut;
+    s->inSize = st.st_size;
+    /* always at least one (possibly empty) block so that empty input still goes through the codec */
+    s->nBlocks = utils::max(1ULL, (s->inSize + IO_BLOCK_SIZE - 1) / IO_BLOCK_SIZE);
+    s->writeSlotSize = writeSlotSize;
+
+    if (!UringInit(&s->ring, pAlloc, READ_AHEAD + WRITE_BEHIND))
+    {
+        LOG_BAD("io ring setup failed\n");
+        return false;
+    }
+
+    for (auto& slot : s->aRead)
+        if (!(slot.pData = (u8*)alloc(pAlloc, IO_BLOCK_SIZE, 1))) return false;
+    for (auto& slot : s->aWrite)
+        if (!(slot.pData = (u8*)alloc(pAlloc, writeSlotSize, 1))) return false;
+
+    return true;
+}
+
+static bool
+PipelineReap(Pipeline* s)
+{
+    UringCompletion c;
+    if (!UringWait(&s->ring, &c))
+    {
+        LOG_BAD("io wait failed: {}\n", strerror(errno));
+        s->bError = true;
+        return false;
+    }
+
+    const IO_KIND eKind = IO_KIND(c.userData >> 32);
+    const u32 idx = u32(c.userData);
+    Slot* pSlot = eKind == IO_KIND_READ ? &s->aRead[idx] : &s->aWrite[idx];
+
+    if (c.res <= 0)
+    {
+        if (c.res == 0) LOG_BAD("{}: unexpected end of file\n", eKind == IO_KIND_READ ? "read" : "write");
+        else LOG_BAD("{} failed: {}\n", eKind == IO_KIND_READ ? "read" : "write", strerror(-c.res));
+
+        pSlot->eState = SLOT::FREE;
+        s->bError = true;
+        return false;
+    }
+
+    pSlot->nDone += c.res;
+    if (pSlot->nDone < pSlot->size)
+    {
+        const u32 rest = pSlot->size - pSlot->nDone;
+        const u64 off = pSlot->offset + pSlot->nDone;
+        if (eKind == IO_KIND_READ) UringRead(&s->ring, s->fdIn, pSlot->pData + pSlot->nDone, rest, off, c.userData);
+        else UringWrite(&s->ring, s->fdOut, pSlot->pData + pSlot->nDone, rest, off, c.userData);
+
+        return UringSubmit(&s->ring);
+    }
+
+    pSlot->eState = eKind == IO_KIND_READ ? SLOT::READY : SLOT::FREE;
+    return true;
+}
+
+static bool
+PipelineFillReads(Pipeline* s)
+{
+    for (; s->nextRead < s->nBlocks; ++s->nextRead)
+    {
+        const u32 idx = s->nextRead % READ_AHEAD;
+        Slot* pSlot = &s->aRead[idx];
+        if (pSlot->eState != SLOT::FREE) break;
+
+        pSlot->offset = s->nextRead * IO_BLOCK_SIZE;
+        pSlot->size = utils::min(IO_BLOCK_SIZE, s->inSize - pSlot->offset);
+        pSlot->nDone = 0;
+
+        if (pSlot->size == 0)
+        {
+            pSlot->eState = SLOT::READY;
+            continue;
+        }
+
+        pSlot->eState = SLOT::PENDING;
+        UringRead(&s->ring, s->fdIn, pSlot->pData, pSlot->size, pSlot->offset, ioUserData(IO_KIND_READ, idx));
+    }
+
+    return UringSubmit(&s->ring);
+}
+
+/* block k once its read is complete, nullptr on error */
+static Slot*
+PipelineAcquireBlock(Pipeline* s, const u64 k)
+{
+    Slot* pSlot = &s->aRead[k % READ_AHEAD];
+    while (pSlot->eState != SLOT::READY)
+        if (!PipelineReap(s)) return nullptr;
+
+    return pSlot;
+}
+
+static bool
+PipelineReleaseBlock(Pipeline* s, Slot* pSlot)
+{
+    pSlot->eState = SLOT::FREE;
+    return PipelineFillReads(s);
+}
+
+/* free output buffer, waits for an older write if all of them are in flight */
+static Slot*
+PipelineAcquireOut(Pipeline* s)
+{
+    while (true)
+    {
+        for (auto& slot : s->aWrite)
+            if (slot.eState == SLOT::FREE) return &slot;
+
+        if (!PipelineReap(s)) return nullptr;
+    }
+}
+
+/* append pSlot->pData[skip, skip + size) to the output */
+static bool
+PipelineWrite(Pipeline* s, Slot* pSlot, const u64 skip, const u64 size)
+{
+    if (size == 0) return true;
+
+    const u32 idx = pSlot - s->aWrite;
+    pSlot->offset = s->outOffset - skip; /* resubmits of short writes index pData by file offset */
+    pSlot->size = skip + size;
+    pSlot->nDone = skip;
+    pSlot->eState = SLOT::PENDING;
+    s->outOffset += size;
+
+    UringWrite(&s->ring, s->fdOut, pSlot->pData + skip, size, pSlot->offset + skip, ioUserData(IO_KIND_WRITE, idx));
+    return UringSubmit(&s->ring);
+}
+
+/* wait for everything in flight, the kernel may still be using our buffers */
+static bool
+PipelineDrain(Pipeline* s)
+{
+    while (s->ring.nInFlight > 0)
+    {
+        const u32 nInFlight = s->ring.nInFlight;
+        PipelineReap(s);
+        if (s->ring.nInFlight == nInFlight) break; /* the wait itself failed, nothing more to reap */
+    }
+
+    return !s->bError;
+}
+
+static void
+PipelineDestroy(Pipeline* s, IAllocator* pAlloc)
+{
+    PipelineDrain(s);
+
+    for (auto& slot : s->aRead)
+        if (slot.pData) free(pAlloc, slot.pData);
+    for (auto& slot : s->aWrite)
+        if (slot.pData) free(pAlloc, slot.pData);
+
+    UringDestroy(&s->ring, pAlloc);
+}
+
+bool
+encodeFile(rle_ctx* pCtx, IAllocator* pAlloc, int fdIn, int fdOut)
+{
+    const u64 cap = rle_compress_bound(IO_BLOCK_SIZE);
+
+    Pipeline p {};
+    defer( PipelineDestroy(&p, pAlloc) );
+    if (!PipelineInit(&p, pAlloc, fdIn, fdOut, cap)) return false;
+    if (!PipelineFillReads(&p)) return false;
+
+    /* Blocks are encoded in order and share the first header, patched to the whole file size,
+     * so with RLE_DEDUP_LINKED their references into earlier blocks still decode.
+     * Reads of the next blocks and writes of the previous ones overlap with rle_compress(). */
+    u64 firstFlags = 0, flags = 0;
+    for (u64 k = 0; k < p.nBlocks; ++k)
+    {
+        Slot* pIn = PipelineAcquireBlock(&p, k);
+        if (!pIn) return false;
+        Slot* pOut = PipelineAcquireOut(&p);
+        if (!pOut) return false;
+
+        size_t nWritten = 0;
+        RLE_STATUS eStatus = rle_compress(pCtx, pIn->pData, pIn->size, pOut->pData, cap, &nWritten);
+        if (!PipelineReleaseBlock(&p, pIn)) return false;
+
+        if (eStatus != RLE_STATUS_OK)
+        {
+            LOG_BAD("encoding failed: {}\n", rle_status_string(eStatus));
+            return false;
+        }
+
+        uint64_t header;
+        memcpy(&header, pOut->pData, sizeof(header));
+        flags |= header & RLE_FRAME_FLAG_DEDUP;
+
+        u64 skip = RLE_FRAME_HEADER_SIZE;
+        if (k == 0)
+        {
+            firstFlags = flags;
+            header = p.inSize | flags;
+            memcpy(pOut->pData, &header, sizeof(header));
+            skip = 0;
+        }
+
+        if (!PipelineWrite(&p, pOut, skip, nWritten - skip)) return false;
+    }
+
+    if (!PipelineDrain(&p)) return false;
+
+    /* a later block had references, the first header was already written without the flag */
+    if (flags != firstFlags)
+    {
+        const uint64_t header = p.inSize | flags;
+        if (pwrite(fdOut, &header, sizeof(header), 0) != sizeof(header))
+        {
+            LOG_BAD("failed to patch the frame header\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+decodeFile(rle_ctx* pCtx, IAllocator* pAlloc, int fdIn, int fdOut)
+{
+    Pipeline p {};
+    defer( PipelineDestroy(&p, pAlloc) );
+    if (!PipelineInit(&p, pAlloc, fdIn, fdOut, IO_BLOCK_SIZE)) return false;
+    if (!PipelineFillReads(&p)) return false;
+
+    RLE_STATUS eStatus = rle_decompress_stream_begin(pCtx);
+    if (eStatus != RLE_STATUS_OK) return false;
+
+    Slot* pOut = PipelineAcquireOut(&p);
+    if (!pOut) return false;
+    rle_out_buffer out {.dst = pOut->pData, .size = IO_BLOCK_SIZE, .pos = 0};
+
+    eStatus = RLE_STATUS_MORE;
+    for (u64 k = 0; k < p.nBlocks && eStatus == RLE_STATUS_MORE; ++k)
+    {
+        Slot* pIn = PipelineAcquireBlock(&p, k);
+        if (!pIn) return false;
+        rle_in_buffer in {.src = pIn->pData, .size = pIn->size, .pos = 0};
+
+        while (true)
+        {
+            eStatus = rle_decompress_stream(pCtx, &out, &in);
+            if (eStatus != RLE_STATUS_OK && eStatus != RLE_STATUS_MORE) break;
+
+            const bool bFull = out.pos == out.size;
+            if (bFull || eStatus == RLE_STATUS_OK)
+            {
+                if (!PipelineWrite(&p, pOut, 0, out.pos)) return false;
+                if (eStatus == RLE_STATUS_OK) break;
+
+                if (!(pOut = PipelineAcquireOut(&p))) return false;
+                out = {.dst = pOut->pData, .size = IO_BLOCK_SIZE, .pos = 0};
+                continue; /* the decoder may still hold output for this input */
+            }
+
+            if (in.pos == in.size) break;
+        }
+
+        /* the frame has to end with the file, even when it ends on a block boundary */
+        if (eStatus == RLE_STATUS_OK && (in.pos != in.size || k + 1 != p.nBlocks)) eStatus = RLE_STATUS_CORRUPT;
+
+        if (!PipelineReleaseBlock(&p, pIn)) return false;
+    }
+
+    /* input ended mid frame */
+    if (eStatus == RLE_STATUS_MORE) eStatus = RLE_STATUS_CORRUPT;
+
+    if (eStatus != RLE_STATUS_OK)
+    {
+        LOG_BAD("decoding failed: {}\n", rle_status_string(eStatus));
+        return false;
+    }
+
+    return PipelineDrain(&p);
+}
+
+} /* namespace io */
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "rle.h"
+
+#include "adt/IAllocator.hh"
+
+namespace io
+{
+
+using namespace adt;
+
+constexpr u64 IO_BLOCK_SIZE = 4 * SIZE_1M; /* input bytes per read-ahead block */
+constexpr u32 READ_AHEAD = 4; /* input blocks in flight */
+constexpr u32 WRITE_BEHIND = 4; /* output blocks in flight */
+
+struct UringCompletion
+{
+    u64 userData {};
+    s64 res {}; /* bytes transferred or -errno */
+};
+
+/* Minimal io_uring over raw syscalls, one submitter and one reaper (the calling thread).
+ * Falls back to synchronous pread/pwrite if the kernel refuses to set up a ring,
+ * completions are then queued right away and returned by UringWait() in order. */
+struct Uring
+{
+    int fd = -1;
+    u32 depth {};
+    u32 nQueued {}; /* prepared but not yet submitted */
+    u32 nInFlight {}; /* submitted (or queued) but not yet reaped */
+
+    u32* pSqHead {};
+    u32* pSqTail {};
+    u32 sqMask {};
+    u32* pSqArray {};
+    void* aSqes {};
+
+    u32* pCqHead {};
+    u32* pCqTail {};
+    u32 cqMask {};
+    void* aCqes {};
+
+    void* pSqMap {};
+    u64 sqMapSize {};
+    void* pCqMap {};
+    u64 cqMapSize {};
+    u64 sqesMapSize {};
+
+    /* synchronous fallback */
+    UringCompletion* aDone {};
+    u32 doneHead {};
+    u32 nDone {};
+};
+
+/* depth is the maximum number of requests in flight */
+bool UringInit(Uring* s, IAllocator* pAlloc, u32 depth);
+void UringDestroy(Uring* s, IAllocator* pAlloc);
+bool UringIsAsync(const Uring* s);
+/* false if depth requests are already in flight */
+bool UringRead(Uring* s, int fd, void* pBuff, u32 size, u64 offset, u64 userData);
+bool UringWrite(Uring* s, int fd, const void* pBuff, u32 size, u64 offset, u64 userData);
+/* hand prepared requests to the kernel */
+bool UringSubmit(Uring* s);
+/* submit pending requests and block until one completes */
+bool UringWait(Uring* s, UringCompletion* pOut);
+
+/* Whole file pipelines: reads run ahead of the codec and writes trail behind it.
+ * Errors are logged, the output file is left as is. */
+bool encodeFile(rle_ctx* pCtx, IAllocator* pAlloc, int fdIn, int fdOut);
+bool decodeFile(rle_ctx* pCtx, IAllocator* pAlloc, int fdIn, int fdOut);
+
+} /* namespace io */
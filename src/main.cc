@@ -1,138 +1,51 @@
+#include "rle.h"
+#include "io.hh"
+
 #include "adt/logs.hh"
-#include "adt/file.hh"
 #include "adt/Arena.hh"
 #include "adt/defer.hh"
-#include "adt/Vec.hh"
-
-#include <limits>
-
-using namespace adt;
-
-struct EncodedChar
-{
-    u8 nRepeat {};
-    u8 charCode {};
-};
-
-struct EncodedBuff
-{
-    VecBase<EncodedChar> vec {};
-    u64 realByteSize {};
-};
-
-static bool
-saveToOpenFile(const char* sPath)
-{
-    FILE* pf = fopen(sPath, "rb");
-
-    if (!pf) return true;
-    else
-    {
-        fclose(pf);
-        return false;
-    }
-}
-
-static EncodedBuff
-encode(IAllocator* pAlloc, u8* pBuff, u64 size)
-{
-    decltype(EncodedChar::nRepeat) nConsecutive = 0;
-
-    VecBase<EncodedChar> vec(pAlloc, size);
-
-    for (u64 i = 0; i < size;)
-    {
-        u8 curr = pBuff[i];
-        nConsecutive = 1;
-
-        ++i;
-        while (curr == pBuff[i] && i < size && nConsecutive < std::numeric_limits<decltype(EncodedChar::nRepeat)>::max())
-        {
-            ++nConsecutive;
-            ++i;
-        }
-
-        VecPush(&vec, pAlloc, {nConsecutive, curr});
-    }
-
-    return {
-        .vec = vec,
-        .realByteSize = size
-    };
-}
-
-static void
-EncodedBuffWriteToFile(EncodedBuff* s, FILE* pFile)
-{
-    fwrite(&s->realByteSize, sizeof(s->realByteSize), 1, pFile);
-    fwrite(VecData(&s->vec), sizeof((s->vec)[0]), VecSize(&s->vec), pFile);
-}
-
-static String
-EncodedBuffDecode(EncodedBuff* s, IAllocator* pAlloc)
-{
-    String str = StringAlloc(pAlloc, s->realByteSize);
 
-    u32 pos = 0;
-    for (auto e : s->vec)
-    {
-        for (u32 r = 0; r < e.nRepeat; ++r)
-            str[pos++] = e.charCode;
-    }
-
-    return str;
-}
+#if defined ADT_DBG_MEMORY
+    #include "adt/StatsAllocator.hh"
+#endif
 
-static EncodedBuff
-buffToEncoder(const file::Buff buff)
-{
-    EncodedBuff eb {.realByteSize = *(u64*)buff.pData};
-    VecBase<EncodedChar> vec {};
-    vec.size = buff.size - sizeof(eb.realByteSize);
+#include <cerrno>
 
-    auto* pData = (EncodedChar*)(buff.pData + sizeof(eb.realByteSize));
-    vec.pData = pData;
+#include <fcntl.h>
+#include <unistd.h>
 
-    eb.vec = vec;
-    return eb;
-}
+using namespace adt;
 
 static void
 usage(char* argv0)
 {
     LOG_EXIT(
         "usage:\n"
-        "\t{} [-e(encode)|-d(decode)] <input file> <output file>\n", argv0
+        "\t{} [-e(encode)|-E(encode with block dedup)|-d(decode)] <input file> <output file>\n", argv0
     );
 }
 
 static void
-encode(IAllocator* pAlloc, const char* sPath, const char* sOutName)
+run(rle_ctx* pCtx, IAllocator* pAlloc, bool bEncode, const char* sPath, const char* sOutName)
 {
-    auto file = file::load(pAlloc, sPath);
-    if (!file) LOG_EXIT("quit...\n");
-
-    auto encoded = encode(pAlloc, (u8*)file.data.pData, file.data.size);
-
-    if (!saveToOpenFile(sOutName)) LOG_EXIT("File: '{}' exists\n", sOutName);
-
-    FILE* pFile = fopen(sOutName, "wb");
-    EncodedBuffWriteToFile(&encoded, pFile);
-    fclose(pFile);
-}
+    int fdIn = open(sPath, O_RDONLY);
+    if (fdIn < 0) LOG_EXIT("Error opening '{}' file\n", sPath);
+    defer( close(fdIn) );
 
-static void
-decode(IAllocator* pAlloc, const char* sPath, const char* sOutName)
-{
-    auto oBuff = file::loadToBuff(pAlloc, sPath);
-    if (!oBuff) LOG_EXIT("quit...\n");
-
-    auto eb = buffToEncoder(oBuff.data);
-    auto sOrig = EncodedBuffDecode(&eb, pAlloc);
+    int fdOut = open(sOutName, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fdOut < 0)
+    {
+        if (errno == EEXIST) LOG_EXIT("File: '{}' exists\n", sOutName);
+        else LOG_EXIT("Error opening '{}' file\n", sOutName);
+    }
+    defer( close(fdOut) );
 
-    if (!saveToOpenFile(sOutName)) LOG_EXIT("File: '{}' exists\n", sOutName);
-    FILE* pFileOut = fopen(sOutName, "wb");
-    fwrite(sOrig.pData, 1, sOrig.size, pFileOut);
+    bool bOk = bEncode ? io::encodeFile(pCtx, pAlloc, fdIn, fdOut) : io::decodeFile(pCtx, pAlloc, fdIn, fdOut);
+    if (!bOk)
+    {
+        unlink(sOutName);
+        LOG_EXIT("quit...\n");
+    }
 }
 
 int
@@ -140,17 +53,40 @@ main(int argc, char** argv)
 {
     if (argc < 4) usage(argv[0]);
 
-    Arena arena(SIZE_1M);
+    Arena arena(SIZE_1M, ARENA_BACKING::HUGE_PAGES);
     defer( freeAll(&arena) );
 
+#if defined ADT_DBG_MEMORY
+    StatsAllocator stats(&arena.super, true);
+    IAllocator* pAlloc = &stats.super;
+    defer(
+        StatsPrint(&stats, stderr);
+        AllocatorUsage u = usage(&arena);
+        fprintf(stderr, "[Arena]: blocks: %llu, reserved: %llu, used: %llu bytes\n", u.nBlocks, u.nBytesReserved, u.nBytesUsed);
+    );
+#else
+    IAllocator* pAlloc = &arena.super;
+#endif
+
+    rle_ctx* pCtx = rle_ctx_create_mt(0);
+    if (!pCtx) LOG_EXIT("failed to create codec context\n");
+    defer( rle_ctx_destroy(pCtx) );
+
     if (argv[1] == String("-e"))
     {
-        encode(&arena.super, argv[2], argv[3]);
+        run(pCtx, pAlloc, true, argv[2], argv[3]);
+        return 0;
+    }
+    else if (argv[1] == String("-E"))
+    {
+        RLE_STATUS eStatus = rle_ctx_set_dedup(pCtx, RLE_DEDUP_LINKED);
+        if (eStatus != RLE_STATUS_OK) LOG_EXIT("failed to enable dedup: {}\n", rle_status_string(eStatus));
+        run(pCtx, pAlloc, true, argv[2], argv[3]);
         return 0;
     }
     else if (argv[1] == String("-d"))
     {
-        decode(&arena.super, argv[2], argv[3]);
+        run(pCtx, pAlloc, false, argv[2], argv[3]);
         return 0;
     }
     else usage(argv[0]);
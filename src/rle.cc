@@ -0,0 +1,1503 @@
+#include "rle.h"
+
+#include "adt/OsAllocator.hh"
+#include "adt/Arena.hh"
+#include "adt/ThreadPool.hh"
+#include "adt/SwissMap.hh"
+#include "adt/hash.hh"
+#include "adt/utils.hh"
+
+#include <cstring>
+#include <new>
+
+#if defined __SSE2__
+    #include <emmintrin.h>
+#endif
+
+using namespace adt;
+
+constexpr u64 MAX_RUN = 255;
+constexpr u64 TOKEN_SIZE = 2;
+
+constexpr u64 MAX_PATTERN_PERIOD = 16;
+constexpr u64 MAX_PATTERN_REPEAT = 16;
+constexpr u64 MIN_PATTERN_LEN = 4; /* don't bother replacing fewer bytes with a pattern token */
+constexpr u64 PATTERN_RUN_CUTOFF = 32; /* runs at least this long are never checked for patterns */
+constexpr u64 MAX_TOKEN_OUTPUT = utils::max(MAX_RUN, MAX_PATTERN_PERIOD * MAX_PATTERN_REPEAT);
+constexpr u64 PATTERN_SCAN_LIMIT = MAX_PATTERN_PERIOD * MAX_PATTERN_REPEAT * 4; /* bytes matched per decision */
+
+constexpr u64 REF_SIZE = TOKEN_SIZE + 2 * sizeof(u32); /* { 0, 0 } token, distance, length */
+constexpr u64 DEDUP_MIN_CHUNK = 2 * SIZE_1K; /* smaller chunks are never deduplicated, always larger than REF_SIZE / 2 */
+constexpr u64 DEDUP_AVG_CHUNK = 8 * SIZE_1K;
+constexpr u64 DEDUP_MAX_CHUNK = 64 * SIZE_1K;
+constexpr u64 DEDUP_MASK_HARD = ~0ULL << 49; /* 15 bits before the average size, 11 after (FastCDC normalization) */
+constexpr u64 DEDUP_MASK_EASY = ~0ULL << 53;
+
+constexpr u64 SCRATCH_BLOCK_SIZE = SIZE_1M;
+constexpr u64 PARALLEL_BLOCK_SIZE = SIZE_1M; /* input bytes (or token bytes) per worker task */
+constexpr u64 BATCH_GROUP_SIZE = 64 * SIZE_1K; /* input bytes of small records per worker task */
+
+struct CompressStream
+{
+    u64 contentSize {};
+    u64 nConsumed {};
+    u8 aHeader[RLE_FRAME_HEADER_SIZE] {};
+    u32 headerPos {}; /* header bytes already flushed */
+    u64 runLen {}; /* pending run, may exceed MAX_RUN until flushed */
+    u8 runChar {};
+    bool bActive {};
+};
+
+struct DecompressStream
+{
+    u8 aHeader[RLE_FRAME_HEADER_SIZE] {};
+    u32 headerPos {}; /* header bytes already read */
+    u64 contentSize {};
+    u64 nProduced {};
+    u8 aHistory[MAX_PATTERN_PERIOD] {}; /* last written bytes, pattern tokens copy from here */
+    u8 aPattern[MAX_PATTERN_PERIOD] {}; /* pending output repeats aPattern[0, period) */
+    u8 period {};
+    u8 phase {};
+    u64 pendingLen {}; /* decoded but not yet written */
+    u8 partialRepeat {}; /* first half of a token split between input chunks */
+    bool bPartial {};
+    bool bActive {};
+    bool bRefs {}; /* RLE_FRAME_FLAG_DEDUP */
+    u8* pWindow {}; /* ring of the last RLE_DEDUP_WINDOW output bytes, dedup frames only */
+    u64 nFlushed {}; /* bytes written out, the window position */
+    u64 refDistance {}; /* pending output is a back-reference if not 0 */
+    u8 aRef[REF_SIZE - TOKEN_SIZE] {}; /* reference payload split between input chunks */
+    u8 refPos {};
+    bool bInRef {};
+};
+
+struct EncodeBlock
+{
+    const u8* pSrc {};
+    u64 size {};
+    u8* pDst {}; /* room for 2 * size */
+    u64 nWritten {};
+};
+
+struct DecodeBlock
+{
+    const u8* pSrc {}; /* whole tokens */
+    u64 size {};
+    u8* pDst {};
+    u64 nHistory {}; /* output offset of the block */
+    u64 nDecoded {}; /* index pass result */
+    RLE_STATUS eStatus {};
+    bool bDependent {}; /* pattern token referencing the previous block's output */
+};
+
+struct BatchGroup
+{
+    const rle_record* aRecords {};
+    u64 nRecords {};
+    uint64_t* aSizes {}; /* frame size per record */
+    u8* pDst {}; /* room for every record's bound */
+    u64 nWritten {};
+};
+
+struct DedupChunk
+{
+    u64 offset {}; /* latest occurrence, keeps distances short */
+    u64 size {};
+};
+
+/* RLE_DEDUP_LINKED: what later calls of the chain can reference */
+struct DedupHistory
+{
+    SwissMapT<u64, DedupChunk, IAllocator> mChunks {}; /* offsets count from the start of the chain */
+    u8* pRing {}; /* last RLE_DEDUP_WINDOW input bytes of earlier calls */
+    u64 pos {}; /* input of earlier calls */
+};
+
+struct rle_ctx
+{
+    Arena arena {}; /* scratch results and per call index buffers, reset (not freed) between calls */
+    ThreadPool* pPool {}; /* null for single threaded contexts */
+    u32 nThreads {};
+    CompressStream cs {};
+    DecompressStream ds {};
+    RLE_DEDUP eDedup {};
+    DedupHistory dedup {};
+    u8* pDedupWindow {}; /* DecompressStream::pWindow, kept between frames */
+};
+
+/* index of the first byte that differs from c, starting at i */
+static inline u64
+runEnd(const u8* p, u64 i, const u64 size, const u8 c)
+{
+    if (i >= size || p[i] != c) return i;
+
+#if defined __SSE2__
+    const __m128i vc = _mm_set1_epi8(c);
+    while (i + 16 <= size)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)&p[i]);
+        u32 mask = ~u32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, vc))) & 0xffff;
+        if (mask) return i + __builtin_ctz(mask);
+
+        i += 16;
+    }
+#endif
+
+    while (i < size && p[i] == c) ++i;
+
+    return i;
+}
+
+/* number of bytes starting at i that repeat the byte period positions back */
+static inline u64
+periodMatch(const u8* p, u64 i, const u64 size, const u64 period)
+{
+    const u64 start = i;
+
+#if defined __SSE2__
+    while (i + 16 <= size)
+    {
+        __m128i cur = _mm_loadu_si128((const __m128i*)&p[i]);
+        __m128i prev = _mm_loadu_si128((const __m128i*)&p[i - period]);
+        u32 mask = ~u32(_mm_movemask_epi8(_mm_cmpeq_epi8(cur, prev))) & 0xffff;
+        if (mask) return i + __builtin_ctz(mask) - start;
+
+        i += 16;
+    }
+#endif
+
+    while (i < size && p[i] == p[i - period]) ++i;
+
+    return i - start;
+}
+
+/* longest whole number of periods repeating at i, 0 if nothing is worth a pattern token */
+static inline u64
+bestPattern(const u8* p, const u64 i, const u64 size, u64* pPeriod)
+{
+    if (i < 2 || i + MIN_PATTERN_LEN > size) return 0;
+
+    const u64 scanEnd = utils::min(size, i + PATTERN_SCAN_LIMIT);
+    u64 best = 0;
+
+    auto tryPeriod = [&](const u64 period) {
+        u64 len = periodMatch(p, i, scanEnd, period);
+        len -= len % period;
+
+        /* on ties longer periods win, they cover more bytes per token */
+        if (len > best || (len == best && period > *pPeriod))
+        {
+            best = len;
+            *pPeriod = period;
+        }
+    };
+
+#if defined __SSE2__
+    if (i >= MAX_PATTERN_PERIOD)
+    {
+        /* bit j: p[i, i + MIN_PATTERN_LEN) repeats with period 16 - j */
+        __m128i vMatch = _mm_set1_epi8(-1);
+        for (u64 k = 0; k < MIN_PATTERN_LEN; ++k)
+        {
+            __m128i vPrev = _mm_loadu_si128((const __m128i*)&p[i + k - MAX_PATTERN_PERIOD]);
+            vMatch = _mm_and_si128(vMatch, _mm_cmpeq_epi8(vPrev, _mm_set1_epi8(p[i + k])));
+        }
+
+        u32 mask = u32(_mm_movemask_epi8(vMatch)) & 0x7fff; /* bit 15 is period 1, that's a plain run */
+        for (; mask; mask &= mask - 1)
+            tryPeriod(MAX_PATTERN_PERIOD - __builtin_ctz(mask));
+
+        return best >= MIN_PATTERN_LEN ? best : 0;
+    }
+#endif
+
+    u32 head;
+    memcpy(&head, &p[i], sizeof(head));
+
+    const u64 maxPeriod = utils::min(MAX_PATTERN_PERIOD, i);
+    for (u64 period = 2; period <= maxPeriod; ++period)
+    {
+        u32 prev;
+        memcpy(&prev, &p[i - period], sizeof(prev));
+        if (head == prev) tryPeriod(period);
+    }
+
+    return best >= MIN_PATTERN_LEN ? best : 0;
+}
+
+static inline u8 patternPeriod(const u8 x) { return (x & 0xf) + 1; }
+static inline u8 patternRepeat(const u8 x) { return (x >> 4) + 1; }
+
+static inline u64
+outPatternTokens(u8* pDst, u64 o, const u64 period, const u64 len)
+{
+    for (u64 k = len / period; k > 0;)
+    {
+        u64 n = utils::min(k, MAX_PATTERN_REPEAT);
+        pDst[o++] = 0;
+        pDst[o++] = u8((period - 1) | ((n - 1) << 4));
+        k -= n;
+    }
+
+    return o;
+}
+
+/* overlapping copy: pDst[-period, 0) repeated for len bytes */
+static inline void
+expandPattern(u8* pDst, const u64 period, const u64 len)
+{
+    u8 aPat[16];
+    for (u64 j = 0; j < sizeof(aPat); ++j)
+        aPat[j] = pDst[s64(j % period) - s64(period)];
+
+    /* aPat is periodic, so 16 byte stores can advance by any whole number of periods */
+    const u64 step = (sizeof(aPat) / period) * period;
+
+    u64 o = 0;
+    for (; o + sizeof(aPat) <= len; o += step)
+        memcpy(&pDst[o], aPat, sizeof(aPat));
+    memcpy(&pDst[o], aPat, len - o);
+}
+
+/* pDst must have room for 2 * size bytes */
+static u64
+encodeTokens(const u8* pSrc, const u64 size, u8* pDst)
+{
+    u64 o = 0;
+    for (u64 i = 0; i < size;)
+    {
+        const u8 c = pSrc[i];
+        const u64 end = runEnd(pSrc, i + 1, size, c);
+        u64 n = end - i;
+
+        if (n < PATTERN_RUN_CUTOFF)
+        {
+            u64 period = 0;
+            u64 len = bestPattern(pSrc, i, size, &period);
+            if (len > n)
+            {
+                o = outPatternTokens(pDst, o, period, len);
+                i += len;
+                continue;
+            }
+        }
+
+        for (; n > MAX_RUN; n -= MAX_RUN)
+        {
+            pDst[o++] = MAX_RUN;
+            pDst[o++] = c;
+        }
+        pDst[o++] = u8(n);
+        pDst[o++] = c;
+
+        i = end;
+    }
+
+    return o;
+}
+
+/* nHistory: bytes already decoded in front of pDst, pattern tokens may copy from them.
+ * *pWritten gets the number of decoded bytes */
+static RLE_STATUS
+decodeTokens(const u8* pSrc, const u64 size, u8* pDst, const u64 dstCap, const u64 nHistory, u64* pWritten)
+{
+    if (size % TOKEN_SIZE != 0) return RLE_STATUS_CORRUPT;
+
+    u64 o = 0;
+    for (u64 i = 0; i < size; i += TOKEN_SIZE)
+    {
+        const u8 n = pSrc[i];
+        const u8 c = pSrc[i + 1];
+
+        if (n != 0)
+        {
+            if (o + n > dstCap) return RLE_STATUS_DST_TOO_SMALL;
+
+            memset(&pDst[o], c, n);
+            o += n;
+        }
+        else
+        {
+            const u64 period = patternPeriod(c);
+            const u64 len = period * patternRepeat(c);
+
+            if (o + nHistory < period) return RLE_STATUS_CORRUPT;
+            if (o + len > dstCap) return RLE_STATUS_DST_TOO_SMALL;
+
+            expandPattern(&pDst[o], period, len);
+            o += len;
+        }
+    }
+
+    *pWritten = o;
+    return RLE_STATUS_OK;
+}
+
+static inline bool
+isRefToken(const u8* p)
+{
+    return p[0] == 0 && p[1] == 0;
+}
+
+static inline void
+readRef(const u8* pPayload, u32* pDistance, u32* pLength)
+{
+    memcpy(pDistance, pPayload, sizeof(u32));
+    memcpy(pLength, pPayload + sizeof(u32), sizeof(u32));
+}
+
+/* overlapping copy: pDst[-distance, 0) continued for len bytes, every memcpy is at most distance long */
+static inline void
+expandRef(u8* pDst, const u64 distance, u64 len)
+{
+    const u8* pFrom = pDst - distance;
+    while (len > 0)
+    {
+        const u64 n = utils::min(len, distance);
+        memcpy(pDst, pFrom, n);
+        pDst += n;
+        pFrom += n;
+        len -= n;
+    }
+}
+
+/* decodeTokens() for frames with back-references, they copy from pDst[-nHistory, o).
+ * Stops in front of a reference it can't resolve here (cut off by size, reaching past nHistory or dstCap),
+ * *pConsumed gets the number of token bytes decoded. */
+static RLE_STATUS
+decodeRefTokens(
+    const u8* pSrc, const u64 size, u8* pDst, const u64 dstCap, const u64 nHistory, u64* pWritten, u64* pConsumed
+)
+{
+    if (size % TOKEN_SIZE != 0) return RLE_STATUS_CORRUPT;
+
+    u64 o = 0, i = 0;
+    while (i < size)
+    {
+        u64 end = i;
+        while (end < size && !isRefToken(&pSrc[end])) end += TOKEN_SIZE;
+
+        u64 nWritten = 0;
+        RLE_STATUS eStatus = decodeTokens(&pSrc[i], end - i, &pDst[o], dstCap - o, nHistory + o, &nWritten);
+        if (eStatus != RLE_STATUS_OK) return eStatus;
+
+        o += nWritten;
+        i = end;
+        if (i >= size || i + REF_SIZE > size) break;
+
+        u32 distance, length;
+        readRef(&pSrc[i + TOKEN_SIZE], &distance, &length);
+        if (distance == 0 || length == 0 || distance > RLE_DEDUP_WINDOW || length > RLE_DEDUP_WINDOW)
+            return RLE_STATUS_CORRUPT;
+        if (distance > nHistory + o || length > dstCap - o) break;
+
+        expandRef(&pDst[o], distance, length);
+        o += length;
+        i += REF_SIZE;
+    }
+
+    *pWritten = o;
+    *pConsumed = i;
+    return RLE_STATUS_OK;
+}
+
+static inline void
+writeHeader(u8* pDst, const u64 contentSize)
+{
+    memcpy(pDst, &contentSize, RLE_FRAME_HEADER_SIZE);
+}
+
+/* with RLE_FRAME_FLAG_DEDUP */
+static inline u64
+readHeader(const u8* pSrc)
+{
+    u64 r;
+    memcpy(&r, pSrc, RLE_FRAME_HEADER_SIZE);
+    return r;
+}
+
+static inline u64 headerContentSize(const u64 header) { return header & ~RLE_FRAME_FLAG_DEDUP; }
+static inline bool headerRefs(const u64 header) { return header & RLE_FRAME_FLAG_DEDUP; }
+
+static int
+EncodeBlockTask(void* p)
+{
+    auto* b = (EncodeBlock*)p;
+    b->nWritten = encodeTokens(b->pSrc, b->size, b->pDst);
+
+    return thrd_success;
+}
+
+/* sum of repeat counts, so every block knows where its output starts */
+static int
+DecodeBlockIndexTask(void* p)
+{
+    auto* b = (DecodeBlock*)p;
+
+    u64 sum = 0;
+    for (u64 i = 0; i < b->size; i += TOKEN_SIZE)
+    {
+        const u8 n = b->pSrc[i];
+
+        if (n != 0) sum += n;
+        else
+        {
+            const u64 period = patternPeriod(b->pSrc[i + 1]);
+            if (sum < period) b->bDependent = true;
+
+            sum += period * patternRepeat(b->pSrc[i + 1]);
+        }
+    }
+
+    b->nDecoded = sum;
+    b->eStatus = RLE_STATUS_OK;
+
+    return thrd_success;
+}
+
+static int
+DecodeBlockTask(void* p)
+{
+    auto* b = (DecodeBlock*)p;
+
+    u64 nWritten = 0;
+    b->eStatus = decodeTokens(b->pSrc, b->size, b->pDst, b->nDecoded, b->nHistory, &nWritten);
+
+    return thrd_success;
+}
+
+static u64
+encodeFrame(const u8* pSrc, const u64 size, u8* pDst)
+{
+    writeHeader(pDst, size);
+    return RLE_FRAME_HEADER_SIZE + encodeTokens(pSrc, size, pDst + RLE_FRAME_HEADER_SIZE);
+}
+
+static int
+BatchGroupTask(void* p)
+{
+    auto* g = (BatchGroup*)p;
+
+    u64 o = 0;
+    for (u64 i = 0; i < g->nRecords; ++i)
+    {
+        u64 n = encodeFrame((const u8*)g->aRecords[i].src, g->aRecords[i].size, g->pDst + o);
+        g->aSizes[i] = n;
+        o += n;
+    }
+    g->nWritten = o;
+
+    return thrd_success;
+}
+
+/* null if the work is too small to be worth splitting into blockSize pieces */
+static ThreadPool*
+CtxPool(rle_ctx* s, u64 size, u64 blockSize)
+{
+    if (s->nThreads <= 1 || size < blockSize * 2) return nullptr;
+
+    if (!s->pPool)
+    {
+        auto* pPool = (ThreadPool*)alloc(inl_pOsAlloc, 1, sizeof(ThreadPool));
+        new(pPool) ThreadPool(inl_pOsAlloc, s->nThreads);
+        ThreadPoolStart(pPool);
+        s->pPool = pPool;
+    }
+
+    return s->pPool;
+}
+
+/* pDst must have room for 2 * size bytes */
+static u64
+CtxEncode(rle_ctx* s, const u8* pSrc, const u64 size, u8* pDst)
+{
+    ThreadPool* pPool = CtxPool(s, size, PARALLEL_BLOCK_SIZE);
+    if (!pPool) return encodeTokens(pSrc, size, pDst);
+
+    /* every block encodes into its own worst case slot, then slots get compacted to the left */
+    const u64 nBlocks = (size + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+    auto* aBlocks = (EncodeBlock*)alloc(&s->arena, nBlocks, sizeof(EncodeBlock));
+
+    for (u64 i = 0; i < nBlocks; ++i)
+    {
+        u64 off = i * PARALLEL_BLOCK_SIZE;
+        aBlocks[i] = {
+            .pSrc = pSrc + off,
+            .size = utils::min(PARALLEL_BLOCK_SIZE, size - off),
+            .pDst = pDst + off * TOKEN_SIZE,
+        };
+    }
+
+    parallelFor(pPool, 0, nBlocks, 1, [&](u64 b, u64 e) {
+        for (u64 i = b; i < e; ++i) EncodeBlockTask(&aBlocks[i]);
+    });
+
+    u64 o = 0;
+    for (u64 i = 0; i < nBlocks; ++i)
+    {
+        if (pDst + o != aBlocks[i].pDst) memmove(pDst + o, aBlocks[i].pDst, aBlocks[i].nWritten);
+        o += aBlocks[i].nWritten;
+    }
+
+    return o;
+}
+
+/* random values per byte for the rolling gear hash */
+struct GearTable
+{
+    u64 a[256] {};
+
+    constexpr GearTable()
+    {
+        u64 x = 0x9E3779B97F4A7C15ULL; /* splitmix64 */
+        for (u64& r : a)
+        {
+            x += 0x9E3779B97F4A7C15ULL;
+            u64 z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            r = z ^ (z >> 31);
+        }
+    }
+};
+
+constexpr GearTable GEAR_TABLE {};
+
+/* Length of the next content-defined chunk (FastCDC): cut where the gear hash of the last 64 bytes has its top bits clear.
+ * Same content gives the same cut points wherever it sits in the input, so repeated blocks line up even after insertions. */
+static u64
+nextChunk(const u8* p, const u64 size)
+{
+    if (size <= DEDUP_MIN_CHUNK) return size;
+
+    const u64 end = utils::min(size, DEDUP_MAX_CHUNK);
+    const u64 normal = utils::min(end, DEDUP_AVG_CHUNK);
+
+    u64 h = 0;
+    u64 i = DEDUP_MIN_CHUNK;
+    for (; i < normal; ++i)
+    {
+        h = (h << 1) + GEAR_TABLE.a[p[i]];
+        if (!(h & DEDUP_MASK_HARD)) return i + 1;
+    }
+    for (; i < end; ++i)
+    {
+        h = (h << 1) + GEAR_TABLE.a[p[i]];
+        if (!(h & DEDUP_MASK_EASY)) return i + 1;
+    }
+
+    return end;
+}
+
+static inline void
+writeRef(u8* pDst, const u32 distance, const u32 length)
+{
+    pDst[0] = pDst[1] = 0;
+    memcpy(pDst + TOKEN_SIZE, &distance, sizeof(u32));
+    memcpy(pDst + TOKEN_SIZE + sizeof(u32), &length, sizeof(u32));
+}
+
+/* compare with an earlier chunk at chain offset `from`, chunks never straddle calls:
+ * it's either in this call's input (starting at chain offset `base`) or in the history ring */
+static inline bool
+DedupEqual(const rle_ctx* s, const u8* pSrc, const u64 base, const u64 from, const u8* p, const u64 n)
+{
+    if (from >= base) return memcmp(&pSrc[from - base], p, n) == 0;
+
+    constexpr u64 mask = RLE_DEDUP_WINDOW - 1;
+    const u64 at = from & mask;
+    const u64 nFirst = utils::min(n, RLE_DEDUP_WINDOW - at);
+
+    return memcmp(&s->dedup.pRing[at], p, nFirst) == 0 && memcmp(s->dedup.pRing, p + nFirst, n - nFirst) == 0;
+}
+
+/* RLE_DEDUP_LINKED: keep the tail of the input for later calls, forget chunks no later call can reach */
+static void
+DedupAppend(rle_ctx* s, const u8* pSrc, const u64 size)
+{
+    DedupHistory* h = &s->dedup;
+    constexpr u64 mask = RLE_DEDUP_WINDOW - 1;
+
+    for (u64 i = size > RLE_DEDUP_WINDOW ? size - RLE_DEDUP_WINDOW : 0; i < size;)
+    {
+        const u64 at = (h->pos + i) & mask;
+        const u64 n = utils::min(size - i, RLE_DEDUP_WINDOW - at);
+        memcpy(&h->pRing[at], &pSrc[i], n);
+        i += n;
+    }
+    h->pos += size;
+
+    /* at most RLE_DEDUP_WINDOW / DEDUP_MIN_CHUNK chunks are in reach, purge once twice that many pile up */
+    if (SwissMapSize(&h->mChunks) <= 2 * RLE_DEDUP_WINDOW / DEDUP_MIN_CHUNK) return;
+
+    for (u32 i = SwissMapFirstI(&h->mChunks); i != NPOS; i = SwissMapNextI(&h->mChunks, i))
+    {
+        if (h->pos - h->mChunks.base.pSlots[i].val.offset > RLE_DEDUP_WINDOW)
+            SwissMapRemove(&h->mChunks, i);
+    }
+}
+
+/* CtxEncode() with repeated chunks replaced by back-references, the spans between them are encoded as usual.
+ * pDst must have room for 2 * size bytes, *pbRefs tells if any reference was emitted */
+static u64
+CtxEncodeDedup(rle_ctx* s, const u8* pSrc, const u64 size, u8* pDst, bool* pbRefs)
+{
+    const bool bLinked = s->eDedup == RLE_DEDUP_LINKED;
+    const u64 base = bLinked ? s->dedup.pos : 0; /* chain offset of pSrc[0] */
+
+    SwissMapT<u64, DedupChunk, IAllocator> mFrame {};
+    if (!bLinked) mFrame = {&s->arena.super, u32(size / DEDUP_AVG_CHUNK)};
+    auto* pChunks = bLinked ? &s->dedup.mChunks : &mFrame;
+
+    u64 o = 0;
+    u64 literalStart = 0; /* input not yet encoded */
+    u64 lastRef = NPOS64; /* output offset of the previous reference if nothing came after it */
+    *pbRefs = false;
+
+    for (u64 i = 0, n; i < size; i += n)
+    {
+        n = nextChunk(&pSrc[i], size - i);
+        if (n < DEDUP_MIN_CHUNK) continue;
+
+        const u64 at = base + i;
+        auto res = SwissMapTryInsert(pChunks, hash::xxh64(&pSrc[i], n), {at, n});
+        if (res.eStatus == MAP_RESULT_STATUS::INSERTED) continue;
+
+        DedupChunk* pPrev = &res.pData->val;
+        const u64 distance = at - pPrev->offset;
+        const bool bRepeat = pPrev->size == n && distance <= RLE_DEDUP_WINDOW &&
+            DedupEqual(s, pSrc, base, pPrev->offset, &pSrc[i], n);
+        *pPrev = {at, n};
+
+        if (!bRepeat) continue;
+
+        if (literalStart < i)
+        {
+            o += CtxEncode(s, &pSrc[literalStart], i - literalStart, &pDst[o]);
+            lastRef = NPOS64;
+        }
+
+        /* consecutive repeats of consecutive chunks grow one reference */
+        u32 prevDistance, prevLength;
+        if (lastRef != NPOS64) readRef(&pDst[lastRef + TOKEN_SIZE], &prevDistance, &prevLength);
+
+        if (lastRef != NPOS64 && prevDistance == distance && prevLength + n <= RLE_DEDUP_WINDOW)
+        {
+            writeRef(&pDst[lastRef], prevDistance, u32(prevLength + n));
+        }
+        else
+        {
+            writeRef(&pDst[o], u32(distance), u32(n));
+            lastRef = o;
+            o += REF_SIZE;
+        }
+
+        literalStart = i + n;
+        *pbRefs = true;
+    }
+
+    if (literalStart < size) o += CtxEncode(s, &pSrc[literalStart], size - literalStart, &pDst[o]);
+
+    return o;
+}
+
+/* header and tokens, pDst must have room for rle_compress_bound(size) */
+static u64
+CtxEncodeFrame(rle_ctx* s, const u8* pSrc, const u64 size, u8* pDst)
+{
+    if (s->eDedup == RLE_DEDUP_OFF)
+    {
+        writeHeader(pDst, size);
+        return RLE_FRAME_HEADER_SIZE + CtxEncode(s, pSrc, size, pDst + RLE_FRAME_HEADER_SIZE);
+    }
+
+    bool bRefs = false;
+    u64 n = CtxEncodeDedup(s, pSrc, size, pDst + RLE_FRAME_HEADER_SIZE, &bRefs);
+    if (s->eDedup == RLE_DEDUP_LINKED) DedupAppend(s, pSrc, size);
+    /* no references, no flag: plain frames keep the parallel decoder */
+    writeHeader(pDst, bRefs ? size | RLE_FRAME_FLAG_DEDUP : size);
+
+    return RLE_FRAME_HEADER_SIZE + n;
+}
+
+/* decodes exactly contentSize bytes or fails */
+static RLE_STATUS
+CtxDecode(rle_ctx* s, const u8* pSrc, const u64 size, u8* pDst, const u64 contentSize, const bool bRefs)
+{
+    if (size % TOKEN_SIZE != 0) return RLE_STATUS_CORRUPT;
+
+    /* references need all output before them, decoded in one pass */
+    if (bRefs)
+    {
+        u64 nWritten = 0, nConsumed = 0;
+        RLE_STATUS eStatus = decodeRefTokens(pSrc, size, pDst, contentSize, 0, &nWritten, &nConsumed);
+
+        if (eStatus == RLE_STATUS_DST_TOO_SMALL) return RLE_STATUS_CORRUPT;
+        if (eStatus != RLE_STATUS_OK) return eStatus;
+        if (nConsumed != size || nWritten != contentSize) return RLE_STATUS_CORRUPT;
+
+        return RLE_STATUS_OK;
+    }
+
+    ThreadPool* pPool = CtxPool(s, size, PARALLEL_BLOCK_SIZE);
+    if (!pPool)
+    {
+        u64 nWritten = 0;
+        RLE_STATUS eStatus = decodeTokens(pSrc, size, pDst, contentSize, 0, &nWritten);
+
+        if (eStatus == RLE_STATUS_DST_TOO_SMALL) return RLE_STATUS_CORRUPT; /* more data than the header says */
+        if (eStatus != RLE_STATUS_OK) return eStatus;
+        if (nWritten != contentSize) return RLE_STATUS_CORRUPT;
+
+        return RLE_STATUS_OK;
+    }
+
+    const u64 nBlocks = (size + PARALLEL_BLOCK_SIZE - 1) / PARALLEL_BLOCK_SIZE;
+    auto* aBlocks = (DecodeBlock*)alloc(&s->arena, nBlocks, sizeof(DecodeBlock));
+
+    for (u64 i = 0; i < nBlocks; ++i)
+    {
+        u64 off = i * PARALLEL_BLOCK_SIZE;
+        aBlocks[i] = {.pSrc = pSrc + off, .size = utils::min(PARALLEL_BLOCK_SIZE, size - off)};
+    }
+
+    parallelFor(pPool, 0, nBlocks, 1, [&](u64 b, u64 e) {
+        for (u64 i = b; i < e; ++i) DecodeBlockIndexTask(&aBlocks[i]);
+    });
+
+    u64 o = 0;
+    for (u64 i = 0; i < nBlocks; ++i)
+    {
+        if (aBlocks[i].eStatus != RLE_STATUS_OK) return aBlocks[i].eStatus;
+        if (aBlocks[i].nDecoded > contentSize - o) return RLE_STATUS_CORRUPT;
+
+        aBlocks[i].pDst = pDst + o;
+        aBlocks[i].nHistory = o;
+        o += aBlocks[i].nDecoded;
+    }
+    if (o != contentSize) return RLE_STATUS_CORRUPT;
+
+    parallelFor(pPool, 0, nBlocks, 1, [&](u64 b, u64 e) {
+        for (u64 i = b; i < e; ++i)
+            if (!aBlocks[i].bDependent) DecodeBlockTask(&aBlocks[i]);
+    });
+
+    /* previous blocks are complete by now, in order */
+    for (u64 i = 0; i < nBlocks; ++i)
+        if (aBlocks[i].bDependent) DecodeBlockTask(&aBlocks[i]);
+
+    for (u64 i = 0; i < nBlocks; ++i)
+        if (aBlocks[i].eStatus != RLE_STATUS_OK) return RLE_STATUS_CORRUPT;
+
+    return RLE_STATUS_OK;
+}
+
+static u64
+batchBound(const rle_record* aRecords, const u64 nRecords)
+{
+    u64 r = 0;
+    for (u64 i = 0; i < nRecords; ++i)
+        r += rle_compress_bound(aRecords[i].size);
+
+    return r;
+}
+
+/* frames packed back to back into pDst (room for batchBound()), aOffsets has nRecords + 1 entries */
+static u64
+CtxEncodeBatch(rle_ctx* s, const rle_record* aRecords, const u64 nRecords, u8* pDst, uint64_t* aOffsets)
+{
+    u64 totalSize = 0;
+    for (u64 i = 0; i < nRecords; ++i)
+        totalSize += aRecords[i].size;
+
+    aOffsets[0] = 0;
+
+    ThreadPool* pPool = CtxPool(s, totalSize, BATCH_GROUP_SIZE);
+    if (!pPool)
+    {
+        BatchGroup g {.aRecords = aRecords, .nRecords = nRecords, .aSizes = &aOffsets[1], .pDst = pDst};
+        BatchGroupTask(&g);
+    }
+    else
+    {
+        /* group consecutive records by input size, each group encodes into its own worst case slot */
+        u64 nGroups = 0;
+        for (u64 i = 0, acc = 0; i < nRecords; ++i)
+        {
+            acc += aRecords[i].size;
+            if (acc >= BATCH_GROUP_SIZE || i == nRecords - 1)
+            {
+                ++nGroups;
+                acc = 0;
+            }
+        }
+
+        auto* aGroups = (BatchGroup*)alloc(&s->arena, nGroups, sizeof(BatchGroup));
+
+        u64 first = 0, acc = 0, slot = 0, slotSize = 0, g = 0;
+        for (u64 i = 0; i < nRecords; ++i)
+        {
+            acc += aRecords[i].size;
+            slotSize += rle_compress_bound(aRecords[i].size);
+
+            if (acc >= BATCH_GROUP_SIZE || i == nRecords - 1)
+            {
+                aGroups[g] = {
+                    .aRecords = &aRecords[first],
+                    .nRecords = i + 1 - first,
+                    .aSizes = &aOffsets[first + 1],
+                    .pDst = pDst + slot,
+                };
+
+                ++g;
+                first = i + 1;
+                slot += slotSize;
+                acc = slotSize = 0;
+            }
+        }
+
+        parallelFor(pPool, 0, nGroups, 1, [&](u64 b, u64 e) {
+            for (u64 i = b; i < e; ++i) BatchGroupTask(&aGroups[i]);
+        });
+
+        u64 o = 0;
+        for (u64 i = 0; i < nGroups; ++i)
+        {
+            if (pDst + o != aGroups[i].pDst) memmove(pDst + o, aGroups[i].pDst, aGroups[i].nWritten);
+            o += aGroups[i].nWritten;
+        }
+    }
+
+    /* sizes to offsets */
+    for (u64 i = 0; i < nRecords; ++i)
+        aOffsets[i + 1] += aOffsets[i];
+
+    return aOffsets[nRecords];
+}
+
+static inline u64
+outRoom(const rle_out_buffer* pOut)
+{
+    return pOut->size - pOut->pos;
+}
+
+static inline void
+outToken(rle_out_buffer* pOut, const u8 n, const u8 c)
+{
+    auto* p = (u8*)pOut->dst + pOut->pos;
+    p[0] = n;
+    p[1] = c;
+    pOut->pos += TOKEN_SIZE;
+}
+
+/* false if pOut got full before the header was written */
+static bool
+CompressStreamFlushHeader(CompressStream* s, rle_out_buffer* pOut)
+{
+    u64 nLeft = RLE_FRAME_HEADER_SIZE - s->headerPos;
+    u64 n = utils::min(nLeft, outRoom(pOut));
+
+    memcpy((u8*)pOut->dst + pOut->pos, &s->aHeader[s->headerPos], n);
+    pOut->pos += n;
+    s->headerPos += n;
+
+    return s->headerPos == RLE_FRAME_HEADER_SIZE;
+}
+
+/* emit full tokens until the pending run fits into one, false if pOut got full */
+static bool
+CompressStreamDrainRun(CompressStream* s, rle_out_buffer* pOut)
+{
+    while (s->runLen > MAX_RUN)
+    {
+        if (outRoom(pOut) < TOKEN_SIZE) return false;
+
+        outToken(pOut, MAX_RUN, s->runChar);
+        s->runLen -= MAX_RUN;
+    }
+
+    return true;
+}
+
+/* n bytes were just written out */
+static void
+DecompressStreamPushHistory(DecompressStream* s, const u8* p, const u64 n)
+{
+    constexpr u64 cap = MAX_PATTERN_PERIOD;
+
+    if (n >= cap)
+    {
+        memcpy(s->aHistory, p + n - cap, cap);
+    }
+    else
+    {
+        memmove(s->aHistory, s->aHistory + n, cap - n);
+        memcpy(s->aHistory + cap - n, p, n);
+    }
+
+    if (s->pWindow)
+    {
+        constexpr u64 mask = RLE_DEDUP_WINDOW - 1;
+
+        const u64 skip = n > RLE_DEDUP_WINDOW ? n - RLE_DEDUP_WINDOW : 0;
+        const u64 pos = (s->nFlushed + skip) & mask;
+        const u64 size = n - skip;
+        const u64 nFirst = utils::min(size, RLE_DEDUP_WINDOW - pos);
+
+        memcpy(s->pWindow + pos, p + skip, nFirst);
+        memcpy(s->pWindow, p + skip + nFirst, size - nFirst);
+    }
+
+    s->nFlushed += n;
+}
+
+/* copy the pending back-reference out of the window, false if pOut got full first */
+static bool
+DecompressStreamFlushRef(DecompressStream* s, rle_out_buffer* pOut)
+{
+    constexpr u64 mask = RLE_DEDUP_WINDOW - 1;
+
+    while (s->pendingLen > 0 && outRoom(pOut) > 0)
+    {
+        /* at most distance bytes at a time, so the source is already in the window */
+        const u64 from = (s->nFlushed - s->refDistance) & mask;
+        const u64 n = utils::min(utils::min(s->pendingLen, outRoom(pOut)), utils::min(s->refDistance, RLE_DEDUP_WINDOW - from));
+        auto* p = (u8*)pOut->dst + pOut->pos;
+
+        memcpy(p, s->pWindow + from, n);
+        pOut->pos += n;
+        s->pendingLen -= n;
+        DecompressStreamPushHistory(s, p, n);
+    }
+
+    return s->pendingLen == 0;
+}
+
+/* consume the reference payload after a { 0, 0 } token, false if pIn ran out first */
+static bool
+DecompressStreamReadRef(DecompressStream* s, rle_in_buffer* pIn)
+{
+    const u64 n = utils::min(u64(sizeof(s->aRef) - s->refPos), u64(pIn->size - pIn->pos));
+    memcpy(&s->aRef[s->refPos], (const u8*)pIn->src + pIn->pos, n);
+    s->refPos += n;
+    pIn->pos += n;
+
+    return s->refPos == sizeof(s->aRef);
+}
+
+static RLE_STATUS
+DecompressStreamStartRef(DecompressStream* s)
+{
+    s->bInRef = false;
+
+    u32 distance, length;
+    readRef(s->aRef, &distance, &length);
+
+    if (distance == 0 || length == 0 || distance > RLE_DEDUP_WINDOW || length > RLE_DEDUP_WINDOW) return RLE_STATUS_CORRUPT;
+    if (distance > s->nProduced || s->nProduced + length > s->contentSize) return RLE_STATUS_CORRUPT;
+
+    s->refDistance = distance;
+    s->pendingLen = length;
+    s->nProduced += length;
+
+    return RLE_STATUS_OK;
+}
+
+/* write out the pending run or pattern, false if pOut got full first */
+static bool
+DecompressStreamFlush(DecompressStream* s, rle_out_buffer* pOut)
+{
+    if (s->pendingLen == 0) return true;
+    if (s->refDistance) return DecompressStreamFlushRef(s, pOut);
+
+    const u64 n = utils::min(s->pendingLen, outRoom(pOut));
+    auto* p = (u8*)pOut->dst + pOut->pos;
+
+    if (s->period == 1)
+    {
+        memset(p, s->aPattern[0], n);
+    }
+    else
+    {
+        for (u64 i = 0; i < n; ++i)
+        {
+            p[i] = s->aPattern[s->phase];
+            if (++s->phase == s->period) s->phase = 0;
+        }
+    }
+
+    pOut->pos += n;
+    s->pendingLen -= n;
+    DecompressStreamPushHistory(s, p, n);
+
+    return s->pendingLen == 0;
+}
+
+extern "C" {
+
+RLE_API unsigned
+rle_version_number(void)
+{
+    return RLE_VERSION_NUMBER;
+}
+
+RLE_API const char*
+rle_status_string(RLE_STATUS eStatus)
+{
+    constexpr const char* map[] {
+        "ok",
+        "more input or output space required",
+        "bad argument",
+        "destination buffer is too small",
+        "corrupted input",
+        "streamed size doesn't match content size",
+        "out of memory",
+    };
+
+    if (u32(eStatus) >= utils::size(map)) return "unknown status";
+    return map[eStatus];
+}
+
+RLE_API rle_ctx*
+rle_ctx_create(void)
+{
+    return rle_ctx_create_mt(1);
+}
+
+RLE_API rle_ctx*
+rle_ctx_create_mt(unsigned nThreads)
+{
+    auto* s = (rle_ctx*)alloc(inl_pOsAlloc, 1, sizeof(rle_ctx));
+    if (!s) return nullptr;
+
+    *s = {};
+    s->arena = Arena(SCRATCH_BLOCK_SIZE);
+    s->nThreads = nThreads == 0 ? getNCores() : nThreads;
+
+    return s;
+}
+
+RLE_API void
+rle_ctx_destroy(rle_ctx* s)
+{
+    if (!s) return;
+
+    if (s->pPool)
+    {
+        ThreadPoolDestroy(s->pPool);
+        free(inl_pOsAlloc, s->pPool);
+    }
+    if (s->pDedupWindow) free(inl_pOsAlloc, s->pDedupWindow);
+    if (s->dedup.mChunks.pA) SwissMapDestroy(&s->dedup.mChunks);
+    if (s->dedup.pRing) free(inl_pOsAlloc, s->dedup.pRing);
+    ArenaFreeAll(&s->arena);
+    free(inl_pOsAlloc, s);
+}
+
+RLE_API void
+rle_ctx_reset(rle_ctx* s)
+{
+    if (!s) return;
+
+    ArenaReset(&s->arena);
+}
+
+RLE_API RLE_STATUS
+rle_ctx_set_dedup(rle_ctx* s, RLE_DEDUP eMode)
+{
+    if (!s || u32(eMode) > RLE_DEDUP_LINKED) return RLE_STATUS_BAD_ARG;
+
+    /* new chain */
+    DedupHistory* h = &s->dedup;
+    if (h->mChunks.pA) SwissMapDestroy(&h->mChunks);
+    h->mChunks = {};
+    h->pos = 0;
+
+    if (eMode == RLE_DEDUP_LINKED)
+    {
+        if (!h->pRing) h->pRing = (u8*)alloc(inl_pOsAlloc, RLE_DEDUP_WINDOW, 1);
+        if (!h->pRing) return RLE_STATUS_NO_MEMORY;
+
+        h->mChunks = {inl_pOsAlloc, u32(RLE_DEDUP_WINDOW / DEDUP_AVG_CHUNK)};
+    }
+
+    s->eDedup = eMode;
+    return RLE_STATUS_OK;
+}
+
+RLE_API size_t
+rle_compress_bound(size_t srcSize)
+{
+    return RLE_FRAME_HEADER_SIZE + srcSize * TOKEN_SIZE;
+}
+
+RLE_API RLE_STATUS
+rle_decompressed_size(const void* pSrc, size_t srcSize, uint64_t* pSize)
+{
+    if (!pSrc || !pSize) return RLE_STATUS_BAD_ARG;
+    if (srcSize < RLE_FRAME_HEADER_SIZE) return RLE_STATUS_CORRUPT;
+
+    *pSize = headerContentSize(readHeader((const u8*)pSrc));
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress(rle_ctx* s, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pWritten)
+{
+    if (!s || (!pSrc && srcSize > 0) || !pDst || !pWritten) return RLE_STATUS_BAD_ARG;
+    if (dstCap < rle_compress_bound(srcSize)) return RLE_STATUS_DST_TOO_SMALL;
+
+    ArenaReset(&s->arena);
+
+    *pWritten = CtxEncodeFrame(s, (const u8*)pSrc, srcSize, (u8*)pDst);
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_decompress(rle_ctx* s, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pWritten)
+{
+    if (!s || !pSrc || (!pDst && dstCap > 0) || !pWritten) return RLE_STATUS_BAD_ARG;
+    if (srcSize < RLE_FRAME_HEADER_SIZE) return RLE_STATUS_CORRUPT;
+
+    const u64 header = readHeader((const u8*)pSrc);
+    const u64 contentSize = headerContentSize(header);
+    if (contentSize > dstCap) return RLE_STATUS_DST_TOO_SMALL;
+
+    ArenaReset(&s->arena);
+
+    RLE_STATUS eStatus = CtxDecode(
+        s, (const u8*)pSrc + RLE_FRAME_HEADER_SIZE, srcSize - RLE_FRAME_HEADER_SIZE, (u8*)pDst, contentSize, headerRefs(header)
+    );
+    if (eStatus != RLE_STATUS_OK) return eStatus;
+
+    *pWritten = contentSize;
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress_scratch(rle_ctx* s, const void* pSrc, size_t srcSize, const void** ppDst, size_t* pSize)
+{
+    if (!s || (!pSrc && srcSize > 0) || !ppDst || !pSize) return RLE_STATUS_BAD_ARG;
+
+    ArenaReset(&s->arena);
+
+    auto* pOut = (u8*)alloc(&s->arena, rle_compress_bound(srcSize), 1);
+
+    *pSize = CtxEncodeFrame(s, (const u8*)pSrc, srcSize, pOut);
+    *ppDst = pOut;
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_decompress_scratch(rle_ctx* s, const void* pSrc, size_t srcSize, const void** ppDst, size_t* pSize)
+{
+    if (!s || !pSrc || !ppDst || !pSize) return RLE_STATUS_BAD_ARG;
+    if (srcSize < RLE_FRAME_HEADER_SIZE) return RLE_STATUS_CORRUPT;
+
+    const u64 header = readHeader((const u8*)pSrc);
+    const u64 contentSize = headerContentSize(header);
+    const u64 payloadSize = srcSize - RLE_FRAME_HEADER_SIZE;
+
+    /* don't trust the header with the allocation size */
+    if (headerRefs(header))
+    {
+        if (contentSize / RLE_DEDUP_WINDOW > payloadSize / REF_SIZE) return RLE_STATUS_CORRUPT;
+    }
+    else if (contentSize > (payloadSize / TOKEN_SIZE) * MAX_TOKEN_OUTPUT) return RLE_STATUS_CORRUPT;
+
+    ArenaReset(&s->arena);
+
+    auto* pOut = (u8*)alloc(&s->arena, contentSize, 1);
+    RLE_STATUS eStatus = CtxDecode(
+        s, (const u8*)pSrc + RLE_FRAME_HEADER_SIZE, payloadSize, pOut, contentSize, headerRefs(header)
+    );
+    if (eStatus != RLE_STATUS_OK) return eStatus;
+
+    *ppDst = pOut;
+    *pSize = contentSize;
+    return RLE_STATUS_OK;
+}
+
+RLE_API size_t
+rle_compress_batch_bound(const rle_record* aRecords, size_t nRecords)
+{
+    if (!aRecords) return 0;
+
+    return batchBound(aRecords, nRecords);
+}
+
+RLE_API RLE_STATUS
+rle_compress_batch(
+    rle_ctx* s,
+    const rle_record* aRecords,
+    size_t nRecords,
+    void* pDst,
+    size_t dstCap,
+    uint64_t* aOffsets
+)
+{
+    if (!s || (!aRecords && nRecords > 0) || !pDst || !aOffsets) return RLE_STATUS_BAD_ARG;
+    if (dstCap < batchBound(aRecords, nRecords)) return RLE_STATUS_DST_TOO_SMALL;
+
+    ArenaReset(&s->arena);
+    CtxEncodeBatch(s, aRecords, nRecords, (u8*)pDst, aOffsets);
+
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress_batch_scratch(
+    rle_ctx* s,
+    const rle_record* aRecords,
+    size_t nRecords,
+    const void** ppDst,
+    const uint64_t** paOffsets
+)
+{
+    if (!s || (!aRecords && nRecords > 0) || !ppDst || !paOffsets) return RLE_STATUS_BAD_ARG;
+
+    ArenaReset(&s->arena);
+
+    auto* aOffsets = (uint64_t*)alloc(&s->arena, nRecords + 1, sizeof(uint64_t));
+    auto* pDst = (u8*)alloc(&s->arena, batchBound(aRecords, nRecords), 1);
+    CtxEncodeBatch(s, aRecords, nRecords, pDst, aOffsets);
+
+    *ppDst = pDst;
+    *paOffsets = aOffsets;
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress_stream_begin(rle_ctx* s, uint64_t contentSize)
+{
+    if (!s) return RLE_STATUS_BAD_ARG;
+
+    s->cs = {};
+    s->cs.contentSize = contentSize;
+    s->cs.bActive = true;
+    writeHeader(s->cs.aHeader, contentSize);
+
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress_stream(rle_ctx* s, rle_out_buffer* pOut, rle_in_buffer* pIn)
+{
+    if (!s || !pOut || !pIn || !s->cs.bActive) return RLE_STATUS_BAD_ARG;
+
+    auto* cs = &s->cs;
+    const auto* pSrc = (const u8*)pIn->src;
+
+    if (cs->nConsumed + (pIn->size - pIn->pos) > cs->contentSize)
+        return RLE_STATUS_SIZE_MISMATCH;
+
+    if (!CompressStreamFlushHeader(cs, pOut)) return RLE_STATUS_OK;
+
+    for (;;)
+    {
+        if (!CompressStreamDrainRun(cs, pOut)) break;
+        if (pIn->pos >= pIn->size) break;
+
+        const u8 c = pSrc[pIn->pos];
+        if (cs->runLen > 0 && c != cs->runChar)
+        {
+            if (outRoom(pOut) < TOKEN_SIZE) break;
+
+            outToken(pOut, u8(cs->runLen), cs->runChar);
+            cs->runLen = 0;
+        }
+
+        cs->runChar = c;
+        u64 end = runEnd(pSrc, pIn->pos, pIn->size, c);
+        cs->runLen += end - pIn->pos;
+        cs->nConsumed += end - pIn->pos;
+        pIn->pos = end;
+    }
+
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_compress_stream_end(rle_ctx* s, rle_out_buffer* pOut)
+{
+    if (!s || !pOut || !s->cs.bActive) return RLE_STATUS_BAD_ARG;
+
+    auto* cs = &s->cs;
+
+    if (cs->nConsumed != cs->contentSize) return RLE_STATUS_SIZE_MISMATCH;
+
+    if (!CompressStreamFlushHeader(cs, pOut)) return RLE_STATUS_MORE;
+    if (!CompressStreamDrainRun(cs, pOut)) return RLE_STATUS_MORE;
+
+    if (cs->runLen > 0)
+    {
+        if (outRoom(pOut) < TOKEN_SIZE) return RLE_STATUS_MORE;
+
+        outToken(pOut, u8(cs->runLen), cs->runChar);
+        cs->runLen = 0;
+    }
+
+    cs->bActive = false;
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_decompress_stream_begin(rle_ctx* s)
+{
+    if (!s) return RLE_STATUS_BAD_ARG;
+
+    s->ds = {};
+    s->ds.bActive = true;
+
+    return RLE_STATUS_OK;
+}
+
+RLE_API RLE_STATUS
+rle_decompress_stream(rle_ctx* s, rle_out_buffer* pOut, rle_in_buffer* pIn)
+{
+    if (!s || !pOut || !pIn || !s->ds.bActive) return RLE_STATUS_BAD_ARG;
+
+    auto* ds = &s->ds;
+    const auto* pSrc = (const u8*)pIn->src;
+    /* pOut->dst[outStart, pos) is what this call wrote, anything before it belongs to the caller */
+    const u64 outStart = pOut->pos;
+
+    if (ds->headerPos < RLE_FRAME_HEADER_SIZE)
+    {
+        u64 n = utils::min(u64(RLE_FRAME_HEADER_SIZE - ds->headerPos), u64(pIn->size - pIn->pos));
+        memcpy(&ds->aHeader[ds->headerPos], &pSrc[pIn->pos], n);
+        ds->headerPos += n;
+        pIn->pos += n;
+
+        if (ds->headerPos < RLE_FRAME_HEADER_SIZE) return RLE_STATUS_MORE;
+
+        const u64 header = readHeader(ds->aHeader);
+        ds->contentSize = headerContentSize(header);
+        ds->bRefs = headerRefs(header);
+
+        if (ds->bRefs)
+        {
+            if (!s->pDedupWindow) s->pDedupWindow = (u8*)alloc(inl_pOsAlloc, RLE_DEDUP_WINDOW, 1);
+            if (!s->pDedupWindow) return RLE_STATUS_NO_MEMORY;
+
+            ds->pWindow = s->pDedupWindow;
+        }
+    }
+
+    for (;;)
+    {
+        if (!DecompressStreamFlush(ds, pOut)) return RLE_STATUS_MORE;
+
+        if (ds->nProduced == ds->contentSize)
+        {
+            if (ds->bPartial || ds->bInRef || pIn->pos < pIn->size) return RLE_STATUS_CORRUPT; /* trailing garbage */
+
+            ds->bActive = false;
+            return RLE_STATUS_OK;
+        }
+
+        if (pIn->pos >= pIn->size) return RLE_STATUS_MORE;
+
+        if (ds->bInRef)
+        {
+            if (!DecompressStreamReadRef(ds, pIn)) return RLE_STATUS_MORE;
+
+            RLE_STATUS eStatus = DecompressStreamStartRef(ds);
+            if (eStatus != RLE_STATUS_OK) return eStatus;
+            continue;
+        }
+
+        /* whole tokens straight into pOut, once our own output in front of it covers the history */
+        const u64 nHistory = pOut->pos - outStart;
+        if (!ds->bPartial && nHistory >= MAX_PATTERN_PERIOD)
+        {
+            const u64 nTokens = utils::min((pIn->size - pIn->pos) / TOKEN_SIZE, outRoom(pOut) / MAX_TOKEN_OUTPUT);
+            if (nTokens > 0)
+            {
+                auto* pDst = (u8*)pOut->dst + pOut->pos;
+                u64 nWritten = 0;
+                u64 nConsumed = nTokens * TOKEN_SIZE;
+                RLE_STATUS eStatus;
+
+                /* literals only fit pOut up to the first reference, references reaching behind this call's
+                 * output or past the end of pOut are left to the token by token path and the window */
+                if (ds->bRefs)
+                {
+                    u64 size = 0;
+                    while (size < nConsumed && !isRefToken(&pSrc[pIn->pos + size])) size += TOKEN_SIZE;
+                    if (size < nConsumed) size = utils::min(size + REF_SIZE, u64(pIn->size - pIn->pos) & ~u64(TOKEN_SIZE - 1));
+
+                    eStatus = decodeRefTokens(
+                        &pSrc[pIn->pos], size, pDst, utils::min(ds->contentSize - ds->nProduced, outRoom(pOut)),
+                        nHistory, &nWritten, &nConsumed
+                    );
+                }
+                else
+                {
+                    eStatus = decodeTokens(
+                        &pSrc[pIn->pos], nConsumed, pDst, ds->contentSize - ds->nProduced, nHistory, &nWritten
+                    );
+                }
+                if (eStatus != RLE_STATUS_OK) return RLE_STATUS_CORRUPT; /* only contentSize can be overrun */
+
+                if (nConsumed > 0)
+                {
+                    pIn->pos += nConsumed;
+                    pOut->pos += nWritten;
+                    ds->nProduced += nWritten;
+                    DecompressStreamPushHistory(ds, pDst, nWritten);
+                    continue;
+                }
+            }
+        }
+
+        u8 n;
+        if (ds->bPartial)
+        {
+            n = ds->partialRepeat;
+            ds->bPartial = false;
+        }
+        else
+        {
+            n = pSrc[pIn->pos++];
+            if (pIn->pos >= pIn->size)
+            {
+                ds->partialRepeat = n;
+                ds->bPartial = true;
+                return RLE_STATUS_MORE;
+            }
+        }
+
+        const u8 c = pSrc[pIn->pos++];
+        ds->refDistance = 0;
+
+        if (n == 0 && c == 0 && ds->bRefs)
+        {
+            ds->bInRef = true;
+            ds->refPos = 0;
+            continue;
+        }
+
+        if (n != 0)
+        {
+            ds->aPattern[0] = c;
+            ds->period = 1;
+            ds->pendingLen = n;
+        }
+        else
+        {
+            const u64 period = patternPeriod(c);
+            if (ds->nProduced < period) return RLE_STATUS_CORRUPT;
+
+            memcpy(ds->aPattern, &ds->aHistory[MAX_PATTERN_PERIOD - period], period);
+            ds->period = period;
+            ds->pendingLen = period * patternRepeat(c);
+        }
+
+        ds->phase = 0;
+        if (ds->nProduced + ds->pendingLen > ds->contentSize) return RLE_STATUS_CORRUPT;
+        ds->nProduced += ds->pendingLen;
+    }
+}
+
+} /* extern "C" */
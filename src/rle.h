@@ -0,0 +1,151 @@
+/* librle: run-length codec with a stable C ABI.
+ *
+ * Frame layout (native byte order):
+ *     u64 contentSize, the top bit is RLE_FRAME_FLAG_DEDUP
+ *     { u8 nRepeat; u8 charCode; } tokens...
+ *
+ * nRepeat in [1, 255]: charCode repeated nRepeat times.
+ * nRepeat == 0: pattern run, the previous P bytes of output repeated K times,
+ *     with P - 1 in the low and K - 1 in the high nibble of charCode (P, K in [1, 16]).
+ * Only in frames with RLE_FRAME_FLAG_DEDUP: the { 0, 0 } token (P = K = 1, never emitted as a pattern)
+ *     is followed by { u32 distance; u32 length; }, a copy of length bytes starting distance bytes back in the output.
+ *     distance and length are in [1, RLE_DEDUP_WINDOW], the copy may overlap its own output.
+ *
+ * Independently encoded pieces of the same content can be concatenated under one header,
+ * which needs RLE_FRAME_FLAG_DEDUP if any of the pieces has it.
+ * Pieces encoded with RLE_DEDUP_LINKED may reference earlier pieces of their chain, they only decode concatenated in order.
+ * The streaming encoder only emits plain runs. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined _WIN32
+    #if defined RLE_BUILD_SHARED
+        #define RLE_API __declspec(dllexport)
+    #elif defined RLE_USE_SHARED
+        #define RLE_API __declspec(dllimport)
+    #else
+        #define RLE_API
+    #endif
+#elif defined __clang__ || __GNUC__
+    #define RLE_API __attribute__((visibility("default")))
+#else
+    #define RLE_API
+#endif
+
+#define RLE_VERSION_MAJOR 0
+#define RLE_VERSION_MINOR 3
+#define RLE_VERSION_NUMBER (RLE_VERSION_MAJOR * 100 + RLE_VERSION_MINOR)
+
+#define RLE_FRAME_HEADER_SIZE 8
+#define RLE_FRAME_FLAG_DEDUP 0x8000000000000000ULL /* frame may contain back-references */
+#define RLE_DEDUP_WINDOW (32U << 20) /* farthest back-reference, the streaming decoder keeps this much output */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum RLE_STATUS
+{
+    RLE_STATUS_OK = 0,
+    RLE_STATUS_MORE, /* streaming: not finished, provide more input and/or output space */
+    RLE_STATUS_BAD_ARG,
+    RLE_STATUS_DST_TOO_SMALL,
+    RLE_STATUS_CORRUPT,
+    RLE_STATUS_SIZE_MISMATCH, /* streamed input doesn't match contentSize given to *_begin() */
+    RLE_STATUS_NO_MEMORY,
+} RLE_STATUS;
+
+typedef enum RLE_DEDUP
+{
+    RLE_DEDUP_OFF = 0,
+    RLE_DEDUP_FRAME, /* references stay within one call's output */
+    RLE_DEDUP_LINKED, /* references may reach the input of earlier calls on the same context (a chain) */
+} RLE_DEDUP;
+
+typedef struct rle_ctx rle_ctx;
+
+typedef struct rle_record
+{
+    const void* src;
+    size_t size;
+} rle_record;
+
+typedef struct rle_in_buffer
+{
+    const void* src;
+    size_t size;
+    size_t pos; /* advanced by the library */
+} rle_in_buffer;
+
+typedef struct rle_out_buffer
+{
+    void* dst;
+    size_t size;
+    size_t pos; /* advanced by the library */
+} rle_out_buffer;
+
+RLE_API unsigned rle_version_number(void);
+RLE_API const char* rle_status_string(RLE_STATUS eStatus);
+
+/* Contexts own scratch memory, index buffers and (optionally) worker threads.
+ * Reuse one context for many calls: its memory is reset, not freed, between calls.
+ * A context must not be used from multiple threads at once. */
+RLE_API rle_ctx* rle_ctx_create(void); /* single threaded */
+RLE_API rle_ctx* rle_ctx_create_mt(unsigned nThreads); /* 0 means one thread per core, started on first large input */
+RLE_API void rle_ctx_destroy(rle_ctx* pCtx);
+/* drop scratch results, keeps the memory mapped for the next call */
+RLE_API void rle_ctx_reset(rle_ctx* pCtx);
+/* Block deduplication for rle_compress() and rle_compress_scratch() (RLE_DEDUP_OFF by default).
+ * Input is split into content-defined chunks, repeats of an earlier chunk become back-references.
+ * Costs a hashing pass over the input, pays off on data with repeated blocks (disk images, backups, archives).
+ * RLE_DEDUP_LINKED lets a large input compressed piece by piece dedup across pieces, up to RLE_DEDUP_WINDOW back:
+ * the context keeps that much input (32M) plus a chunk index, the outputs must be concatenated in call order
+ * under one header to decode. Failed calls don't join the chain, every call to this function starts a new one.
+ * Batch and streaming compression ignore it. */
+RLE_API RLE_STATUS rle_ctx_set_dedup(rle_ctx* pCtx, RLE_DEDUP eMode);
+
+/* worst case frame size for srcSize bytes of input */
+RLE_API size_t rle_compress_bound(size_t srcSize);
+
+/* content size stored in the frame header */
+RLE_API RLE_STATUS rle_decompressed_size(const void* pSrc, size_t srcSize, uint64_t* pSize);
+
+/* one-shot, *pWritten is set on RLE_STATUS_OK */
+RLE_API RLE_STATUS rle_compress(rle_ctx* pCtx, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pWritten);
+RLE_API RLE_STATUS rle_decompress(rle_ctx* pCtx, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pWritten);
+
+/* One-shot into context owned memory, *ppDst stays valid until the next call with pCtx or rle_ctx_reset() */
+RLE_API RLE_STATUS rle_compress_scratch(rle_ctx* pCtx, const void* pSrc, size_t srcSize, const void** ppDst, size_t* pSize);
+RLE_API RLE_STATUS rle_decompress_scratch(rle_ctx* pCtx, const void* pSrc, size_t srcSize, const void** ppDst, size_t* pSize);
+
+/* Batch compression of many small records. Every record becomes its own frame, frames are packed back to back:
+ * frame i starts at aOffsets[i] and ends at aOffsets[i + 1], so aOffsets has nRecords + 1 entries. */
+RLE_API size_t rle_compress_batch_bound(const rle_record* aRecords, size_t nRecords);
+RLE_API RLE_STATUS rle_compress_batch(
+    rle_ctx* pCtx, const rle_record* aRecords, size_t nRecords, void* pDst, size_t dstCap, uint64_t* aOffsets
+);
+/* same, but frames and offsets live in context memory until the next call with pCtx or rle_ctx_reset() */
+RLE_API RLE_STATUS rle_compress_batch_scratch(
+    rle_ctx* pCtx, const rle_record* aRecords, size_t nRecords, const void** ppDst, const uint64_t** paOffsets
+);
+
+/* Streaming compression:
+ *     rle_compress_stream_begin() once with the total content size,
+ *     rle_compress_stream() until every input chunk is consumed (in->pos == in->size),
+ *     rle_compress_stream_end() until it returns RLE_STATUS_OK (RLE_STATUS_MORE means out is full). */
+RLE_API RLE_STATUS rle_compress_stream_begin(rle_ctx* pCtx, uint64_t contentSize);
+RLE_API RLE_STATUS rle_compress_stream(rle_ctx* pCtx, rle_out_buffer* pOut, rle_in_buffer* pIn);
+RLE_API RLE_STATUS rle_compress_stream_end(rle_ctx* pCtx, rle_out_buffer* pOut);
+
+/* Streaming decompression:
+ *     rle_decompress_stream_begin() once,
+ *     rle_decompress_stream() until it returns RLE_STATUS_OK (whole frame decoded). */
+RLE_API RLE_STATUS rle_decompress_stream_begin(rle_ctx* pCtx);
+RLE_API RLE_STATUS rle_decompress_stream(rle_ctx* pCtx, rle_out_buffer* pOut, rle_in_buffer* pIn);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,79 @@
+#include "adt/Arena.hh"
+#include "adt/defer.hh"
+
+#include <cstdio>
+
+using namespace adt;
+
+#define CHECK(COND)                                                                  \
+    if (!(COND))                                                                     \
+    {                                                                                \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #COND);     \
+        return 1;                                                                    \
+    }
+
+/* p came from one of the arena's blocks, inside its memory */
+static bool
+owned(Arena* s, void* p)
+{
+    ArenaBlock* pBlock = _ArenaFindBlockFromPtr(s, (u8*)p);
+    for (auto* it = s->pBlocks; it; it = it->pNext)
+        if (it == pBlock) return (u8*)p >= it->pMem && (u8*)p < it->pMem + it->size;
+
+    return false;
+}
+
+/* zero sized allocations from an exactly full block */
+static int
+zeroSizeFullBlock(ARENA_BACKING eBacking)
+{
+    Arena a(SIZE_1K * 64, eBacking);
+    defer( ArenaFreeAll(&a) );
+
+    u8* pFill = (u8*)ArenaAlloc(&a, a.defaultCapacity, 1);
+    CHECK(owned(&a, pFill));
+    CHECK(a.pCur->nBytesOccupied == a.pCur->size);
+
+    u8* pZero = (u8*)ArenaZalloc(&a, 0, 1);
+    CHECK(pZero != nullptr && owned(&a, pZero));
+
+    u8* pAlloc = (u8*)ArenaAlloc(&a, 0, 1);
+    CHECK(pAlloc != nullptr && owned(&a, pAlloc) && pAlloc != pZero);
+
+    CHECK(ArenaTryExpand(&a, pAlloc, 16, 1));
+    memset(pAlloc, 0xff, 16);
+
+    u8* pRe = (u8*)ArenaRealloc(&a, pZero, 32, 1);
+    CHECK(owned(&a, pRe));
+
+    return 0;
+}
+
+/* the os refusing a block shows up as nullptr, the arena stays usable */
+static int
+outOfMemory(ARENA_BACKING eBacking)
+{
+    Arena a(SIZE_1K * 64, eBacking);
+    defer( ArenaFreeAll(&a) );
+
+    u8* p = (u8*)ArenaAlloc(&a, 64, 1);
+    CHECK(owned(&a, p));
+
+    CHECK(ArenaAlloc(&a, 1ULL << 50, 1) == nullptr);
+    CHECK(ArenaZalloc(&a, 1ULL << 50, 1) == nullptr);
+    CHECK(ArenaRealloc(&a, p, 1ULL << 50, 1) == nullptr);
+
+    CHECK(owned(&a, ArenaAlloc(&a, 64, 1)));
+
+    return 0;
+}
+
+int
+main()
+{
+    ARENA_BACKING aBackings[] {ARENA_BACKING::HEAP, ARENA_BACKING::MMAP, ARENA_BACKING::HUGE_PAGES};
+    for (auto eBacking : aBackings)
+        if (zeroSizeFullBlock(eBacking) || outOfMemory(eBacking)) return 1;
+
+    return 0;
+}